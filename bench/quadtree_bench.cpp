@@ -0,0 +1,538 @@
+// Benchmark of every stage of the compression pipeline.
+//
+// Runs each stage `--repeat` times on the images of test/ (or the ones given
+// with --image) and on synthetic images, for every error method, and prints
+// the timings as JSON so results can be compared between releases.
+
+#include "error_measurement/error_method_factory.h"
+#include "image/image.h"
+#include "image/image_sequence.h"
+#include "image/sat_kernels.h"
+#include "image/scan_kernels.h"
+#include "quadtree/quadtreeimage.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef QUADTREE_SOURCE_DIR
+#define QUADTREE_SOURCE_DIR "."
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct BenchOptions {
+  std::vector<std::string> images;
+  std::vector<std::pair<int, int>> syntheticSizes;
+  std::vector<std::string> methods = {"VAR", "MAD", "MPD", "ENT", "SIM"};
+  int repeat = 3;
+  int minBlockSize = 4;
+  int threads = 1;
+  bool animation = true;
+  std::string outputPath;
+};
+
+// mid-range thresholds that give a tree of reasonable size for each method
+double defaultThreshold(const std::string &method) {
+  if (method == "VAR")
+    return 100.0;
+  if (method == "MAD")
+    return 10.0;
+  if (method == "MPD")
+    return 30.0;
+  if (method == "ENT")
+    return 3.0;
+  return 0.9; // SIM
+}
+
+struct StageTiming {
+  std::string name;
+  std::vector<double> samplesMs;
+};
+
+template <typename Fn> StageTiming timeStage(const std::string &name,
+                                             int repeat, Fn fn) {
+  StageTiming timing{name, {}};
+  for (int i = 0; i < repeat; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto end = std::chrono::steady_clock::now();
+    timing.samplesMs.push_back(
+        std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return timing;
+}
+
+struct MethodResult {
+  std::string method;
+  double threshold;
+  int depth;
+  int nodeCount;
+  long long estimatedSize;
+  // node memory after the last build; a slab is never left unused, so
+  // the reserved bytes stay within a slab per arena of the used ones however
+  // often the tree is rebuilt
+  size_t arenaBytesReserved;
+  size_t arenaBytesUsed;
+  std::vector<StageTiming> stages;
+};
+
+struct ImageResult {
+  std::string name;
+  std::string source;
+  int width;
+  int height;
+  int channels;
+  std::vector<StageTiming> stages;
+  std::vector<MethodResult> methods;
+};
+
+// gradient background with flat rectangles and a noisy corner, so every
+// method produces a tree with both large and small leaves
+Image makeSyntheticImage(int width, int height) {
+  Image image(width, height, 3, ".png");
+  unsigned char *data = image.getImageData();
+  uint32_t state = 0x9e3779b9u;
+  auto nextRandom = [&state]() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  };
+
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      unsigned char *pixel = data + (static_cast<size_t>(y) * width + x) * 3;
+      pixel[0] = static_cast<unsigned char>(x * 255 / (std::max)(1, width));
+      pixel[1] = static_cast<unsigned char>(y * 255 / (std::max)(1, height));
+      pixel[2] = 128;
+      if (x > width * 3 / 4 && y > height * 3 / 4) {
+        const uint32_t noise = nextRandom();
+        pixel[0] = static_cast<unsigned char>(noise);
+        pixel[1] = static_cast<unsigned char>(noise >> 8);
+        pixel[2] = static_cast<unsigned char>(noise >> 16);
+      }
+    }
+  }
+  for (int i = 0; i < 16; ++i) {
+    const int x = nextRandom() % (std::max)(1, width);
+    const int y = nextRandom() % (std::max)(1, height);
+    const int w = nextRandom() % (std::max)(1, width / 4) + 1;
+    const int h = nextRandom() % (std::max)(1, height / 4) + 1;
+    const uint32_t color = nextRandom();
+    image.setBlockColorAt(x, y, w, h, static_cast<unsigned char>(color),
+                          static_cast<unsigned char>(color >> 8),
+                          static_cast<unsigned char>(color >> 16));
+  }
+  return image;
+}
+
+// the build thread and every worker fill one slab at a time
+bool isArenaLeaking(const MethodResult &result, int threads) {
+  const size_t slabBytes = NodeArena::DEFAULT_SLAB_NODES * sizeof(QuadtreeNode);
+  return result.arenaBytesReserved >
+         result.arenaBytesUsed + (threads + 1) * slabBytes;
+}
+
+void benchMethods(const Image &image, const BenchOptions &options,
+                  const fs::path &scratchDir, ImageResult &result) {
+  const fs::path outputPath = scratchDir / ("output" + image.getFileExt());
+  const fs::path gifPath = scratchDir / "output.gif";
+
+  for (const auto &methodId : options.methods) {
+    std::unique_ptr<ErrorMethod> method(EMM::createFromIdentifier(methodId));
+    if (!method) {
+      std::cerr << "Unknown method " << methodId << ", skipped" << std::endl;
+      continue;
+    }
+
+    MethodResult methodResult;
+    methodResult.method = method->getIdentifier();
+    methodResult.threshold = defaultThreshold(methodResult.method);
+
+    QuadtreeImage quadtree(image, methodResult.threshold, options.minBlockSize,
+                           method.get());
+    quadtree.setThreadCount(options.threads);
+    methodResult.stages.push_back(timeStage(
+        "build", options.repeat, [&quadtree]() { quadtree.build(); }));
+    methodResult.arenaBytesReserved = quadtree.getArenaBytesReserved();
+    methodResult.arenaBytesUsed = quadtree.getArenaBytesUsed();
+    if (isArenaLeaking(methodResult, options.threads)) {
+      std::cerr << "Node memory of " << methodResult.method << " reserved "
+                << methodResult.arenaBytesReserved << " bytes for "
+                << methodResult.arenaBytesUsed << " used after "
+                << options.repeat << " builds" << std::endl;
+    }
+    methodResult.depth = quadtree.getDepth();
+    methodResult.nodeCount = quadtree.getNodeCount();
+
+    std::unique_ptr<Image> output;
+    methodResult.stages.push_back(
+        timeStage("apply", options.repeat, [&quadtree, &output]() {
+          output = std::make_unique<Image>(quadtree.apply());
+        }));
+    methodResult.stages.push_back(
+        timeStage("estimateFileSize", options.repeat, [&]() {
+          methodResult.estimatedSize = output->estimateFileSize();
+        }));
+    methodResult.stages.push_back(
+        timeStage("save", options.repeat,
+                  [&]() { output->save(outputPath.string()); }));
+
+    // the same tree kept as Z-ordered leaf codes (see LinearQuadtree)
+    QuadtreeImage linearQuadtree(image, methodResult.threshold,
+                                 options.minBlockSize, method.get());
+    linearQuadtree.setThreadCount(options.threads);
+    linearQuadtree.setRepresentation(QuadtreeImage::Representation::Linear);
+    methodResult.stages.push_back(
+        timeStage("buildLinear", options.repeat,
+                  [&linearQuadtree]() { linearQuadtree.build(); }));
+    std::unique_ptr<Image> linearOutput;
+    methodResult.stages.push_back(
+        timeStage("applyLinear", options.repeat, [&]() {
+          linearOutput = std::make_unique<Image>(linearQuadtree.apply());
+        }));
+    const size_t outputBytes = static_cast<size_t>(output->getWidth()) *
+                               output->getHeight() * output->getChannels();
+    if (std::memcmp(output->getImageData(), linearOutput->getImageData(),
+                    outputBytes) != 0) {
+      std::cerr << "Linear tree of " << methodResult.method
+                << " paints other pixels than the node tree" << std::endl;
+    }
+    output.reset();
+    linearOutput.reset();
+
+    if (options.animation) {
+      std::unique_ptr<ImageSequence> sequence;
+      methodResult.stages.push_back(
+          timeStage("applyAnimation", options.repeat, [&]() {
+            sequence =
+                std::make_unique<ImageSequence>(quadtree.applyAnimation());
+          }));
+      methodResult.stages.push_back(
+          timeStage("saveGif", options.repeat,
+                    [&]() { sequence->save(gifPath.string()); }));
+    }
+
+    result.methods.push_back(std::move(methodResult));
+  }
+}
+
+void benchPrecompute(Image &image, int repeat, ImageResult &result) {
+  result.stages.push_back(
+      timeStage("computeSummedAreaTable", repeat,
+                [&image]() { image.computeSummedAreaTable(); }));
+  result.stages.push_back(
+      timeStage("computeSummedSquareTable", repeat,
+                [&image]() { image.computeSummedSquareTable(); }));
+  result.stages.push_back(
+      timeStage("computeMinMaxPyramid", repeat,
+                [&image]() { image.computeMinMaxPyramid(); }));
+  result.stages.push_back(
+      timeStage("computeEntropyPyramid", repeat,
+                [&image]() { image.computeEntropyPyramid(); }));
+
+  // the fused kernel once per instruction set the CPU supports, for both
+  // record widths
+  const size_t recordCount = static_cast<size_t>(image.getWidth() + 1) *
+                             (image.getHeight() + 1);
+  std::vector<long long> wideRecords(recordCount * 2 * SatKernels::kLanes);
+  std::vector<uint32_t> compactRecords(recordCount * 2 * SatKernels::kLanes);
+  for (SatKernels::InstructionSet set :
+       {SatKernels::InstructionSet::Scalar, SatKernels::InstructionSet::SSE2,
+        SatKernels::InstructionSet::AVX2}) {
+    if (set > SatKernels::detectInstructionSet()) {
+      continue;
+    }
+    const std::string setName = SatKernels::getInstructionSetName(set);
+    result.stages.push_back(
+        timeStage("summedTables64_" + setName, repeat, [&]() {
+          SatKernels::computeSummedTables(
+              image.getImageData(), image.getWidth(), image.getHeight(),
+              image.getChannels(), wideRecords.data(), true, set);
+        }));
+    result.stages.push_back(
+        timeStage("summedTables32_" + setName, repeat, [&]() {
+          SatKernels::computeSummedTables(
+              image.getImageData(), image.getWidth(), image.getHeight(),
+              image.getChannels(), compactRecords.data(), true, set);
+        }));
+    // the scan kernels of the error methods over the whole image
+    const size_t rowStride =
+        static_cast<size_t>(image.getWidth()) * image.getChannels();
+    result.stages.push_back(
+        timeStage("flooredDeviations_" + setName, repeat, [&]() {
+          ScanKernels::sumFlooredDeviations(
+              image.getImageData(), rowStride, image.getWidth(),
+              image.getHeight(), image.getChannels(), {127, 127, 127},
+              {true, true, true}, set);
+        }));
+    result.stages.push_back(
+        timeStage("channelRange_" + setName, repeat, [&]() {
+          ScanKernels::findChannelRange(image.getImageData(), rowStride,
+                                        image.getWidth(), image.getHeight(),
+                                        image.getChannels(), set);
+        }));
+  }
+}
+
+ImageResult benchFile(const std::string &path, const BenchOptions &options,
+                      const fs::path &scratchDir) {
+  ImageResult result;
+  result.name = fs::path(path).filename().string();
+  result.source = "file";
+
+  std::unique_ptr<Image> image;
+  bool loadFailed = false;
+  result.stages.push_back(timeStage("load", options.repeat, [&]() {
+    image = std::make_unique<Image>(path);
+    loadFailed = image->load();
+  }));
+  if (loadFailed) {
+    std::cerr << "Failed to load " << path << ", skipped" << std::endl;
+    result.width = result.height = result.channels = 0;
+    return result;
+  }
+
+  result.width = image->getWidth();
+  result.height = image->getHeight();
+  result.channels = image->getChannels();
+  benchPrecompute(*image, options.repeat, result);
+  benchMethods(*image, options, scratchDir, result);
+  return result;
+}
+
+ImageResult benchSynthetic(int width, int height, const BenchOptions &options,
+                           const fs::path &scratchDir) {
+  ImageResult result;
+  result.name =
+      "synthetic_" + std::to_string(width) + "x" + std::to_string(height);
+  result.source = "synthetic";
+  result.width = width;
+  result.height = height;
+  result.channels = 3;
+
+  std::unique_ptr<Image> image;
+  result.stages.push_back(timeStage("generate", options.repeat, [&]() {
+    image = std::make_unique<Image>(makeSyntheticImage(width, height));
+  }));
+
+  benchPrecompute(*image, options.repeat, result);
+  benchMethods(*image, options, scratchDir, result);
+  return result;
+}
+
+std::string jsonEscape(const std::string &text) {
+  std::string escaped;
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped;
+}
+
+void writeStages(std::ostream &out, const std::vector<StageTiming> &stages,
+                 const std::string &indent) {
+  out << "{";
+  for (size_t i = 0; i < stages.size(); ++i) {
+    std::vector<double> samples = stages[i].samplesMs;
+    std::sort(samples.begin(), samples.end());
+    const double mean =
+        std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+
+    out << (i ? "," : "") << "\n"
+        << indent << "  \"" << stages[i].name << "\": {\"min_ms\": "
+        << samples.front() << ", \"median_ms\": " << samples[samples.size() / 2]
+        << ", \"mean_ms\": " << mean << ", \"max_ms\": " << samples.back()
+        << "}";
+  }
+  out << "\n" << indent << "}";
+}
+
+void writeJson(std::ostream &out, const BenchOptions &options,
+               const std::vector<ImageResult> &results) {
+  out << std::fixed << std::setprecision(3);
+  out << "{\n"
+      << "  \"repeat\": " << options.repeat << ",\n"
+      << "  \"min_block_size\": " << options.minBlockSize << ",\n"
+      << "  \"threads\": " << options.threads << ",\n"
+      << "  \"sat_kernel\": \""
+      << SatKernels::getInstructionSetName(SatKernels::detectInstructionSet())
+      << "\",\n"
+      << "  \"images\": [";
+
+  for (size_t i = 0; i < results.size(); ++i) {
+    const ImageResult &image = results[i];
+    out << (i ? "," : "") << "\n    {\n"
+        << "      \"name\": \"" << jsonEscape(image.name) << "\",\n"
+        << "      \"source\": \"" << image.source << "\",\n"
+        << "      \"width\": " << image.width << ",\n"
+        << "      \"height\": " << image.height << ",\n"
+        << "      \"channels\": " << image.channels << ",\n"
+        << "      \"stages\": ";
+    writeStages(out, image.stages, "      ");
+    out << ",\n      \"methods\": [";
+
+    for (size_t j = 0; j < image.methods.size(); ++j) {
+      const MethodResult &method = image.methods[j];
+      out << (j ? "," : "") << "\n        {\n"
+          << "          \"method\": \"" << method.method << "\",\n"
+          << "          \"threshold\": " << method.threshold << ",\n"
+          << "          \"depth\": " << method.depth << ",\n"
+          << "          \"node_count\": " << method.nodeCount << ",\n"
+          << "          \"estimated_size\": " << method.estimatedSize << ",\n"
+          << "          \"arena_bytes_reserved\": "
+          << method.arenaBytesReserved << ",\n"
+          << "          \"stages\": ";
+      writeStages(out, method.stages, "          ");
+      out << "\n        }";
+    }
+    out << "\n      ]\n    }";
+  }
+  out << "\n  ]\n}\n";
+}
+
+std::string usage() {
+  return "Usage: quadtree_bench [options]\n"
+         "\n"
+         "Options:\n"
+         "  --image <path>        benchmark this image (repeatable), "
+         "defaults to test/\n"
+         "  --synthetic <WxH>     add a synthetic image (repeatable), "
+         "defaults to 1024x1024\n"
+         "  --methods <list>      comma separated methods "
+         "(VAR,MAD,MPD,ENT,SIM)\n"
+         "  --repeat <n>          runs per stage (3)\n"
+         "  --min-block <pixels>  minimum block size (4)\n"
+         "  --threads <n>         quadtree build threads (1)\n"
+         "  --no-animation        skip applyAnimation and GIF saving\n"
+         "  --output <path>       write the JSON report to a file\n";
+}
+
+bool parseArguments(int argc, char **argv, BenchOptions &options) {
+  bool methodsGiven = false;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--no-animation") {
+      options.animation = false;
+      continue;
+    }
+    if (arg == "--help" || i + 1 >= argc) {
+      return false;
+    }
+
+    const std::string value = argv[++i];
+    try {
+      if (arg == "--image") {
+        options.images.push_back(value);
+      } else if (arg == "--synthetic") {
+        const size_t separator = value.find('x');
+        if (separator == std::string::npos) {
+          return false;
+        }
+        options.syntheticSizes.emplace_back(
+            std::stoi(value.substr(0, separator)),
+            std::stoi(value.substr(separator + 1)));
+      } else if (arg == "--methods") {
+        if (!methodsGiven) {
+          options.methods.clear();
+          methodsGiven = true;
+        }
+        std::stringstream list(value);
+        std::string method;
+        while (std::getline(list, method, ',')) {
+          options.methods.push_back(method);
+        }
+      } else if (arg == "--repeat") {
+        options.repeat = (std::max)(1, std::stoi(value));
+      } else if (arg == "--min-block") {
+        options.minBlockSize = (std::max)(1, std::stoi(value));
+      } else if (arg == "--threads") {
+        options.threads = (std::max)(1, std::stoi(value));
+      } else if (arg == "--output") {
+        options.outputPath = value;
+      } else {
+        return false;
+      }
+    } catch (const std::exception &) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  if (!parseArguments(argc, argv, options)) {
+    std::cerr << usage();
+    return 1;
+  }
+
+  if (options.images.empty()) {
+    const fs::path testDir = fs::path(QUADTREE_SOURCE_DIR) / "test";
+    if (fs::is_directory(testDir)) {
+      for (const auto &entry : fs::directory_iterator(testDir)) {
+        const std::string name = entry.path().filename().string();
+        const std::string ext = entry.path().extension().string();
+        // test/out* are outputs of earlier runs
+        if (entry.is_regular_file() && name.rfind("out", 0) != 0 &&
+            (ext == ".png" || ext == ".jpg" || ext == ".bmp")) {
+          options.images.push_back(entry.path().string());
+        }
+      }
+      std::sort(options.images.begin(), options.images.end());
+    }
+  }
+  if (options.syntheticSizes.empty()) {
+    options.syntheticSizes.emplace_back(1024, 1024);
+  }
+
+  const fs::path scratchDir = fs::temp_directory_path() / "quadtree_bench";
+  fs::create_directories(scratchDir);
+
+  std::vector<ImageResult> results;
+  for (const auto &path : options.images) {
+    std::cerr << "Benchmarking " << path << std::endl;
+    results.push_back(benchFile(path, options, scratchDir));
+  }
+  for (const auto &[width, height] : options.syntheticSizes) {
+    std::cerr << "Benchmarking synthetic " << width << "x" << height
+              << std::endl;
+    results.push_back(benchSynthetic(width, height, options, scratchDir));
+  }
+
+  std::error_code ec;
+  fs::remove_all(scratchDir, ec);
+
+  if (options.outputPath.empty()) {
+    writeJson(std::cout, options, results);
+  } else {
+    std::ofstream out(options.outputPath);
+    writeJson(out, options, results);
+  }
+  // node memory growing over rebuilds is a leak, fail the run
+  for (const ImageResult &image : results) {
+    for (const MethodResult &method : image.methods) {
+      if (isArenaLeaking(method, options.threads)) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,350 @@
+#include "batch_runner.h"
+#include "codec/qtc_codec.h"
+#include "controller/compression_controller.h"
+#include "error_measurement/error_method_factory.h"
+#include "quadtree/quadtreeimage.h"
+#include "utils/instrumentation.h"
+#include "utils/thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace {
+bool isSupportedImage(const fs::path &path) {
+  std::string ext = path.extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga" ||
+         ext == ".bmp";
+}
+
+bool parseNumber(const std::string &text, double &value) {
+  try {
+    size_t consumed = 0;
+    value = std::stod(text, &consumed);
+    return consumed == text.size();
+  } catch (const std::exception &) {
+    return false;
+  }
+}
+} // namespace
+
+BatchRunner::BatchRunner(const BatchOptions &options) : mOptions(options) {}
+
+std::string BatchRunner::usage() {
+  return "Usage: quadtree_image_compressor --batch <dir|list.txt|image> "
+         "--out <dir> [options]\n"
+         "       quadtree_image_compressor --decode <file.qtc|-> <image>\n"
+         "\n"
+         "Options:\n"
+         "  --method <VAR|MAD|MPD|ENT|SIM>  error measurement method (VAR)\n"
+         "  --threshold <value>             error threshold\n"
+         "  --min-block <pixels>            minimum block size (1)\n"
+         "  --target <0..1>                 target compression, 0 = none\n"
+         "  --jobs <n>                      images compressed concurrently\n"
+         "  --threads <n>                   build threads per image (1)\n"
+         "  --report-dir <dir>              write a JSON report per image\n"
+         "  --tile <pixels>                 compress in independent tiles\n"
+         "  --target-probes <n>             thresholds probed per round (1)\n"
+         "  --format <input|qtc|qtc-progressive>\n"
+         "                                  output format (input)\n"
+         "  --palette <exact|quantize|off>  indexed PNG output (exact)\n"
+         "  --split <half|mcu>              JPEG block split positions "
+         "(half)\n"
+         "  --linear                        build a linear quadtree\n";
+}
+
+bool BatchRunner::parseArguments(const std::vector<std::string> &args,
+                                 BatchOptions &options, std::string &error) {
+  for (size_t i = 0; i < args.size(); ++i) {
+    const std::string &arg = args[i];
+    // the only switch, every other option takes a value
+    if (arg == "--linear") {
+      options.linear = true;
+      continue;
+    }
+    if (i + 1 >= args.size()) {
+      error = "Missing value for " + arg;
+      return false;
+    }
+    const std::string &value = args[++i];
+    double number = 0.0;
+
+    if (arg == "--batch") {
+      options.inputPath = value;
+    } else if (arg == "--out") {
+      options.outputDirectory = value;
+    } else if (arg == "--method") {
+      options.method = value;
+    } else if (arg == "--threshold" && parseNumber(value, number)) {
+      options.threshold = number;
+    } else if (arg == "--min-block" && parseNumber(value, number)) {
+      options.minBlockSize = static_cast<int>(number);
+    } else if (arg == "--target" && parseNumber(value, number)) {
+      options.targetCompression = number;
+    } else if (arg == "--jobs" && parseNumber(value, number)) {
+      options.jobs = static_cast<int>(number);
+    } else if (arg == "--threads" && parseNumber(value, number)) {
+      options.threadsPerJob = static_cast<int>(number);
+    } else if (arg == "--tile" && parseNumber(value, number)) {
+      options.tileSize = static_cast<int>(number);
+    } else if (arg == "--target-probes" && parseNumber(value, number)) {
+      options.targetProbes = static_cast<int>(number);
+    } else if (arg == "--format") {
+      options.format = value;
+    } else if (arg == "--split") {
+      options.split = value;
+    } else if (arg == "--palette") {
+      options.palette = value;
+    } else if (arg == "--report-dir") {
+      options.reportDirectory = value;
+    } else {
+      error = "Invalid argument: " + arg + " " + value;
+      return false;
+    }
+  }
+
+  if (options.inputPath.empty() || options.outputDirectory.empty()) {
+    error = "--batch and --out are required";
+    return false;
+  }
+  std::unique_ptr<ErrorMethod> method(
+      EMM::createFromIdentifier(options.method));
+  if (!method) {
+    error = "Unknown method " + options.method;
+    return false;
+  }
+  if (options.targetCompression < 0.0 || options.targetCompression > 1.0) {
+    error = "Target compression must be between 0 and 1";
+    return false;
+  }
+  if (options.targetCompression == 0.0 &&
+      !method->isInErrorBound(options.threshold)) {
+    std::ostringstream message;
+    message << "Threshold must be between " << method->getLowerBound()
+            << " and " << method->getUpperBound();
+    error = message.str();
+    return false;
+  }
+  if (options.minBlockSize < 1 || options.jobs < 0 ||
+      options.threadsPerJob < 1 || options.tileSize < 0 ||
+      options.targetProbes < 1) {
+    error = "Block size, jobs, threads, tile size and target probes must be "
+            "positive";
+    return false;
+  }
+  if (options.format != "input" && options.format != "qtc" &&
+      options.format != "qtc-progressive") {
+    error = "Unknown format " + options.format;
+    return false;
+  }
+  if (options.palette != "exact" && options.palette != "quantize" &&
+      options.palette != "off") {
+    error = "Unknown palette " + options.palette;
+    return false;
+  }
+  if (options.split != "half" && options.split != "mcu") {
+    error = "Unknown split " + options.split;
+    return false;
+  }
+  if (options.tileSize > 0 &&
+      (options.targetCompression > 0.0 || options.format != "input")) {
+    error = "--tile can't be combined with --target or a .qtc format";
+    return false;
+  }
+  return true;
+}
+
+bool BatchRunner::collectInputs(std::string &error) {
+  mInputs.clear();
+  const fs::path inputPath(mOptions.inputPath);
+
+  if (fs::is_directory(inputPath)) {
+    for (const auto &entry : fs::directory_iterator(inputPath)) {
+      if (entry.is_regular_file() && isSupportedImage(entry.path())) {
+        mInputs.push_back(entry.path().string());
+      }
+    }
+    std::sort(mInputs.begin(), mInputs.end());
+  } else if (fs::is_regular_file(inputPath) && isSupportedImage(inputPath)) {
+    mInputs.push_back(inputPath.string());
+  } else if (fs::is_regular_file(inputPath)) {
+    std::ifstream list(inputPath);
+    std::string line;
+    while (std::getline(list, line)) {
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      if (!line.empty()) {
+        mInputs.push_back(line);
+      }
+    }
+  } else {
+    error = "Input path doesn't exist: " + mOptions.inputPath;
+    return false;
+  }
+
+  // every output and report is named after its input alone, two inputs
+  // with the same name would overwrite each other's files
+  std::map<fs::path, std::string> writers;
+  for (const std::string &input : mInputs) {
+    std::vector<fs::path> paths = {getOutputPath(input)};
+    if (!mOptions.reportDirectory.empty()) {
+      paths.push_back(getReportPath(input));
+    }
+    for (const fs::path &path : paths) {
+      const auto [writer, isNew] = writers.emplace(path, input);
+      if (!isNew) {
+        error = "Inputs " + writer->second + " and " + input +
+                " would both be written to " + path.string();
+        return false;
+      }
+    }
+  }
+
+  std::error_code ec;
+  fs::create_directories(mOptions.outputDirectory, ec);
+  if (!fs::is_directory(mOptions.outputDirectory)) {
+    error = "Cannot create output directory: " + mOptions.outputDirectory;
+    return false;
+  }
+  if (!mOptions.reportDirectory.empty()) {
+    fs::create_directories(mOptions.reportDirectory, ec);
+    if (!fs::is_directory(mOptions.reportDirectory)) {
+      error = "Cannot create report directory: " + mOptions.reportDirectory;
+      return false;
+    }
+  }
+  return true;
+}
+
+fs::path BatchRunner::getOutputPath(const std::string &inputPath) const {
+  fs::path outputPath =
+      fs::path(mOptions.outputDirectory) / fs::path(inputPath).filename();
+  if (mOptions.format != "input") {
+    outputPath.replace_extension(QTC::kFileExt);
+  }
+  return outputPath.lexically_normal();
+}
+
+fs::path BatchRunner::getReportPath(const std::string &inputPath) const {
+  return (fs::path(mOptions.reportDirectory) /
+          fs::path(inputPath).filename().replace_extension(".json"))
+      .lexically_normal();
+}
+
+BatchSummary BatchRunner::run() {
+  BatchSummary summary;
+  std::atomic<size_t> succeeded(0), failed(0), inputBytes(0), outputBytes(0);
+  std::atomic<size_t> finished(0);
+  std::mutex outputMutex;
+
+  const int jobs =
+      mOptions.jobs > 0 ? mOptions.jobs : ThreadPool::defaultThreadCount();
+  const size_t total = mInputs.size();
+
+  QuadtreeImage::PaletteMode paletteMode = QuadtreeImage::PaletteMode::Exact;
+  if (mOptions.palette == "quantize") {
+    paletteMode = QuadtreeImage::PaletteMode::Quantize;
+  } else if (mOptions.palette == "off") {
+    paletteMode = QuadtreeImage::PaletteMode::Off;
+  }
+
+  auto compressOne = [&](const std::string &inputPath) {
+    CompressionController controller;
+    const fs::path outputPath = getOutputPath(inputPath);
+    const fs::path reportPath = mOptions.reportDirectory.empty()
+                                    ? fs::path()
+                                    : getReportPath(inputPath);
+
+    bool isSuccess =
+        controller.setInputPath(inputPath) &&
+        controller.setErrorMethod(EMM::createFromIdentifier(mOptions.method)) &&
+        controller.setMinBlockSize(mOptions.minBlockSize) &&
+        controller.setTargetCompression(mOptions.targetCompression) &&
+        controller.setThreadCount(mOptions.threadsPerJob) &&
+        controller.setTargetProbeCount(mOptions.targetProbes) &&
+        controller.setTileSize(mOptions.tileSize) &&
+        controller.setOutputPath(outputPath.string()) &&
+        controller.setQtcLayout(mOptions.format == "qtc-progressive"
+                                    ? QTC::Layout::Progressive
+                                    : QTC::Layout::DepthFirst) &&
+        controller.setPaletteMode(paletteMode) &&
+        controller.setAlignSplitsToMcu(mOptions.split == "mcu") &&
+        controller.setUseLinearTree(mOptions.linear) &&
+        controller.setGifOutputPath("") &&
+        controller.setReportPath(reportPath.string());
+    if (isSuccess) {
+      const double threshold =
+          mOptions.targetCompression > 0.0
+              ? controller.getErrorMethod()->getLowerBound()
+              : mOptions.threshold;
+      isSuccess = controller.setThreshold(threshold) &&
+                  controller.run([](const ProgressStage &) {});
+    }
+
+    const CompressionResult result = controller.getResult();
+    const size_t index = ++finished;
+    if (isSuccess) {
+      ++succeeded;
+      inputBytes += result.originalFileSize;
+      outputBytes += result.compressedFileSize;
+    } else {
+      ++failed;
+    }
+
+    std::lock_guard<std::mutex> lock(outputMutex);
+    std::cout << "[" << index << "/" << total << "] " << inputPath;
+    if (isSuccess) {
+      std::cout << " -> " << result.outputFilePath << " (" << std::fixed
+                << std::setprecision(2) << result.compressionPercentage
+                << "%)" << std::endl;
+    } else {
+      std::cout << " FAILED" << std::endl;
+    }
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  {
+    ThreadPool pool(jobs);
+    for (const auto &input : mInputs) {
+      pool.submit([&compressOne, &input]() { compressOne(input); });
+    }
+    pool.wait();
+  }
+  const auto end = std::chrono::steady_clock::now();
+
+  summary.succeeded = succeeded;
+  summary.failed = failed;
+  summary.inputBytes = inputBytes;
+  summary.outputBytes = outputBytes;
+  summary.wallSeconds = std::chrono::duration<double>(end - start).count();
+  summary.peakMemoryBytes = peakResidentBytes();
+
+  const double seconds = summary.wallSeconds > 0 ? summary.wallSeconds : 1e-9;
+  std::cout << std::endl
+            << "Compressed " << summary.succeeded << " images (" << summary.failed
+            << " failed) in " << std::fixed << std::setprecision(2)
+            << summary.wallSeconds << " s with " << jobs << " jobs"
+            << std::endl
+            << "Throughput: " << summary.succeeded / seconds << " images/s, "
+            << summary.inputBytes / (1024.0 * 1024.0) / seconds << " MB/s"
+            << std::endl
+            << "Total size: " << summary.inputBytes / (1024.0 * 1024.0)
+            << " MB -> " << summary.outputBytes / (1024.0 * 1024.0) << " MB"
+            << std::endl
+            << "Peak memory: "
+            << summary.peakMemoryBytes / (1024.0 * 1024.0) << " MB"
+            << std::endl;
+  return summary;
+}
@@ -0,0 +1,71 @@
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+struct BatchOptions {
+  std::string inputPath; // directory, list file (one path per line) or image
+  std::string outputDirectory;
+  std::string method = "VAR";
+  double threshold = -1;
+  int minBlockSize = 1;
+  double targetCompression = 0.0;
+  int jobs = 0;          // concurrent images, 0 = hardware concurrency
+  int threadsPerJob = 1; // quadtree build threads of a single image
+  std::string reportDirectory; // per-image JSON reports, empty = none
+  int tileSize = 0; // independent square tiles per image, 0 = whole image
+  int targetProbes = 1; // thresholds encoded concurrently per target round
+  // "input" keeps the input format, "qtc" or "qtc-progressive" save the tree
+  std::string format = "input";
+  // indexed PNG output: "exact", "quantize" or "off" (see
+  // QuadtreeImage::PaletteMode)
+  std::string palette = "exact";
+  // "half" splits blocks at the middle, "mcu" a JPEG output on its MCU grid
+  std::string split = "half";
+  // builds and applies the leaves as a LinearQuadtree instead of nodes (see
+  // QuadtreeImage::Representation), the output is the same
+  bool linear = false;
+};
+
+struct BatchSummary {
+  size_t succeeded = 0;
+  size_t failed = 0;
+  size_t inputBytes = 0;
+  size_t outputBytes = 0;
+  double wallSeconds = 0.0;
+  // of the whole process, every job running at once adds to it
+  size_t peakMemoryBytes = 0;
+};
+
+// Headless compression of many images: every image runs through its own
+// CompressionController on a pool of `jobs` workers, so at most `jobs`
+// images are resident at a time.
+class BatchRunner {
+public:
+  explicit BatchRunner(const BatchOptions &options);
+
+  // parses the command line arguments after the program name, returns false
+  // and fills `error` when they are invalid
+  static bool parseArguments(const std::vector<std::string> &args,
+                             BatchOptions &options, std::string &error);
+  static std::string usage();
+
+  // false as well when two inputs would be written to the same output or
+  // report path
+  bool collectInputs(std::string &error);
+  BatchSummary run();
+
+  const std::vector<std::string> &getInputs() const { return mInputs; }
+
+private:
+  BatchOptions mOptions;
+  std::vector<std::string> mInputs;
+
+  std::filesystem::path getOutputPath(const std::string &inputPath) const;
+  std::filesystem::path getReportPath(const std::string &inputPath) const;
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include "error_measurement/emm_mpd.h"
 #include "error_measurement/emm_ssim.h"
 #include "error_measurement/emm_variance.h"
+#include "utils/instrumentation.h"
 #include "utils/style.h"
 #include <algorithm>
 #include <climits>
@@ -966,6 +967,21 @@ CompressionResult CLI::run() {
   std::cout << BOLD << "  Performance Metrics" << RESET << std::endl;
   std::cout << "  " << std::left << std::setw(labelWidth)
             << "Computation Time:" << timeStr << std::endl;
+  for (const StageMetrics &metrics : result.stageMetrics) {
+    std::cout << "    " << std::left << std::setw(labelWidth - 2)
+              << progressStageName(metrics.stage) << std::fixed
+              << std::setprecision(2) << metrics.wallMs << " ms wall, "
+              << metrics.cpuMs << " ms cpu" << std::endl;
+  }
+  std::cout << "  " << std::left << std::setw(labelWidth)
+            << "Error Evaluations:" << result.errorEvaluations << std::endl;
+  std::cout << "  " << std::left << std::setw(labelWidth)
+            << "Pixels Scanned:" << result.scannedPixels << std::endl;
+  std::cout << "  " << std::left << std::setw(labelWidth)
+            << "Encodes:" << result.encodeCount << std::endl;
+  std::cout << "  " << std::left << std::setw(labelWidth)
+            << "Peak Memory:" << formatSize(peakResidentBytes())
+            << std::endl;
 
   std::cout << std::endl << BOLD << "  File Information" << RESET << std::endl;
   std::cout << "  " << std::left << std::setw(labelWidth)
@@ -984,6 +1000,10 @@ CompressionResult CLI::run() {
             << "Tree Depth:" << result.quadtreeDepth << std::endl;
   std::cout << "  " << std::left << std::setw(labelWidth)
             << "Node Count:" << result.quadtreeNodeCount << std::endl;
+  std::cout << "  " << std::left << std::setw(labelWidth)
+            << "Node Memory:" << formatSize(result.nodeArenaBytesUsed) << " / "
+            << formatSize(result.nodeArenaBytesReserved) << " ("
+            << result.nodeArenaSlabCount << " slabs)" << std::endl;
 
   if (compression.getTargetCompression()) {
 
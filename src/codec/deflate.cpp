@@ -0,0 +1,572 @@
+#include "deflate.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <utility>
+
+namespace Deflate {
+namespace {
+
+constexpr int kMinMatch = 3;
+constexpr int kMaxMatch = 258;
+// a match of length 3 this far back costs more than its literals
+constexpr size_t kTooFar = 4096;
+// chain candidates tried per position, and the match length past which the
+// next position isn't tried for a longer one
+constexpr int kMaxChain = 64;
+constexpr int kLazyLimit = 32;
+constexpr int kHashBits = 15;
+// symbols per block, each block gets codes of its own
+constexpr size_t kBlockSymbols = 1 << 15;
+
+constexpr int kLiteralCodes = 286;
+constexpr int kFixedLiteralCodes = 288;
+constexpr int kDistanceCodes = 30;
+constexpr int kCodeLengthCodes = 19;
+constexpr int kEndOfBlock = 256;
+constexpr int kMaxBits = 15;
+constexpr int kMaxCodeLengthBits = 7;
+
+constexpr int kLengthBase[29] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                                 15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                                 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr int kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                  1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                  4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr int kDistanceBase[30] = {
+    1,    2,    3,    4,    5,    7,    9,    13,    17,    25,
+    33,   49,   65,   97,   129,  193,  257,  385,   513,   769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+constexpr int kDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                    4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                    9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+constexpr int kCodeLengthOrder[kCodeLengthCodes] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// length and distance codes by value, built once
+struct CodeTables {
+  std::array<unsigned char, kMaxMatch + 1> lengthCode;
+  // distance - 1 below 256, then (distance - 1) >> 7
+  std::array<unsigned char, 512> distanceCode;
+
+  CodeTables() {
+    for (int code = 0; code < 29; ++code) {
+      const int last = code == 28 ? kMaxMatch
+                                  : kLengthBase[code] +
+                                        (1 << kLengthExtra[code]) - 1;
+      for (int length = kLengthBase[code]; length <= last; ++length) {
+        lengthCode[length] = static_cast<unsigned char>(code);
+      }
+    }
+    for (int code = 0; code < kDistanceCodes; ++code) {
+      const int first = kDistanceBase[code] - 1;
+      const int last = first + (1 << kDistanceExtra[code]) - 1;
+      for (int distance = first; distance <= last; ++distance) {
+        if (distance < 256) {
+          distanceCode[distance] = static_cast<unsigned char>(code);
+        } else {
+          distanceCode[256 + (distance >> 7)] =
+              static_cast<unsigned char>(code);
+        }
+      }
+    }
+  }
+
+  int getDistanceCode(int distance) const {
+    const int value = distance - 1;
+    return value < 256 ? distanceCode[value]
+                       : distanceCode[256 + (value >> 7)];
+  }
+};
+
+const CodeTables &codeTables() {
+  static const CodeTables tables;
+  return tables;
+}
+
+// a literal when distance is 0
+struct Symbol {
+  uint16_t value;
+  uint16_t distance;
+};
+
+// least significant bit first, as deflate packs everything but Huffman
+// codes, which are stored bit reversed for it
+class BitWriter {
+public:
+  explicit BitWriter(std::vector<unsigned char> &out)
+      : mOut(out), mBits(0), mCount(0) {}
+
+  void write(uint32_t value, int count) {
+    mBits |= static_cast<uint64_t>(value) << mCount;
+    mCount += count;
+    while (mCount >= 8) {
+      mOut.push_back(static_cast<unsigned char>(mBits));
+      mBits >>= 8;
+      mCount -= 8;
+    }
+  }
+
+  void alignToByte() {
+    if (mCount > 0) {
+      write(0, 8 - mCount);
+    }
+  }
+
+private:
+  std::vector<unsigned char> &mOut;
+  uint64_t mBits;
+  int mCount;
+};
+
+// lengths of a Huffman code no longer than maxBits, the frequencies are
+// flattened until the optimal code fits
+void buildLengths(const uint32_t *frequencies, int count, int maxBits,
+                  unsigned char *lengths) {
+  std::vector<uint64_t> weights(frequencies, frequencies + count);
+  for (;;) {
+    std::fill(lengths, lengths + count, 0);
+    using Entry = std::pair<uint64_t, int>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+    // leaves first, then every merge; a parent comes after its children
+    std::vector<int> parents;
+    std::vector<int> leaves;
+    for (int symbol = 0; symbol < count; ++symbol) {
+      if (weights[symbol] > 0) {
+        heap.push({weights[symbol], static_cast<int>(parents.size())});
+        parents.push_back(-1);
+        leaves.push_back(symbol);
+      }
+    }
+    if (leaves.size() == 1) {
+      lengths[leaves[0]] = 1;
+      return;
+    }
+    while (heap.size() > 1) {
+      const Entry first = heap.top();
+      heap.pop();
+      const Entry second = heap.top();
+      heap.pop();
+      const int node = static_cast<int>(parents.size());
+      parents[first.second] = node;
+      parents[second.second] = node;
+      parents.push_back(-1);
+      heap.push({first.first + second.first, node});
+    }
+
+    std::vector<int> depths(parents.size(), 0);
+    for (int node = static_cast<int>(parents.size()) - 2; node >= 0; --node) {
+      depths[node] = depths[parents[node]] + 1;
+    }
+    int longest = 0;
+    for (size_t leaf = 0; leaf < leaves.size(); ++leaf) {
+      longest = (std::max)(longest, depths[leaf]);
+    }
+    if (longest <= maxBits) {
+      for (size_t leaf = 0; leaf < leaves.size(); ++leaf) {
+        lengths[leaves[leaf]] = static_cast<unsigned char>(depths[leaf]);
+      }
+      return;
+    }
+    for (uint64_t &weight : weights) {
+      weight = (weight + 1) / 2;
+    }
+  }
+}
+
+// canonical codes of the lengths (RFC 1951 3.2.2), bit reversed
+void buildCodes(const unsigned char *lengths, int count, uint16_t *codes) {
+  int lengthCounts[kMaxBits + 1] = {};
+  for (int symbol = 0; symbol < count; ++symbol) {
+    ++lengthCounts[lengths[symbol]];
+  }
+  lengthCounts[0] = 0;
+  int nextCode[kMaxBits + 1] = {};
+  int code = 0;
+  for (int bits = 1; bits <= kMaxBits; ++bits) {
+    code = (code + lengthCounts[bits - 1]) << 1;
+    nextCode[bits] = code;
+  }
+  for (int symbol = 0; symbol < count; ++symbol) {
+    const int length = lengths[symbol];
+    if (length == 0) {
+      codes[symbol] = 0;
+      continue;
+    }
+    int value = nextCode[length]++;
+    int reversed = 0;
+    for (int bit = 0; bit < length; ++bit, value >>= 1) {
+      reversed = (reversed << 1) | (value & 1);
+    }
+    codes[symbol] = static_cast<uint16_t>(reversed);
+  }
+}
+
+// a code over a single symbol isn't complete, some decoders refuse it
+void ensureTwoCodes(uint32_t *frequencies, int count) {
+  int used = 0;
+  for (int symbol = 0; symbol < count; ++symbol) {
+    used += frequencies[symbol] > 0;
+  }
+  for (int symbol = 0; symbol < count && used < 2; ++symbol) {
+    if (frequencies[symbol] == 0) {
+      frequencies[symbol] = 1;
+      ++used;
+    }
+  }
+}
+
+struct CodeLength {
+  unsigned char symbol;
+  unsigned char extra;
+};
+
+// the literal and distance code lengths as one run length coded sequence
+std::vector<CodeLength> encodeCodeLengths(const unsigned char *lengths,
+                                          int count) {
+  std::vector<CodeLength> out;
+  for (int i = 0; i < count;) {
+    const unsigned char length = lengths[i];
+    int run = 1;
+    while (i + run < count && lengths[i + run] == length) {
+      ++run;
+    }
+    i += run;
+    if (length == 0) {
+      while (run >= 11) {
+        const int part = (std::min)(run, 138);
+        out.push_back({18, static_cast<unsigned char>(part - 11)});
+        run -= part;
+      }
+      if (run >= 3) {
+        out.push_back({17, static_cast<unsigned char>(run - 3)});
+        run = 0;
+      }
+    } else {
+      out.push_back({length, 0});
+      --run;
+      while (run >= 3) {
+        const int part = (std::min)(run, 6);
+        out.push_back({16, static_cast<unsigned char>(part - 3)});
+        run -= part;
+      }
+    }
+    for (; run > 0; --run) {
+      out.push_back({length, 0});
+    }
+  }
+  return out;
+}
+
+int codeLengthExtraBits(int symbol) {
+  return symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0;
+}
+
+void writeBlock(BitWriter &writer, const std::vector<Symbol> &symbols,
+                bool isFinal) {
+  const CodeTables &tables = codeTables();
+  uint32_t literalFrequencies[kLiteralCodes] = {};
+  uint32_t distanceFrequencies[kDistanceCodes] = {};
+  for (const Symbol &symbol : symbols) {
+    if (symbol.distance == 0) {
+      ++literalFrequencies[symbol.value];
+    } else {
+      ++literalFrequencies[257 + tables.lengthCode[symbol.value]];
+      ++distanceFrequencies[tables.getDistanceCode(symbol.distance)];
+    }
+  }
+  literalFrequencies[kEndOfBlock] = 1;
+
+  // extra bits cost the same under both codes and are left out
+  unsigned char fixedLiteralLengths[kFixedLiteralCodes];
+  std::fill(fixedLiteralLengths, fixedLiteralLengths + 144, 8);
+  std::fill(fixedLiteralLengths + 144, fixedLiteralLengths + 256, 9);
+  std::fill(fixedLiteralLengths + 256, fixedLiteralLengths + 280, 7);
+  std::fill(fixedLiteralLengths + 280, fixedLiteralLengths + 288, 8);
+  unsigned char fixedDistanceLengths[kDistanceCodes];
+  std::fill(fixedDistanceLengths, fixedDistanceLengths + kDistanceCodes, 5);
+  uint64_t fixedBits = 0;
+  for (int symbol = 0; symbol < kLiteralCodes; ++symbol) {
+    fixedBits +=
+        static_cast<uint64_t>(literalFrequencies[symbol]) *
+        fixedLiteralLengths[symbol];
+  }
+  for (int symbol = 0; symbol < kDistanceCodes; ++symbol) {
+    fixedBits += static_cast<uint64_t>(distanceFrequencies[symbol]) * 5;
+  }
+
+  ensureTwoCodes(literalFrequencies, kLiteralCodes);
+  ensureTwoCodes(distanceFrequencies, kDistanceCodes);
+  unsigned char lengths[kLiteralCodes + kDistanceCodes];
+  unsigned char *literalLengths = lengths;
+  buildLengths(literalFrequencies, kLiteralCodes, kMaxBits, literalLengths);
+  int literalCount = kLiteralCodes;
+  while (literalCount > 257 && literalLengths[literalCount - 1] == 0) {
+    --literalCount;
+  }
+  unsigned char *distanceLengths = lengths + literalCount;
+  buildLengths(distanceFrequencies, kDistanceCodes, kMaxBits,
+               distanceLengths);
+  int distanceCount = kDistanceCodes;
+  while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0) {
+    --distanceCount;
+  }
+
+  const std::vector<CodeLength> codeLengths =
+      encodeCodeLengths(lengths, literalCount + distanceCount);
+  uint32_t codeLengthFrequencies[kCodeLengthCodes] = {};
+  for (const CodeLength &codeLength : codeLengths) {
+    ++codeLengthFrequencies[codeLength.symbol];
+  }
+  ensureTwoCodes(codeLengthFrequencies, kCodeLengthCodes);
+  unsigned char codeLengthLengths[kCodeLengthCodes];
+  buildLengths(codeLengthFrequencies, kCodeLengthCodes, kMaxCodeLengthBits,
+               codeLengthLengths);
+  int codeLengthCount = kCodeLengthCodes;
+  while (codeLengthCount > 4 &&
+         codeLengthLengths[kCodeLengthOrder[codeLengthCount - 1]] == 0) {
+    --codeLengthCount;
+  }
+
+  uint64_t dynamicBits = 5 + 5 + 4 + 3 * codeLengthCount;
+  for (const CodeLength &codeLength : codeLengths) {
+    dynamicBits += codeLengthLengths[codeLength.symbol] +
+                   codeLengthExtraBits(codeLength.symbol);
+  }
+  for (int symbol = 0; symbol < literalCount; ++symbol) {
+    dynamicBits +=
+        static_cast<uint64_t>(literalFrequencies[symbol]) *
+        literalLengths[symbol];
+  }
+  for (int symbol = 0; symbol < distanceCount; ++symbol) {
+    dynamicBits +=
+        static_cast<uint64_t>(distanceFrequencies[symbol]) *
+        distanceLengths[symbol];
+  }
+
+  uint16_t literalCodes[kFixedLiteralCodes];
+  uint16_t distanceCodes[kDistanceCodes];
+  writer.write(isFinal ? 1 : 0, 1);
+  if (fixedBits <= dynamicBits) {
+    writer.write(1, 2);
+    buildCodes(fixedLiteralLengths, kFixedLiteralCodes, literalCodes);
+    buildCodes(fixedDistanceLengths, kDistanceCodes, distanceCodes);
+    literalLengths = fixedLiteralLengths;
+    distanceLengths = fixedDistanceLengths;
+  } else {
+    writer.write(2, 2);
+    writer.write(literalCount - 257, 5);
+    writer.write(distanceCount - 1, 5);
+    writer.write(codeLengthCount - 4, 4);
+    for (int i = 0; i < codeLengthCount; ++i) {
+      writer.write(codeLengthLengths[kCodeLengthOrder[i]], 3);
+    }
+    uint16_t codeLengthCodes[kCodeLengthCodes];
+    buildCodes(codeLengthLengths, kCodeLengthCodes, codeLengthCodes);
+    for (const CodeLength &codeLength : codeLengths) {
+      writer.write(codeLengthCodes[codeLength.symbol],
+                   codeLengthLengths[codeLength.symbol]);
+      writer.write(codeLength.extra, codeLengthExtraBits(codeLength.symbol));
+    }
+    buildCodes(literalLengths, literalCount, literalCodes);
+    buildCodes(distanceLengths, distanceCount, distanceCodes);
+  }
+
+  for (const Symbol &symbol : symbols) {
+    if (symbol.distance == 0) {
+      writer.write(literalCodes[symbol.value], literalLengths[symbol.value]);
+      continue;
+    }
+    const int lengthCode = tables.lengthCode[symbol.value];
+    writer.write(literalCodes[257 + lengthCode],
+                 literalLengths[257 + lengthCode]);
+    writer.write(symbol.value - kLengthBase[lengthCode],
+                 kLengthExtra[lengthCode]);
+    const int distanceCode = tables.getDistanceCode(symbol.distance);
+    writer.write(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+    writer.write(symbol.distance - kDistanceBase[distanceCode],
+                 kDistanceExtra[distanceCode]);
+  }
+  writer.write(literalCodes[kEndOfBlock], literalLengths[kEndOfBlock]);
+}
+
+// hash chains over the window and the piece, positions counted from the
+// start of the window
+class MatchFinder {
+public:
+  MatchFinder(const unsigned char *data, size_t windowStart, size_t end)
+      : mData(data + windowStart), mEnd(end - windowStart),
+        mHead(size_t(1) << kHashBits, kNone), mPrevious(mEnd, kNone) {}
+
+  void insert(size_t position) {
+    if (position + kMinMatch > mEnd) {
+      return;
+    }
+    const uint32_t hash = hashAt(position);
+    mPrevious[position] = mHead[hash];
+    mHead[hash] = static_cast<int32_t>(position);
+  }
+
+  // the longest match of the bytes at position among the positions
+  // inserted before it, 0 when there is none
+  int findMatch(size_t position, int &distance) const {
+    const int limit =
+        static_cast<int>((std::min)(static_cast<size_t>(kMaxMatch),
+                                    mEnd - position));
+    if (limit < kMinMatch) {
+      return 0;
+    }
+    const unsigned char *current = mData + position;
+    int best = kMinMatch - 1;
+    int32_t candidate = mHead[hashAt(position)];
+    for (int chain = 0; chain < kMaxChain && candidate != kNone; ++chain) {
+      const size_t back = position - static_cast<size_t>(candidate);
+      if (back > kWindowSize) {
+        break;
+      }
+      const unsigned char *match = mData + candidate;
+      if (match[best] == current[best] && match[0] == current[0]) {
+        int length = 1;
+        while (length < limit && match[length] == current[length]) {
+          ++length;
+        }
+        if (length > best) {
+          best = length;
+          distance = static_cast<int>(back);
+          if (length == limit) {
+            break;
+          }
+        }
+      }
+      candidate = mPrevious[candidate];
+    }
+    if (best < kMinMatch ||
+        (best == kMinMatch && static_cast<size_t>(distance) > kTooFar)) {
+      return 0;
+    }
+    return best;
+  }
+
+private:
+  static constexpr int32_t kNone = -1;
+
+  const unsigned char *mData;
+  size_t mEnd;
+  std::vector<int32_t> mHead;
+  std::vector<int32_t> mPrevious;
+
+  uint32_t hashAt(size_t position) const {
+    const unsigned char *bytes = mData + position;
+    const uint32_t value = bytes[0] | bytes[1] << 8 | bytes[2] << 16;
+    return (value * 2654435761u) >> (32 - kHashBits);
+  }
+};
+
+} // namespace
+
+void compress(const unsigned char *data, size_t begin, size_t end,
+              bool isFinal, std::vector<unsigned char> &out) {
+  const size_t windowStart = begin - (std::min)(begin, kWindowSize);
+  MatchFinder finder(data, windowStart, end);
+  for (size_t position = windowStart; position < begin; ++position) {
+    finder.insert(position - windowStart);
+  }
+
+  BitWriter writer(out);
+  std::vector<Symbol> symbols;
+  symbols.reserve(kBlockSymbols);
+  auto emit = [&](Symbol symbol) {
+    symbols.push_back(symbol);
+    if (symbols.size() == kBlockSymbols) {
+      writeBlock(writer, symbols, false);
+      symbols.clear();
+    }
+  };
+
+  // a match found at a position is only taken when the next position has
+  // no longer one, otherwise that position starts with a literal
+  int previousLength = 0;
+  int previousDistance = 0;
+  bool hasPrevious = false;
+  size_t position = begin - windowStart;
+  const size_t length = end - windowStart;
+  while (position < length) {
+    int distance = 0;
+    const int matchLength = previousLength < kLazyLimit
+                                ? finder.findMatch(position, distance)
+                                : 0;
+    finder.insert(position);
+    if (hasPrevious && previousLength >= kMinMatch &&
+        matchLength <= previousLength) {
+      emit({static_cast<uint16_t>(previousLength),
+            static_cast<uint16_t>(previousDistance)});
+      const size_t matchEnd = position - 1 + previousLength;
+      for (++position; position < matchEnd; ++position) {
+        finder.insert(position);
+      }
+      previousLength = 0;
+      hasPrevious = false;
+      continue;
+    }
+    if (hasPrevious) {
+      emit({data[windowStart + position - 1], 0});
+    }
+    hasPrevious = true;
+    previousLength = matchLength;
+    previousDistance = distance;
+    ++position;
+  }
+  if (hasPrevious) {
+    emit({data[windowStart + position - 1], 0});
+  }
+
+  if (isFinal) {
+    writeBlock(writer, symbols, true);
+    writer.alignToByte();
+    return;
+  }
+  if (!symbols.empty()) {
+    writeBlock(writer, symbols, false);
+  }
+  // an empty stored block
+  writer.write(0, 3);
+  writer.alignToByte();
+  writer.write(0x0000, 16);
+  writer.write(0xFFFF, 16);
+}
+
+uint32_t adler32(const unsigned char *data, size_t size, uint32_t adler) {
+  constexpr uint32_t kBase = 65521;
+  // the most bytes summed before the sums can overflow 32 bits
+  constexpr size_t kMaxRun = 5552;
+  uint32_t a = adler & 0xFFFF;
+  uint32_t b = adler >> 16;
+  while (size > 0) {
+    const size_t run = (std::min)(size, kMaxRun);
+    for (size_t i = 0; i < run; ++i) {
+      a += data[i];
+      b += a;
+    }
+    a %= kBase;
+    b %= kBase;
+    data += run;
+    size -= run;
+  }
+  return b << 16 | a;
+}
+
+uint32_t combineAdler32(uint32_t first, uint32_t second, size_t secondSize) {
+  constexpr uint64_t kBase = 65521;
+  const uint64_t remainder = secondSize % kBase;
+  const uint64_t firstA = first & 0xFFFF;
+  const uint64_t a = (firstA + (second & 0xFFFF) + kBase - 1) % kBase;
+  // every sum of the second piece also counts the first piece's a - 1
+  const uint64_t b = ((first >> 16) + (second >> 16) + remainder * firstA +
+                      kBase - remainder) %
+                     kBase;
+  return static_cast<uint32_t>(b << 16 | a);
+}
+
+} // namespace Deflate
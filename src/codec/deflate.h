@@ -0,0 +1,36 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Raw deflate (RFC 1951) compressor for data cut into pieces that are
+// compressed independently and concatenated, the way pigz does it. Every
+// piece but the last ends with an empty stored block (a sync flush), so the
+// next one starts on a byte boundary, and the bytes before a piece serve it
+// as a dictionary: a decoder has them in its window once it reaches the
+// piece.
+//
+// Matches are found on hash chains with one step of lazy evaluation, and
+// every block is coded with dynamic or fixed Huffman codes, whichever is
+// smaller.
+namespace Deflate {
+
+// how far back a match may reach
+constexpr size_t kWindowSize = 32768;
+
+// appends data[begin, end) as deflate blocks to `out`; matches may refer to
+// up to kWindowSize bytes before begin. The last block of a final piece is
+// marked as the end of the stream.
+void compress(const unsigned char *data, size_t begin, size_t end,
+              bool isFinal, std::vector<unsigned char> &out);
+
+uint32_t adler32(const unsigned char *data, size_t size, uint32_t adler = 1);
+// the Adler-32 of two pieces one after the other, from the checksum of each
+// and the size of the second
+uint32_t combineAdler32(uint32_t first, uint32_t second, size_t secondSize);
+
+} // namespace Deflate
+
+#endif
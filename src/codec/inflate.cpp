@@ -0,0 +1,326 @@
+#include "inflate.h"
+#include "deflate.h"
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+namespace {
+
+constexpr size_t kInputBytes = 1 << 16;
+constexpr size_t kWindowMask = Deflate::kWindowSize - 1;
+
+constexpr int kMaxBits = 15;
+constexpr int kEndOfBlock = 256;
+constexpr int kLiteralCodes = 286;
+constexpr int kFixedLiteralCodes = 288;
+constexpr int kDistanceCodes = 30;
+constexpr int kCodeLengthCodes = 19;
+
+constexpr int kLengthBase[29] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                                 15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                                 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr int kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                  1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                  4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr int kDistanceBase[30] = {
+    1,    2,    3,    4,    5,    7,    9,    13,    17,    25,
+    33,   49,   65,   97,   129,  193,  257,  385,   513,   769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+constexpr int kDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                    4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                    9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+constexpr int kCodeLengthOrder[kCodeLengthCodes] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// the canonical code of the lengths (RFC 1951 3.2.2) as a lookup table of
+// `bits` bits, codes read from the least significant bit; false for lengths
+// that ask for more codes than there are
+bool buildTable(const unsigned char *lengths, int count,
+                std::vector<uint16_t> &table, int &bits) {
+  int lengthCounts[kMaxBits + 1] = {};
+  bits = 0;
+  for (int symbol = 0; symbol < count; ++symbol) {
+    ++lengthCounts[lengths[symbol]];
+    bits = (std::max)(bits, static_cast<int>(lengths[symbol]));
+  }
+  lengthCounts[0] = 0;
+  int left = 1;
+  int nextCode[kMaxBits + 1] = {};
+  for (int length = 1; length <= kMaxBits; ++length) {
+    left = (left << 1) - lengthCounts[length];
+    if (left < 0) {
+      return false;
+    }
+    nextCode[length] = (nextCode[length - 1] + lengthCounts[length - 1]) << 1;
+  }
+
+  // bits no code starts with stay 0, decoding them fails
+  table.assign(size_t(1) << bits, 0);
+  for (int symbol = 0; symbol < count; ++symbol) {
+    const int length = lengths[symbol];
+    if (length == 0) {
+      continue;
+    }
+    const int code = nextCode[length]++;
+    size_t reversed = 0;
+    for (int bit = 0; bit < length; ++bit) {
+      reversed = reversed << 1 | ((code >> bit) & 1);
+    }
+    for (size_t i = reversed; i < table.size(); i += size_t(1) << length) {
+      table[i] = static_cast<uint16_t>(symbol << 4 | length);
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+Inflater::Inflater(Source source)
+    : mSource(std::move(source)), mInput(kInputBytes), mInputPos(0),
+      mInputEnd(0), mBits(0), mBitCount(0), mState(State::BlockHeader),
+      mIsLastBlock(false), mStoredLeft(0), mLiteralBits(0), mDistanceBits(0),
+      mWindow(Deflate::kWindowSize), mProduced(0), mCopyLeft(0),
+      mCopyDistance(0) {}
+
+void Inflater::refill() {
+  while (mBitCount <= 56) {
+    if (mInputPos == mInputEnd) {
+      mInputPos = 0;
+      mInputEnd = mSource(mInput.data(), mInput.size());
+      if (mInputEnd == 0) {
+        return;
+      }
+    }
+    mBits |= static_cast<uint64_t>(mInput[mInputPos++]) << mBitCount;
+    mBitCount += 8;
+  }
+}
+
+bool Inflater::getBits(int count, uint32_t &value) {
+  if (mBitCount < count) {
+    refill();
+    if (mBitCount < count) {
+      return false;
+    }
+  }
+  value = static_cast<uint32_t>(mBits & ((uint64_t(1) << count) - 1));
+  mBits >>= count;
+  mBitCount -= count;
+  return true;
+}
+
+bool Inflater::decodeSymbol(const std::vector<uint16_t> &table, int bits,
+                            int &symbol) {
+  if (mBitCount < kMaxBits) {
+    refill();
+  }
+  // past the end of the input the missing bits read as zeros, a code that
+  // needs them is a truncated stream
+  const uint16_t entry = table[mBits & ((uint64_t(1) << bits) - 1)];
+  const int length = entry & 15;
+  if (length == 0 || length > mBitCount) {
+    return false;
+  }
+  mBits >>= length;
+  mBitCount -= length;
+  symbol = entry >> 4;
+  return true;
+}
+
+bool Inflater::readBlockHeader() {
+  if (mIsLastBlock) {
+    mState = State::Finished;
+    return true;
+  }
+  uint32_t header;
+  if (!getBits(3, header)) {
+    return fail();
+  }
+  mIsLastBlock = header & 1;
+  switch (header >> 1) {
+  case 0: {
+    // stored: byte aligned, its length and the complement of it
+    mBits >>= mBitCount % 8;
+    mBitCount -= mBitCount % 8;
+    uint32_t length, complement;
+    if (!getBits(16, length) || !getBits(16, complement) ||
+        length != (~complement & 0xFFFF)) {
+      return fail();
+    }
+    mStoredLeft = length;
+    mState = State::Stored;
+    return true;
+  }
+  case 1: {
+    unsigned char lengths[kFixedLiteralCodes + kDistanceCodes];
+    std::fill(lengths, lengths + 144, 8);
+    std::fill(lengths + 144, lengths + 256, 9);
+    std::fill(lengths + 256, lengths + 280, 7);
+    std::fill(lengths + 280, lengths + kFixedLiteralCodes, 8);
+    std::fill(lengths + kFixedLiteralCodes, std::end(lengths), 5);
+    buildTable(lengths, kFixedLiteralCodes, mLiteralTable, mLiteralBits);
+    buildTable(lengths + kFixedLiteralCodes, kDistanceCodes, mDistanceTable,
+               mDistanceBits);
+    mState = State::Huffman;
+    return true;
+  }
+  case 2:
+    if (!readDynamicCodes()) {
+      return fail();
+    }
+    mState = State::Huffman;
+    return true;
+  default:
+    return fail();
+  }
+}
+
+bool Inflater::readDynamicCodes() {
+  uint32_t literalCount, distanceCount, codeLengthCount;
+  if (!getBits(5, literalCount) || !getBits(5, distanceCount) ||
+      !getBits(4, codeLengthCount)) {
+    return false;
+  }
+  literalCount += 257;
+  distanceCount += 1;
+  codeLengthCount += 4;
+  if (literalCount > kLiteralCodes || distanceCount > kDistanceCodes) {
+    return false;
+  }
+
+  unsigned char codeLengths[kCodeLengthCodes] = {};
+  for (uint32_t i = 0; i < codeLengthCount; ++i) {
+    uint32_t length;
+    if (!getBits(3, length)) {
+      return false;
+    }
+    codeLengths[kCodeLengthOrder[i]] = static_cast<unsigned char>(length);
+  }
+  std::vector<uint16_t> codeLengthTable;
+  int codeLengthBits;
+  if (!buildTable(codeLengths, kCodeLengthCodes, codeLengthTable,
+                  codeLengthBits)) {
+    return false;
+  }
+
+  // literal and distance lengths are one sequence, a run may cross over
+  unsigned char lengths[kLiteralCodes + kDistanceCodes] = {};
+  const uint32_t total = literalCount + distanceCount;
+  for (uint32_t i = 0; i < total;) {
+    int symbol;
+    if (!decodeSymbol(codeLengthTable, codeLengthBits, symbol)) {
+      return false;
+    }
+    if (symbol < 16) {
+      lengths[i++] = static_cast<unsigned char>(symbol);
+      continue;
+    }
+    uint32_t repeat;
+    unsigned char value = 0;
+    if (symbol == 16) {
+      if (i == 0 || !getBits(2, repeat)) {
+        return false;
+      }
+      value = lengths[i - 1];
+      repeat += 3;
+    } else if (symbol == 17) {
+      if (!getBits(3, repeat)) {
+        return false;
+      }
+      repeat += 3;
+    } else {
+      if (!getBits(7, repeat)) {
+        return false;
+      }
+      repeat += 11;
+    }
+    if (i + repeat > total) {
+      return false;
+    }
+    std::fill(lengths + i, lengths + i + repeat, value);
+    i += repeat;
+  }
+  return lengths[kEndOfBlock] != 0 &&
+         buildTable(lengths, literalCount, mLiteralTable, mLiteralBits) &&
+         buildTable(lengths + literalCount, distanceCount, mDistanceTable,
+                    mDistanceBits);
+}
+
+bool Inflater::fail() {
+  mState = State::Failed;
+  mCopyLeft = 0;
+  return false;
+}
+
+bool Inflater::read(unsigned char *out, size_t size) {
+  size_t done = 0;
+  auto put = [&](unsigned char byte) {
+    out[done++] = byte;
+    mWindow[mProduced++ & kWindowMask] = byte;
+  };
+  while (done < size) {
+    if (mCopyLeft > 0) {
+      const int count =
+          static_cast<int>((std::min)(size - done, size_t(mCopyLeft)));
+      for (int i = 0; i < count; ++i) {
+        put(mWindow[(mProduced - mCopyDistance) & kWindowMask]);
+      }
+      mCopyLeft -= count;
+      continue;
+    }
+    switch (mState) {
+    case State::BlockHeader:
+      if (!readBlockHeader()) {
+        return false;
+      }
+      break;
+    case State::Stored: {
+      uint32_t byte;
+      if (mStoredLeft == 0) {
+        mState = State::BlockHeader;
+      } else if (getBits(8, byte)) {
+        put(static_cast<unsigned char>(byte));
+        --mStoredLeft;
+      } else {
+        return fail();
+      }
+      break;
+    }
+    case State::Huffman: {
+      int symbol;
+      if (!decodeSymbol(mLiteralTable, mLiteralBits, symbol)) {
+        return fail();
+      }
+      if (symbol < kEndOfBlock) {
+        put(static_cast<unsigned char>(symbol));
+        break;
+      }
+      if (symbol == kEndOfBlock) {
+        mState = State::BlockHeader;
+        break;
+      }
+      const int lengthCode = symbol - kEndOfBlock - 1;
+      uint32_t lengthExtra, distanceExtra;
+      int distanceCode;
+      if (lengthCode >= 29 ||
+          !getBits(kLengthExtra[lengthCode], lengthExtra) ||
+          !decodeSymbol(mDistanceTable, mDistanceBits, distanceCode) ||
+          distanceCode >= kDistanceCodes ||
+          !getBits(kDistanceExtra[distanceCode], distanceExtra)) {
+        return fail();
+      }
+      mCopyLeft = kLengthBase[lengthCode] + static_cast<int>(lengthExtra);
+      mCopyDistance =
+          kDistanceBase[distanceCode] + static_cast<int>(distanceExtra);
+      if (static_cast<uint64_t>(mCopyDistance) > mProduced) {
+        return fail();
+      }
+      break;
+    }
+    default:
+      // finished before `size` bytes, or failed earlier
+      return false;
+    }
+  }
+  return true;
+}
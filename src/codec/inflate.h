@@ -0,0 +1,63 @@
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Raw deflate (RFC 1951) decoder that hands out its output a piece at a
+// time: read() stops as soon as it has produced the bytes asked for and
+// carries on from there on the next call, so a stream of any length is
+// decoded in the memory of its 32K window and an input buffer. The
+// compressed bytes are pulled from a callback as they are needed.
+//
+// Huffman codes are decoded with one table lookup, the table indexed by as
+// many bits as the longest code of the block has.
+class Inflater {
+public:
+  // fills up to `size` bytes and returns how many, 0 at the end of input
+  using Source = std::function<size_t(unsigned char *data, size_t size)>;
+
+  explicit Inflater(Source source);
+
+  // the next `size` bytes of the stream; false when the stream is corrupt,
+  // truncated or ends before them
+  bool read(unsigned char *out, size_t size);
+
+private:
+  enum class State { BlockHeader, Stored, Huffman, Finished, Failed };
+
+  Source mSource;
+  std::vector<unsigned char> mInput;
+  size_t mInputPos;
+  size_t mInputEnd;
+  uint64_t mBits;
+  int mBitCount;
+
+  State mState;
+  bool mIsLastBlock;
+  size_t mStoredLeft;
+  // symbol << 4 | code length, 0 for bits no code starts with
+  std::vector<uint16_t> mLiteralTable;
+  std::vector<uint16_t> mDistanceTable;
+  int mLiteralBits;
+  int mDistanceBits;
+
+  // the last 32K bytes produced, and the bytes still to copy of a match
+  // that didn't fit in the previous read()
+  std::vector<unsigned char> mWindow;
+  uint64_t mProduced;
+  int mCopyLeft;
+  int mCopyDistance;
+
+  void refill();
+  bool getBits(int count, uint32_t &value);
+  bool decodeSymbol(const std::vector<uint16_t> &table, int bits,
+                    int &symbol);
+  bool readBlockHeader();
+  bool readDynamicCodes();
+  bool fail();
+};
+
+#endif
@@ -0,0 +1,522 @@
+#include "png_encoder.h"
+#include "deflate.h"
+#include "utils/thread_pool.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+
+namespace PngEncoder {
+namespace {
+
+constexpr unsigned char kSignature[8] = {137, 'P', 'N', 'G',
+                                         '\r', '\n', 26, '\n'};
+
+// deflate with a 32K window, default level
+constexpr unsigned char kZlibHeader[2] = {0x78, 0x9C};
+
+enum Filter { kNone, kSub, kUp, kAverage, kPaeth, kFilterCount };
+
+const std::array<uint32_t, 256> &crcTable() {
+  static const std::array<uint32_t, 256> table = []() {
+    std::array<uint32_t, 256> entries;
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+      uint32_t crc = byte;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc & 1) ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+      }
+      entries[byte] = crc;
+    }
+    return entries;
+  }();
+  return table;
+}
+
+uint32_t crc32(const unsigned char *data, size_t size) {
+  const std::array<uint32_t, 256> &table = crcTable();
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+// PNG stores every number big-endian
+void writeWord(std::vector<unsigned char> &out, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<unsigned char>(value >> shift));
+  }
+}
+
+// a chunk is its length, type, data and the CRC of type and data; the
+// length is filled in by endChunk
+size_t beginChunk(std::vector<unsigned char> &out, const char *type) {
+  const size_t start = out.size();
+  writeWord(out, 0);
+  for (int i = 0; i < 4; ++i) {
+    out.push_back(static_cast<unsigned char>(type[i]));
+  }
+  return start;
+}
+
+void endChunk(std::vector<unsigned char> &out, size_t start) {
+  const size_t size = out.size() - start - 8;
+  for (int i = 0; i < 4; ++i) {
+    out[start + i] = static_cast<unsigned char>(size >> (24 - 8 * i));
+  }
+  writeWord(out, crc32(out.data() + start + 4, size + 4));
+}
+
+// the signature and the IHDR chunk
+void writeHeader(std::vector<unsigned char> &out, int width, int height,
+                 int bitDepth, int colorType) {
+  out.insert(out.end(), std::begin(kSignature), std::end(kSignature));
+  const size_t chunk = beginChunk(out, "IHDR");
+  writeWord(out, static_cast<uint32_t>(width));
+  writeWord(out, static_cast<uint32_t>(height));
+  // bit depth, colour type, deflate, adaptive filtering, no interlace
+  for (int field : {bitDepth, colorType, 0, 0, 0}) {
+    out.push_back(static_cast<unsigned char>(field));
+  }
+  endChunk(out, chunk);
+}
+
+unsigned char predictPaeth(int left, int above, int corner) {
+  const int estimate = left + above - corner;
+  const int toLeft = estimate > left ? estimate - left : left - estimate;
+  const int toAbove = estimate > above ? estimate - above : above - estimate;
+  const int toCorner =
+      estimate > corner ? estimate - corner : corner - estimate;
+  if (toLeft <= toAbove && toLeft <= toCorner) {
+    return static_cast<unsigned char>(left);
+  }
+  return static_cast<unsigned char>(toAbove <= toCorner ? above : corner);
+}
+
+// `above` is null for the first row, which the filters see as zeros;
+// `stride` is the bytes of a pixel
+void applyFilter(int filter, const unsigned char *row,
+                 const unsigned char *above, size_t size, int stride,
+                 unsigned char *out) {
+  const size_t left = static_cast<size_t>(stride);
+  switch (filter) {
+  case kNone:
+    std::memcpy(out, row, size);
+    break;
+  case kSub:
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = static_cast<unsigned char>(row[i] - (i >= left ? row[i - left]
+                                                              : 0));
+    }
+    break;
+  case kUp:
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = static_cast<unsigned char>(row[i] - (above ? above[i] : 0));
+    }
+    break;
+  case kAverage:
+    for (size_t i = 0; i < size; ++i) {
+      const int a = i >= left ? row[i - left] : 0;
+      const int b = above ? above[i] : 0;
+      out[i] = static_cast<unsigned char>(row[i] - (a + b) / 2);
+    }
+    break;
+  default:
+    for (size_t i = 0; i < size; ++i) {
+      const int a = i >= left ? row[i - left] : 0;
+      const int b = above ? above[i] : 0;
+      const int c = above && i >= left ? above[i - left] : 0;
+      out[i] = static_cast<unsigned char>(row[i] - predictPaeth(a, b, c));
+    }
+    break;
+  }
+}
+
+// residuals read as signed bytes
+uint64_t sumAbsolute(const unsigned char *residuals, size_t size) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < size; ++i) {
+    sum += residuals[i] < 128 ? residuals[i] : 256 - residuals[i];
+  }
+  return sum;
+}
+
+// writes the filter type and the filtered row to `out`
+void filterRow(const unsigned char *row, const unsigned char *above,
+               size_t size, int stride, unsigned char *out,
+               std::vector<unsigned char> &scratch) {
+  if (above && std::memcmp(row, above, size) == 0) {
+    out[0] = kUp;
+    std::memset(out + 1, 0, size);
+    return;
+  }
+  // on the first row Up is None and Paeth is Sub
+  const int filterCount = above ? kFilterCount : kUp;
+  uint64_t bestScore = UINT64_MAX;
+  for (int filter = 0; filter < filterCount; ++filter) {
+    applyFilter(filter, row, above, size, stride, scratch.data());
+    const uint64_t score = sumAbsolute(scratch.data(), size);
+    if (score < bestScore) {
+      bestScore = score;
+      out[0] = static_cast<unsigned char>(filter);
+      std::memcpy(out + 1, scratch.data(), size);
+    }
+  }
+}
+
+// PNG colour types of 1 to 4 channels
+constexpr int kColorTypes[5] = {0, 0, 4, 2, 6};
+constexpr int kIndexedColorType = 3;
+constexpr int kMaxEntries = 256;
+
+using Entry = std::array<unsigned char, 4>;
+
+// open addressing over packed colours, enough slots for a full palette to
+// stay sparse
+class ColorTable {
+public:
+  ColorTable() : mKeys(kSlots), mValues(kSlots, kEmpty) {}
+
+  // the value of the key, or kEmpty
+  int find(uint32_t key) const { return mValues[slotOf(key)]; }
+  void insert(uint32_t key, int value) {
+    const size_t slot = slotOf(key);
+    mKeys[slot] = key;
+    mValues[slot] = value;
+  }
+
+  static constexpr int kEmpty = -1;
+
+private:
+  static constexpr size_t kSlots = 4 * kMaxEntries;
+
+  std::vector<uint32_t> mKeys;
+  std::vector<int> mValues;
+
+  size_t slotOf(uint32_t key) const {
+    size_t slot = (key * 2654435761u) >> 22;
+    while (mValues[slot] != kEmpty && mKeys[slot] != key) {
+      slot = (slot + 1) % kSlots;
+    }
+    return slot;
+  }
+};
+
+// rows of rowSize packed bytes, filtered stride bytes apart; an indexed
+// image comes with its palette entries
+bool encodeRows(const unsigned char *rows, size_t rowSize, int width,
+                int height, int bitDepth, int colorType, int stride,
+                const std::vector<Entry> &entries, int threadCount,
+                std::vector<unsigned char> &out) {
+  const size_t filteredSize = rowSize + 1;
+  const int bandRows = static_cast<int>((std::max)(
+      size_t(1), static_cast<size_t>(kBandBytes) / filteredSize));
+  const int bandCount = (height + bandRows - 1) / bandRows;
+
+  std::unique_ptr<ThreadPool> pool;
+  if (threadCount > 1 && bandCount > 1) {
+    pool = std::make_unique<ThreadPool>((std::min)(threadCount, bandCount));
+  }
+  auto forEachBand = [&](const std::function<void(int)> &task) {
+    if (!pool) {
+      for (int band = 0; band < bandCount; ++band) {
+        task(band);
+      }
+      return;
+    }
+    for (int band = 0; band < bandCount; ++band) {
+      pool->submit([&task, band]() { task(band); });
+    }
+    pool->wait();
+  };
+
+  // every band is filtered before any is deflated, the bytes before a band
+  // are its dictionary
+  std::vector<unsigned char> filtered(filteredSize * height);
+  forEachBand([&](int band) {
+    std::vector<unsigned char> scratch(rowSize);
+    const int last = (std::min)(height, (band + 1) * bandRows);
+    for (int y = band * bandRows; y < last; ++y) {
+      const unsigned char *row = rows + rowSize * y;
+      filterRow(row, y > 0 ? row - rowSize : nullptr, rowSize, stride,
+                filtered.data() + filteredSize * y, scratch);
+    }
+  });
+
+  std::vector<std::vector<unsigned char>> streams(bandCount);
+  std::vector<uint32_t> checksums(bandCount);
+  forEachBand([&](int band) {
+    const size_t begin = filteredSize * band * bandRows;
+    const size_t end = filteredSize * (std::min)(height, (band + 1) * bandRows);
+    Deflate::compress(filtered.data(), begin, end, band == bandCount - 1,
+                      streams[band]);
+    checksums[band] = Deflate::adler32(filtered.data() + begin, end - begin);
+  });
+
+  out.clear();
+  writeHeader(out, width, height, bitDepth, colorType);
+  size_t chunk;
+  if (colorType == kIndexedColorType) {
+    chunk = beginChunk(out, "PLTE");
+    for (const Entry &entry : entries) {
+      out.insert(out.end(), entry.begin(), entry.begin() + 3);
+    }
+    endChunk(out, chunk);
+    // alphas up to the last entry that isn't opaque, the rest are
+    const auto opaqueTail = std::find_if(
+        entries.rbegin(), entries.rend(),
+        [](const Entry &entry) { return entry[3] != 255; });
+    if (opaqueTail != entries.rend()) {
+      chunk = beginChunk(out, "tRNS");
+      for (auto entry = entries.begin(); entry != opaqueTail.base();
+           ++entry) {
+        out.push_back((*entry)[3]);
+      }
+      endChunk(out, chunk);
+    }
+  }
+
+  chunk = beginChunk(out, "IDAT");
+  out.insert(out.end(), std::begin(kZlibHeader), std::end(kZlibHeader));
+  uint32_t checksum = 1;
+  for (int band = 0; band < bandCount; ++band) {
+    out.insert(out.end(), streams[band].begin(), streams[band].end());
+    const size_t begin = filteredSize * band * bandRows;
+    const size_t end = filteredSize * (std::min)(height, (band + 1) * bandRows);
+    checksum = Deflate::combineAdler32(checksum, checksums[band], end - begin);
+  }
+  writeWord(out, checksum);
+  endChunk(out, chunk);
+
+  endChunk(out, beginChunk(out, "IEND"));
+  return true;
+}
+
+} // namespace
+
+bool encode(const unsigned char *pixels, int width, int height, int channels,
+            int threadCount, std::vector<unsigned char> &out) {
+  if (!pixels || width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+    return false;
+  }
+  return encodeRows(pixels, static_cast<size_t>(width) * channels, width,
+                    height, 8, kColorTypes[channels], channels, {},
+                    threadCount, out);
+}
+
+bool encodeIndexed(const unsigned char *pixels, int width, int height,
+                   int channels,
+                   const std::vector<std::array<unsigned char, 3>> &palette,
+                   int threadCount, std::vector<unsigned char> &out) {
+  if (!pixels || width <= 0 || height <= 0 || (channels != 3 &&
+                                                channels != 4) ||
+      palette.empty() || palette.size() > kMaxEntries) {
+    return false;
+  }
+  ColorTable allowed;
+  for (const std::array<unsigned char, 3> &color : palette) {
+    allowed.insert(color[0] | color[1] << 8 | color[2] << 16, 0);
+  }
+
+  // runs of a colour are common, the last pixel's entry is checked first
+  const size_t pixelCount = static_cast<size_t>(width) * height;
+  std::vector<unsigned char> indices(pixelCount);
+  std::vector<Entry> entries;
+  ColorTable entryOf;
+  uint32_t lastKey = 0;
+  int lastEntry = ColorTable::kEmpty;
+  for (size_t i = 0; i < pixelCount; ++i) {
+    const unsigned char *pixel = pixels + i * channels;
+    const uint32_t color = pixel[0] | pixel[1] << 8 | pixel[2] << 16;
+    const unsigned char alpha = channels == 4 ? pixel[3] : 255;
+    const uint32_t key = color | static_cast<uint32_t>(alpha) << 24;
+    if (key != lastKey || lastEntry == ColorTable::kEmpty) {
+      lastKey = key;
+      lastEntry = entryOf.find(key);
+      if (lastEntry == ColorTable::kEmpty) {
+        if (allowed.find(color) == ColorTable::kEmpty ||
+            entries.size() == kMaxEntries) {
+          return false;
+        }
+        lastEntry = static_cast<int>(entries.size());
+        entryOf.insert(key, lastEntry);
+        entries.push_back({pixel[0], pixel[1], pixel[2], alpha});
+      }
+    }
+    indices[i] = static_cast<unsigned char>(lastEntry);
+  }
+
+  const int bitDepth = entries.size() <= 2    ? 1
+                       : entries.size() <= 4  ? 2
+                       : entries.size() <= 16 ? 4
+                                              : 8;
+  if (bitDepth == 8) {
+    return encodeRows(indices.data(), width, width, height, 8,
+                      kIndexedColorType, 1, entries, threadCount, out);
+  }
+  // indices packed from the most significant bit, rows start on a byte
+  const int perByte = 8 / bitDepth;
+  const size_t rowSize = (static_cast<size_t>(width) + perByte - 1) / perByte;
+  std::vector<unsigned char> rows(rowSize * height, 0);
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *index =
+        indices.data() + static_cast<size_t>(y) * width;
+    unsigned char *row = rows.data() + rowSize * y;
+    for (int x = 0; x < width; ++x) {
+      const int shift = 8 - bitDepth * (x % perByte + 1);
+      row[x / perByte] |= static_cast<unsigned char>(index[x] << shift);
+    }
+  }
+  return encodeRows(rows.data(), rowSize, width, height, bitDepth,
+                    kIndexedColorType, 1, entries, threadCount, out);
+}
+
+StreamWriter::StreamWriter()
+    : mRowSize(0), mHeight(0), mChannels(0), mRow(0), mBandRows(1),
+      mDictionarySize(0), mDeflatedBytes(0), mChecksum(1) {}
+
+bool StreamWriter::open(const std::string &path, int width, int height,
+                        int channels) {
+  if (width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+    return false;
+  }
+  mFile.open(path, std::ios::binary | std::ios::trunc);
+  mRowSize = static_cast<size_t>(width) * channels;
+  mHeight = height;
+  mChannels = channels;
+  mRow = 0;
+  // the bands of encodeRows
+  mBandRows = static_cast<int>((std::max)(
+      size_t(1), static_cast<size_t>(kBandBytes) / (mRowSize + 1)));
+  mAbove.assign(mRowSize, 0);
+  mFiltered.clear();
+  mDictionarySize = 0;
+  mDeflatedBytes = 0;
+  mChecksum = 1;
+
+  std::vector<unsigned char> header;
+  writeHeader(header, width, height, 8, kColorTypes[channels]);
+  mFile.write(reinterpret_cast<const char *>(header.data()),
+              static_cast<std::streamsize>(header.size()));
+  return static_cast<bool>(mFile);
+}
+
+bool StreamWriter::writeChunk(const char *type,
+                              const std::vector<unsigned char> &data) {
+  // a chunk holds less than 2^31 bytes, long data goes in several
+  constexpr size_t kMaxChunkBytes = size_t(1) << 30;
+  size_t begin = 0;
+  do {
+    const size_t end = (std::min)(data.size(), begin + kMaxChunkBytes);
+    std::vector<unsigned char> chunk;
+    const size_t start = beginChunk(chunk, type);
+    chunk.insert(chunk.end(), data.begin() + begin, data.begin() + end);
+    endChunk(chunk, start);
+    mFile.write(reinterpret_cast<const char *>(chunk.data()),
+                static_cast<std::streamsize>(chunk.size()));
+    begin = end;
+  } while (begin < data.size());
+  return static_cast<bool>(mFile);
+}
+
+bool StreamWriter::writeRows(const unsigned char *pixels, int count,
+                             int threadCount) {
+  if (!mFile || count < 0 || count > mHeight - mRow) {
+    return false;
+  }
+  const size_t filteredSize = mRowSize + 1;
+  const size_t bandBytes = filteredSize * mBandRows;
+  const size_t firstRow = mFiltered.size();
+  mFiltered.resize(firstRow + filteredSize * count);
+  const bool isLast = mRow + count == mHeight;
+  const size_t pending = mFiltered.size() - mDictionarySize;
+  const int filterBands = (count + mBandRows - 1) / mBandRows;
+  const int deflateBands = static_cast<int>(
+      isLast ? (pending + bandBytes - 1) / bandBytes : pending / bandBytes);
+
+  std::unique_ptr<ThreadPool> pool;
+  const int bandCount = (std::max)(filterBands, deflateBands);
+  if (threadCount > 1 && bandCount > 1) {
+    pool = std::make_unique<ThreadPool>((std::min)(threadCount, bandCount));
+  }
+  auto forEachBand = [&](int bands, const std::function<void(int)> &task) {
+    if (!pool) {
+      for (int band = 0; band < bands; ++band) {
+        task(band);
+      }
+      return;
+    }
+    for (int band = 0; band < bands; ++band) {
+      pool->submit([&task, band]() { task(band); });
+    }
+    pool->wait();
+  };
+
+  // the first row is filtered against the last of the previous call
+  forEachBand(filterBands, [&](int band) {
+    std::vector<unsigned char> scratch(mRowSize);
+    const int last = (std::min)(count, (band + 1) * mBandRows);
+    for (int y = band * mBandRows; y < last; ++y) {
+      const unsigned char *row = pixels + mRowSize * y;
+      const unsigned char *above =
+          y > 0 ? row - mRowSize : (mRow > 0 ? mAbove.data() : nullptr);
+      filterRow(row, above, mRowSize, mChannels,
+                mFiltered.data() + firstRow + filteredSize * y, scratch);
+    }
+  });
+  if (count > 0) {
+    std::memcpy(mAbove.data(), pixels + mRowSize * (count - 1), mRowSize);
+  }
+  mRow += count;
+  if (deflateBands == 0) {
+    return true;
+  }
+
+  std::vector<std::vector<unsigned char>> streams(deflateBands);
+  std::vector<uint32_t> checksums(deflateBands);
+  forEachBand(deflateBands, [&](int band) {
+    const size_t begin = mDictionarySize + bandBytes * band;
+    const size_t end = (std::min)(mFiltered.size(), begin + bandBytes);
+    Deflate::compress(mFiltered.data(), begin, end,
+                      isLast && band == deflateBands - 1, streams[band]);
+    checksums[band] = Deflate::adler32(mFiltered.data() + begin, end - begin);
+  });
+
+  std::vector<unsigned char> data;
+  if (mDeflatedBytes == 0) {
+    data.assign(std::begin(kZlibHeader), std::end(kZlibHeader));
+  }
+  for (int band = 0; band < deflateBands; ++band) {
+    data.insert(data.end(), streams[band].begin(), streams[band].end());
+    const size_t begin = mDictionarySize + bandBytes * band;
+    const size_t end = (std::min)(mFiltered.size(), begin + bandBytes);
+    mChecksum = Deflate::combineAdler32(mChecksum, checksums[band],
+                                        end - begin);
+  }
+  if (isLast) {
+    writeWord(data, mChecksum);
+  }
+
+  // what was deflated is kept as far back as a match may reach
+  const size_t deflated = (std::min)(
+      mFiltered.size(), mDictionarySize + bandBytes * deflateBands);
+  const size_t dropped = deflated - (std::min)(deflated, Deflate::kWindowSize);
+  mFiltered.erase(mFiltered.begin(), mFiltered.begin() + dropped);
+  mDeflatedBytes += deflated - mDictionarySize;
+  mDictionarySize = deflated - dropped;
+  return writeChunk("IDAT", data);
+}
+
+bool StreamWriter::close() {
+  if (!mFile.is_open()) {
+    return false;
+  }
+  const bool isComplete = mRow == mHeight && writeChunk("IEND", {});
+  mFile.close();
+  return isComplete && !mFile.fail();
+}
+
+} // namespace PngEncoder
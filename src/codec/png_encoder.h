@@ -0,0 +1,81 @@
+#ifndef PNG_ENCODER_H
+#define PNG_ENCODER_H
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// PNG writer for the images this program renders. Rows are filtered and
+// deflated in bands of about kBandBytes, each band on a thread of its own,
+// and the deflate streams of the bands are joined into one zlib stream (see
+// Deflate). The bands don't depend on the thread count, so neither does the
+// file.
+//
+// Rendered rows are mostly runs of flat blocks: a row equal to the one
+// above is filtered with Up (all zero) without trying the others, every
+// other row with the filter of the smallest sum of absolute residuals.
+//
+// An image painted with few colours is written as an indexed PNG of 1, 2,
+// 4 or 8 bits per pixel, a fraction of the bytes of RGB(A) to filter and
+// deflate.
+namespace PngEncoder {
+
+// filtered bytes per band
+constexpr int kBandBytes = 1 << 18;
+
+// 8-bit gray, gray and alpha, RGB or RGBA pixels, rows packed; false for
+// an empty image or another channel count
+bool encode(const unsigned char *pixels, int width, int height, int channels,
+            int threadCount, std::vector<unsigned char> &out);
+
+// RGB or RGBA pixels whose colours are all in `palette`, as an indexed PNG
+// with an entry per distinct colour and alpha found, in the order they are
+// met; false (and `out` untouched) when a colour isn't in the palette or
+// there are more than 256 entries
+bool encodeIndexed(const unsigned char *pixels, int width, int height,
+                   int channels,
+                   const std::vector<std::array<unsigned char, 3>> &palette,
+                   int threadCount, std::vector<unsigned char> &out);
+
+// Writes an 8-bit PNG to a file a band of rows at a time, for images too
+// large to hold whole (see CompressionController::setTileSize). Rows are
+// filtered as encode() filters them and deflated in the same bands, so the
+// zlib stream is the one encode() writes, split over an IDAT chunk per
+// call. Between calls it holds the filtered rows of the band not complete
+// yet and the deflate window before them.
+class StreamWriter {
+public:
+  StreamWriter();
+
+  // gray, gray and alpha, RGB or RGBA pixels of the given size
+  bool open(const std::string &path, int width, int height, int channels);
+  // the next `count` rows, packed, filtered and deflated on up to
+  // threadCount threads
+  bool writeRows(const unsigned char *pixels, int count, int threadCount);
+  // false when fewer rows than the height were written or a write failed
+  bool close();
+
+private:
+  std::ofstream mFile;
+  size_t mRowSize;
+  int mHeight;
+  int mChannels;
+  int mRow;
+  int mBandRows;
+  // the last row written, the one above the next
+  std::vector<unsigned char> mAbove;
+  // up to Deflate::kWindowSize bytes already deflated, the dictionary of
+  // the next band, followed by the filtered rows not deflated yet
+  std::vector<unsigned char> mFiltered;
+  size_t mDictionarySize;
+  size_t mDeflatedBytes;
+  uint32_t mChecksum;
+
+  bool writeChunk(const char *type, const std::vector<unsigned char> &data);
+};
+
+} // namespace PngEncoder
+
+#endif
@@ -0,0 +1,186 @@
+#include "png_reader.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr unsigned char kSignature[8] = {137, 'P', 'N', 'G',
+                                         '\r', '\n', 26, '\n'};
+
+enum Filter { kNone, kSub, kUp, kAverage, kPaeth };
+
+constexpr int kRgbColorType = 2;
+constexpr int kRgbaColorType = 6;
+// stb_image refuses larger images as well
+constexpr uint32_t kMaxDimension = 1 << 24;
+
+// PNG stores every number big-endian
+uint32_t readWord(const unsigned char *bytes) {
+  return static_cast<uint32_t>(bytes[0]) << 24 | bytes[1] << 16 |
+         bytes[2] << 8 | bytes[3];
+}
+
+unsigned char predictPaeth(int left, int above, int corner) {
+  const int estimate = left + above - corner;
+  const int toLeft = estimate > left ? estimate - left : left - estimate;
+  const int toAbove = estimate > above ? estimate - above : above - estimate;
+  const int toCorner =
+      estimate > corner ? estimate - corner : corner - estimate;
+  if (toLeft <= toAbove && toLeft <= toCorner) {
+    return static_cast<unsigned char>(left);
+  }
+  return static_cast<unsigned char>(toAbove <= toCorner ? above : corner);
+}
+
+} // namespace
+
+PngReader::PngReader()
+    : mWidth(0), mHeight(0), mChannels(0), mRow(0), mChunkLeft(0),
+      mIsInData(false) {}
+
+bool PngReader::readChunkHeader(uint32_t &length, std::string &type) {
+  unsigned char header[8];
+  if (!mFile.read(reinterpret_cast<char *>(header), sizeof(header))) {
+    return false;
+  }
+  length = readWord(header);
+  type.assign(reinterpret_cast<const char *>(header) + 4, 4);
+  return length <= 0x7FFFFFFFu;
+}
+
+bool PngReader::open(const std::string &path) {
+  mFile.open(path, std::ios::binary);
+  unsigned char signature[8];
+  unsigned char header[13];
+  uint32_t length;
+  std::string type;
+  if (!mFile.read(reinterpret_cast<char *>(signature), sizeof(signature)) ||
+      std::memcmp(signature, kSignature, sizeof(signature)) != 0 ||
+      !readChunkHeader(length, type) || type != "IHDR" ||
+      length != sizeof(header) ||
+      !mFile.read(reinterpret_cast<char *>(header), sizeof(header))) {
+    return false;
+  }
+  const uint32_t width = readWord(header);
+  const uint32_t height = readWord(header + 4);
+  // 8 bits, RGB or RGBA, deflate, adaptive filtering, no interlace
+  if (width == 0 || height == 0 || width > kMaxDimension ||
+      height > kMaxDimension || header[8] != 8 ||
+      (header[9] != kRgbColorType && header[9] != kRgbaColorType) ||
+      header[10] != 0 || header[11] != 0 || header[12] != 0) {
+    return false;
+  }
+  mWidth = static_cast<int>(width);
+  mHeight = static_cast<int>(height);
+  mChannels = header[9] == kRgbaColorType ? 4 : 3;
+
+  // ancillary chunks and a suggested palette before the data are skipped,
+  // any other critical chunk is one stb_image would refuse
+  mFile.seekg(4, std::ios::cur);
+  while (true) {
+    if (!readChunkHeader(length, type)) {
+      return false;
+    }
+    if (type == "IDAT") {
+      break;
+    }
+    if ((type[0] & 32) == 0 && type != "PLTE") {
+      return false;
+    }
+    if (type == "tRNS" && mChannels == 3) {
+      return false;
+    }
+    mFile.seekg(static_cast<std::streamoff>(length) + 4, std::ios::cur);
+  }
+  mChunkLeft = length;
+  mIsInData = true;
+
+  // zlib header: deflate with a window of up to 32K, no preset dictionary
+  unsigned char method, flags;
+  if (readData(&method, 1) != 1 || readData(&flags, 1) != 1 ||
+      (method & 15) != 8 || (method >> 4) > 7 ||
+      (method << 8 | flags) % 31 != 0 || (flags & 32) != 0) {
+    return false;
+  }
+  mInflater = std::make_unique<Inflater>(
+      [this](unsigned char *data, size_t size) {
+        return readData(data, size);
+      });
+  const size_t rowSize = static_cast<size_t>(mWidth) * mChannels;
+  mFiltered.assign(rowSize + 1, 0);
+  // the row above the first reads as zeros
+  mAbove.assign(rowSize, 0);
+  mRow = 0;
+  return true;
+}
+
+size_t PngReader::readData(unsigned char *data, size_t size) {
+  // the data may be split over any number of consecutive IDAT chunks
+  while (mChunkLeft == 0) {
+    uint32_t length;
+    std::string type;
+    if (!mIsInData || !mFile.seekg(4, std::ios::cur) ||
+        !readChunkHeader(length, type) || type != "IDAT") {
+      mIsInData = false;
+      return 0;
+    }
+    mChunkLeft = length;
+  }
+  const size_t count = (std::min)(size, static_cast<size_t>(mChunkLeft));
+  if (!mFile.read(reinterpret_cast<char *>(data),
+                  static_cast<std::streamsize>(count))) {
+    mIsInData = false;
+    mChunkLeft = 0;
+    return 0;
+  }
+  mChunkLeft -= static_cast<uint32_t>(count);
+  return count;
+}
+
+bool PngReader::readRows(unsigned char *pixels, int count) {
+  const size_t rowSize = mAbove.size();
+  const size_t left = static_cast<size_t>(mChannels);
+  for (int i = 0; i < count; ++i, ++mRow) {
+    if (!mInflater || mRow >= mHeight ||
+        !mInflater->read(mFiltered.data(), rowSize + 1)) {
+      return false;
+    }
+    const unsigned char *in = mFiltered.data() + 1;
+    const unsigned char *above = mAbove.data();
+    unsigned char *row = pixels + rowSize * i;
+    switch (mFiltered[0]) {
+    case kNone:
+      std::memcpy(row, in, rowSize);
+      break;
+    case kSub:
+      for (size_t j = 0; j < rowSize; ++j) {
+        row[j] = static_cast<unsigned char>(in[j] +
+                                            (j >= left ? row[j - left] : 0));
+      }
+      break;
+    case kUp:
+      for (size_t j = 0; j < rowSize; ++j) {
+        row[j] = static_cast<unsigned char>(in[j] + above[j]);
+      }
+      break;
+    case kAverage:
+      for (size_t j = 0; j < rowSize; ++j) {
+        const int a = j >= left ? row[j - left] : 0;
+        row[j] = static_cast<unsigned char>(in[j] + (a + above[j]) / 2);
+      }
+      break;
+    case kPaeth:
+      for (size_t j = 0; j < rowSize; ++j) {
+        const int a = j >= left ? row[j - left] : 0;
+        const int c = j >= left ? above[j - left] : 0;
+        row[j] = static_cast<unsigned char>(in[j] +
+                                            predictPaeth(a, above[j], c));
+      }
+      break;
+    default:
+      return false;
+    }
+    std::memcpy(mAbove.data(), row, rowSize);
+  }
+  return true;
+}
@@ -0,0 +1,54 @@
+#ifndef PNG_READER_H
+#define PNG_READER_H
+
+#include "inflate.h"
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Reads the pixels of an 8-bit, non-interlaced RGB or RGBA PNG a few rows
+// at a time, for images too large to decode whole (see
+// CompressionController::setTileSize). Only the row above and the inflate
+// window are held between calls. The pixels are those stb_image loads; like
+// stb_image, the CRCs and the Adler-32 aren't checked.
+class PngReader {
+public:
+  PngReader();
+
+  // the inflater reads through this object
+  PngReader(const PngReader &) = delete;
+  PngReader &operator=(const PngReader &) = delete;
+
+  // false for a file that isn't such a PNG, including RGB with a tRNS
+  // colour key, which stb_image loads as RGBA
+  bool open(const std::string &path);
+
+  int getWidth() const { return mWidth; }
+  int getHeight() const { return mHeight; }
+  int getChannels() const { return mChannels; }
+
+  // the next `count` rows, packed; false past the last row or when the
+  // file is truncated or corrupt
+  bool readRows(unsigned char *pixels, int count);
+
+private:
+  std::ifstream mFile;
+  int mWidth;
+  int mHeight;
+  int mChannels;
+  int mRow;
+  // bytes left of the IDAT chunk being read, and whether more may follow
+  uint32_t mChunkLeft;
+  bool mIsInData;
+  std::unique_ptr<Inflater> mInflater;
+  // the filter type and the filtered bytes of a row, and the row above
+  std::vector<unsigned char> mFiltered;
+  std::vector<unsigned char> mAbove;
+
+  bool readChunkHeader(uint32_t &length, std::string &type);
+  size_t readData(unsigned char *data, size_t size);
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include "qtc_codec.h"
+#include "qtc_detail.h"
+#include "qtc_progressive.h"
+#include <fstream>
+#include <iterator>
+
+namespace QTC {
+namespace {
+
+// the split flags and leaf colours of the whole tree as one stream, depth
+// first in Z-order
+class TreeWriter {
+public:
+  TreeWriter(const QuadtreeImage &quadtree, std::vector<unsigned char> &out)
+      : mQuadtree(quadtree), mEncoder(out),
+        mCodedTree(quadtree.getImage().getWidth(),
+                   quadtree.getImage().getHeight()),
+        mLeafCount(0) {
+    mNextNode.fill(CodedTree::kRoot);
+  }
+
+  // siblings are visited one after the other, so the coded node of a child
+  // is the next one of its parent's children
+  bool visit(const QuadRect &rect, int depth, bool isSplit) {
+    const uint32_t codedNode = mNextNode[depth]++;
+    if (QuadtreeImage::isDivisible(rect.width, rect.height,
+                                   mQuadtree.getMinBlockSize())) {
+      mEncoder.encodeBit(mSplitModels[splitContext(depth)], isSplit);
+    } else if (isSplit) {
+      // blocks too small to split carry no flag, the decoder knows them
+      return false;
+    }
+    if (isSplit) {
+      mNextNode[depth + 1] = mCodedTree.split(codedNode);
+      return true;
+    }
+
+    ++mLeafCount;
+    // odd sized blocks split into empty halves, they paint nothing
+    if (rect.width > 0 && rect.height > 0) {
+      const Color color = mQuadtree.getBlockColor(rect);
+      mColorModels.encode(mEncoder, color, mCodedTree.predict(rect));
+      mCodedTree.setColor(codedNode, color);
+    }
+    return true;
+  }
+
+  void finish() { mEncoder.flush(); }
+  uint32_t getLeafCount() const { return mLeafCount; }
+
+private:
+  const QuadtreeImage &mQuadtree;
+  RangeCoder::Encoder mEncoder;
+  std::array<RangeCoder::BitModel, kMaxContextDepth + 1> mSplitModels;
+  ColorModels mColorModels;
+  CodedTree mCodedTree;
+  std::array<uint32_t, LinearQuadtree::MAX_DEPTH + 2> mNextNode;
+  uint32_t mLeafCount;
+};
+
+class TreeReader {
+public:
+  TreeReader(const unsigned char *data, size_t size, int minBlockSize,
+             uint32_t leafCount, Image &image)
+      : mDecoder(data, size), mCodedTree(image.getWidth(), image.getHeight()),
+        mMinBlockSize(minBlockSize), mLeafCount(leafCount), mImage(image),
+        mIsValid(true) {}
+
+  void readNode(const QuadRect &rect, uint32_t codedNode, int depth) {
+    if (!mIsValid) {
+      return;
+    }
+    const bool isSplit =
+        QuadtreeImage::isDivisible(rect.width, rect.height, mMinBlockSize) &&
+        mDecoder.decodeBit(mSplitModels[splitContext(depth)]);
+    if (isSplit) {
+      const uint32_t firstChild = mCodedTree.split(codedNode);
+      for (int quadrant = 0; quadrant < 4; ++quadrant) {
+        readNode(LinearQuadtree::childRect(rect, quadrant, kSplitAlignment),
+                 firstChild + quadrant, depth + 1);
+      }
+      return;
+    }
+
+    // a corrupt stream could claim more leaves than the header
+    if (mLeafCount == 0) {
+      mIsValid = false;
+      return;
+    }
+    --mLeafCount;
+    if (rect.width == 0 || rect.height == 0) {
+      return;
+    }
+    const Color color =
+        mColorModels.decode(mDecoder, mCodedTree.predict(rect));
+    mCodedTree.setColor(codedNode, color);
+    fillBlock(mImage, rect, color);
+  }
+
+  bool isValid() const {
+    return mIsValid && mLeafCount == 0 && !mDecoder.isOverrun();
+  }
+
+private:
+  RangeCoder::Decoder mDecoder;
+  std::array<RangeCoder::BitModel, kMaxContextDepth + 1> mSplitModels;
+  ColorModels mColorModels;
+  CodedTree mCodedTree;
+  int mMinBlockSize;
+  uint32_t mLeafCount;
+  Image &mImage;
+  bool mIsValid;
+};
+
+bool encodeDepthFirst(const QuadtreeImage &quadtree,
+                      std::vector<unsigned char> &out) {
+  writeHeader(out, kDepthFirstMagic, quadtree);
+  TreeWriter writer(quadtree, out);
+  if (!walkTree(quadtree,
+                [&writer](const QuadRect &rect, int depth, bool isSplit) {
+                  return writer.visit(rect, depth, isSplit);
+                })) {
+    return false;
+  }
+  writer.finish();
+  patchCount(out, writer.getLeafCount());
+  return true;
+}
+
+} // namespace
+
+bool isEncodable(int width, int height) {
+  return width > 0 && height > 0 &&
+         isValidSize(static_cast<uint64_t>(width),
+                     static_cast<uint64_t>(height));
+}
+
+bool encode(const QuadtreeImage &quadtree, std::vector<unsigned char> &out,
+            Layout layout) {
+  // a stream the decoder would reject is not written at all
+  if (!isEncodable(quadtree.getImage().getWidth(),
+                   quadtree.getImage().getHeight())) {
+    return false;
+  }
+  if (layout == Layout::Progressive) {
+    return encodeProgressive(quadtree, out);
+  }
+  return encodeDepthFirst(quadtree, out);
+}
+
+bool save(const QuadtreeImage &quadtree, const std::string &path,
+          Layout layout) {
+  std::vector<unsigned char> data;
+  if (!encode(quadtree, data, layout)) {
+    return false;
+  }
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char *>(data.data()),
+             static_cast<std::streamsize>(data.size()));
+  return static_cast<bool>(file);
+}
+
+bool decode(const unsigned char *data, size_t size, Image &image) {
+  if (isProgressive(data, size)) {
+    ProgressiveReader reader;
+    return reader.push(data, size) && reader.isComplete() &&
+           reader.render(image);
+  }
+
+  Header header;
+  if (!hasMagic(data, size, kDepthFirstMagic) ||
+      !readHeader(data, size, header)) {
+    return false;
+  }
+  image = Image(static_cast<int>(header.width),
+                static_cast<int>(header.height), 3, image.getFileExt());
+  TreeReader reader(data + kHeaderSize, size - kHeaderSize,
+                    static_cast<int>(header.minBlockSize), header.count,
+                    image);
+  reader.readNode({0, 0, static_cast<int>(header.width),
+                   static_cast<int>(header.height)},
+                  CodedTree::kRoot, 0);
+  return reader.isValid();
+}
+
+bool load(const std::string &path, Image &image) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  const std::vector<unsigned char> data(
+      (std::istreambuf_iterator<char>(file)),
+      std::istreambuf_iterator<char>());
+  return decode(data.data(), data.size(), image);
+}
+
+bool isProgressive(const unsigned char *data, size_t size) {
+  return hasMagic(data, size, kProgressiveMagic);
+}
+
+} // namespace QTC
@@ -0,0 +1,57 @@
+#ifndef QTC_CODEC_H
+#define QTC_CODEC_H
+
+#include "image/image.h"
+#include "quadtree/quadtreeimage.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Native container for a built quadtree (.qtc): the tree itself instead of
+// the pixels it paints, so encoding and parsing walk the nodes only,
+// whatever the image size.
+//
+// A fixed header (a magic naming the layout, then width, height, minimum
+// block size and a count as little-endian 32-bit words) is followed by
+// range coded data (see RangeCoder). Every node large enough to be split
+// (QuadtreeImage::isDivisible) codes a split flag in a context per depth,
+// and colours are coded as the difference to a prediction from the nodes
+// left of and above them, with the green difference taken out of red and
+// blue. Alpha is not stored.
+//
+// Layout::DepthFirst ("QTC1", counting leaves) codes the nodes depth first
+// in Z-order in one stream, and only the leaves carry a colour. It is the
+// smaller one. Layout::Progressive ("QTP1", counting levels) codes the tree
+// level by level, every node with its colour, so any prefix of the file
+// renders an approximation (see ProgressiveReader).
+namespace QTC {
+
+constexpr const char *kFileExt = ".qtc";
+
+enum class Layout { DepthFirst, Progressive };
+
+// whether an image of this size fits a stream, its area is at most 2^30
+// pixels so a block area always fits an int
+bool isEncodable(int width, int height);
+
+// false when the tree isn't built, its image has a split alignment
+// (Image::setSplitAlignment), which the header can't hold, or a size that
+// isn't encodable
+bool encode(const QuadtreeImage &quadtree, std::vector<unsigned char> &out,
+            Layout layout = Layout::DepthFirst);
+bool save(const QuadtreeImage &quadtree, const std::string &path,
+          Layout layout = Layout::DepthFirst);
+
+// renders a whole stream of either layout into a 3 channel image, saved as
+// the file extension the image had before; false on a malformed or
+// truncated stream
+bool decode(const unsigned char *data, size_t size, Image &image);
+bool load(const std::string &path, Image &image);
+
+// whether a stream starts as a progressive one, which ProgressiveReader can
+// render from any prefix
+bool isProgressive(const unsigned char *data, size_t size);
+
+} // namespace QTC
+
+#endif
@@ -0,0 +1,321 @@
+#ifndef QTC_DETAIL_H
+#define QTC_DETAIL_H
+
+#include "image/image.h"
+#include "quadtree/quadtreeimage.h"
+#include "range_coder.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Pieces shared by the .qtc layouts (see qtc_codec.h), not meant for use
+// outside of src/codec.
+namespace QTC {
+
+using Color = std::array<unsigned char, 3>;
+
+constexpr unsigned char kDepthFirstMagic[4] = {'Q', 'T', 'C', '1'};
+constexpr unsigned char kProgressiveMagic[4] = {'Q', 'T', 'P', '1'};
+// magic, then width, height, minimum block size and a count of the layout
+constexpr size_t kHeaderSize = 4 + 4 * sizeof(uint32_t);
+// keeps the area of a block within an int, as isDivisible takes it
+constexpr uint64_t kMaxArea = 1u << 30;
+// split flags deeper than this share the deepest context
+constexpr int kMaxContextDepth = 15;
+// red and blue are coded in a context per magnitude of the green residual
+constexpr int kGreenContexts = 4;
+// the header has no room for another split, blocks are split at the middle
+constexpr int kSplitAlignment = 1;
+
+struct Header {
+  uint32_t width;
+  uint32_t height;
+  uint32_t minBlockSize;
+  uint32_t count;
+};
+
+inline void writeWord(std::vector<unsigned char> &out, uint32_t value) {
+  for (int shift = 0; shift < 32; shift += 8) {
+    out.push_back(static_cast<unsigned char>(value >> shift));
+  }
+}
+
+inline uint32_t readWord(const unsigned char *data) {
+  return static_cast<uint32_t>(data[0]) |
+         static_cast<uint32_t>(data[1]) << 8 |
+         static_cast<uint32_t>(data[2]) << 16 |
+         static_cast<uint32_t>(data[3]) << 24;
+}
+
+// the count is written last, once the stream is done
+inline void writeHeader(std::vector<unsigned char> &out,
+                        const unsigned char (&magic)[4],
+                        const QuadtreeImage &quadtree) {
+  out.clear();
+  for (unsigned char byte : magic) {
+    out.push_back(byte);
+  }
+  writeWord(out, quadtree.getImage().getWidth());
+  writeWord(out, quadtree.getImage().getHeight());
+  writeWord(out, quadtree.getMinBlockSize());
+  writeWord(out, 0);
+}
+
+inline void patchCount(std::vector<unsigned char> &out, uint32_t count) {
+  for (int i = 0; i < 4; ++i) {
+    out[kHeaderSize - 4 + i] = static_cast<unsigned char>(count >> (8 * i));
+  }
+}
+
+inline bool hasMagic(const unsigned char *data, size_t size,
+                     const unsigned char (&magic)[4]) {
+  return size >= sizeof(magic) && std::memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+// the one limit on the image size, checked by both sides
+inline bool isValidSize(uint64_t width, uint64_t height) {
+  return width > 0 && height > 0 && width * height <= kMaxArea;
+}
+
+// false for dimensions a valid stream can't have
+inline bool readHeader(const unsigned char *data, size_t size,
+                       Header &header) {
+  if (size < kHeaderSize) {
+    return false;
+  }
+  header = {readWord(data + 4), readWord(data + 8), readWord(data + 12),
+            readWord(data + 16)};
+  return isValidSize(header.width, header.height) &&
+         header.minBlockSize > 0 &&
+         header.minBlockSize <= header.width * header.height;
+}
+
+// a difference modulo 256 taken as a signed byte and interleaved, so small
+// magnitudes of either sign are small codes: 0, -1, 1, -2, ...
+inline unsigned char foldDelta(int delta) {
+  const int wrapped = static_cast<signed char>(delta & 0xFF);
+  return static_cast<unsigned char>(wrapped >= 0 ? 2 * wrapped
+                                                 : -2 * wrapped - 1);
+}
+
+inline int unfoldDelta(unsigned char code) {
+  return (code & 1) ? -((code + 1) >> 1) : code >> 1;
+}
+
+inline int splitContext(int depth) {
+  return depth < kMaxContextDepth ? depth : kMaxContextDepth;
+}
+
+// residual of a colour against its prediction: green, then red and blue
+// minus green in a context per magnitude of the green residual
+struct ColorModels {
+  RangeCoder::ByteModel green;
+  std::array<RangeCoder::ByteModel, kGreenContexts> red;
+  std::array<RangeCoder::ByteModel, kGreenContexts> blue;
+
+  static int greenContext(unsigned char foldedGreen) {
+    if (foldedGreen == 0) {
+      return 0;
+    }
+    return foldedGreen <= 2 ? 1 : foldedGreen <= 8 ? 2 : 3;
+  }
+
+  void encode(RangeCoder::Encoder &encoder, const Color &color,
+              const Color &predicted) {
+    const int green = color[1] - predicted[1];
+    const unsigned char foldedGreen = foldDelta(green);
+    const int context = greenContext(foldedGreen);
+    encoder.encodeByte(this->green, foldedGreen);
+    encoder.encodeByte(red[context],
+                       foldDelta(color[0] - predicted[0] - green));
+    encoder.encodeByte(blue[context],
+                       foldDelta(color[2] - predicted[2] - green));
+  }
+
+  Color decode(RangeCoder::Decoder &decoder, const Color &predicted) {
+    const unsigned char foldedGreen = decoder.decodeByte(this->green);
+    const int context = greenContext(foldedGreen);
+    const int green = unfoldDelta(foldedGreen);
+    const int redResidual = unfoldDelta(decoder.decodeByte(red[context]));
+    const int blueResidual = unfoldDelta(decoder.decodeByte(blue[context]));
+    return {static_cast<unsigned char>(predicted[0] + redResidual + green),
+            static_cast<unsigned char>(predicted[1] + green),
+            static_cast<unsigned char>(predicted[2] + blueResidual + green)};
+  }
+};
+
+// fills a block of a 3 channel image
+inline void fillBlock(Image &image, const QuadRect &rect, const Color &color) {
+  const size_t rowStride = static_cast<size_t>(image.getWidth()) * 3;
+  unsigned char *row = image.getImageData() + image.getIdxAt(rect.x, rect.y, 0);
+  for (int y = 0; y < rect.height; ++y, row += rowStride) {
+    unsigned char *pixel = row;
+    for (int x = 0; x < rect.width; ++x, pixel += 3) {
+      pixel[0] = color[0];
+      pixel[1] = color[1];
+      pixel[2] = color[2];
+    }
+  }
+}
+
+// The tree as far as it is coded, kept the same way on both sides so they
+// predict the same colours. Z-order codes the pixels left of and above the
+// top-left corner of a block before the block, on its level and on every
+// coarser one, so the nodes covering them are always known.
+class CodedTree {
+public:
+  static constexpr uint32_t kRoot = 0;
+
+  CodedTree(int width, int height) : mWidth(width), mHeight(height) {
+    mNodes.push_back({kNoChildren, {0, 0, 0}});
+  }
+
+  uint32_t split(uint32_t node) {
+    const uint32_t firstChild = static_cast<uint32_t>(mNodes.size());
+    mNodes[node].firstChild = firstChild;
+    mNodes.resize(mNodes.size() + 4, {kNoChildren, {0, 0, 0}});
+    return firstChild;
+  }
+
+  void setColor(uint32_t node, const Color &color) {
+    mNodes[node].color = color;
+  }
+
+  // median edge detector (LOCO-I) over the nodes left, above and above left
+  // of the block, no deeper than maxDepth
+  Color predict(const QuadRect &rect,
+                int maxDepth = LinearQuadtree::MAX_DEPTH) const {
+    if (rect.x == 0 && rect.y == 0) {
+      return {0, 0, 0};
+    }
+    if (rect.y == 0) {
+      return colorAt(rect.x - 1, 0, maxDepth);
+    }
+    if (rect.x == 0) {
+      return colorAt(0, rect.y - 1, maxDepth);
+    }
+    const Color left = colorAt(rect.x - 1, rect.y, maxDepth);
+    const Color above = colorAt(rect.x, rect.y - 1, maxDepth);
+    const Color corner = colorAt(rect.x - 1, rect.y - 1, maxDepth);
+    Color predicted;
+    for (int channel = 0; channel < 3; ++channel) {
+      const int a = left[channel];
+      const int b = above[channel];
+      const int c = corner[channel];
+      if (c >= (std::max)(a, b)) {
+        predicted[channel] = static_cast<unsigned char>((std::min)(a, b));
+      } else if (c <= (std::min)(a, b)) {
+        predicted[channel] = static_cast<unsigned char>((std::max)(a, b));
+      } else {
+        predicted[channel] = static_cast<unsigned char>(a + b - c);
+      }
+    }
+    return predicted;
+  }
+
+private:
+  static constexpr uint32_t kNoChildren = 0;
+
+  struct Node {
+    uint32_t firstChild;
+    Color color;
+  };
+
+  int mWidth;
+  int mHeight;
+  std::vector<Node> mNodes;
+
+  Color colorAt(int x, int y, int maxDepth) const {
+    QuadRect rect = {0, 0, mWidth, mHeight};
+    uint32_t node = kRoot;
+    for (int depth = 0;
+         depth < maxDepth && mNodes[node].firstChild != kNoChildren;
+         ++depth) {
+      const int quadrant =
+          (x >= rect.x + splitOffset(rect.width, kSplitAlignment) ? 1 : 0) |
+          (y >= rect.y + splitOffset(rect.height, kSplitAlignment) ? 2 : 0);
+      rect = LinearQuadtree::childRect(rect, quadrant, kSplitAlignment);
+      node = mNodes[node].firstChild + quadrant;
+    }
+    return mNodes[node].color;
+  }
+};
+
+// QuadtreeNode::divide stores the top-right quadrant first
+constexpr int kPointerChild[4] = {1, 0, 2, 3};
+
+template <typename Visit>
+bool walkPointer(const QuadtreeNode *node, int depth, Visit &visit) {
+  const QuadRect rect = {node->mPosX, node->mPosY, node->mWidth,
+                         node->mHeight};
+  if (!visit(rect, depth, node->mIsDivided)) {
+    return false;
+  }
+  if (!node->mIsDivided) {
+    return true;
+  }
+  for (int quadrant = 0; quadrant < 4; ++quadrant) {
+    if (!walkPointer(node->mChildren[kPointerChild[quadrant]], depth + 1,
+                     visit)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// a node is a leaf when it is the next leaf code
+template <typename Visit>
+bool walkLinear(const std::vector<uint64_t> &leaves, size_t &cursor,
+                const QuadRect &rect, uint64_t code, int depth,
+                Visit &visit) {
+  const bool isLeaf = cursor < leaves.size() && leaves[cursor] == code;
+  if (!visit(rect, depth, !isLeaf)) {
+    return false;
+  }
+  if (isLeaf) {
+    ++cursor;
+    return true;
+  }
+  if (depth >= LinearQuadtree::MAX_DEPTH) {
+    return false;
+  }
+  for (int quadrant = 0; quadrant < 4; ++quadrant) {
+    if (!walkLinear(leaves, cursor,
+                    LinearQuadtree::childRect(rect, quadrant,
+                                              kSplitAlignment),
+                    LinearQuadtree::childCode(code, quadrant), depth + 1,
+                    visit)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// calls visit(rect, depth, isSplit) on every node of a built tree, depth
+// first in Z-order (top-left, top-right, bottom-left, bottom-right), in
+// either representation; stops with false at the first visit returning
+// false, when the tree isn't built or isn't split at the middle
+template <typename Visit>
+bool walkTree(const QuadtreeImage &quadtree, Visit &&visit) {
+  if (quadtree.getImage().getSplitAlignment() != kSplitAlignment) {
+    return false;
+  }
+  if (quadtree.getRepresentation() == QuadtreeImage::Representation::Linear) {
+    const LinearQuadtree &tree = quadtree.getLinearTree();
+    if (tree.getLeafCount() == 0) {
+      return false;
+    }
+    size_t cursor = 0;
+    return walkLinear(tree.getLeaves(), cursor,
+                      {0, 0, tree.getWidth(), tree.getHeight()},
+                      LinearQuadtree::ROOT_CODE, 0, visit);
+  }
+  return quadtree.getRoot() && walkPointer(quadtree.getRoot(), 0, visit);
+}
+
+} // namespace QTC
+
+#endif
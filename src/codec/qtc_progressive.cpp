@@ -0,0 +1,247 @@
+#include "qtc_progressive.h"
+#include "qtc_codec.h"
+#include "qtc_detail.h"
+#include <optional>
+
+namespace QTC {
+namespace {
+
+// the nodes of a level are coded once the level above is complete, so the
+// same level neighbours come from the coded tree cut at that level; the
+// top-left block has none and takes the colour of its parent
+Color predictColor(const CodedTree &codedTree, const QuadRect &rect,
+                   int depth, const Color &parent) {
+  if (rect.x == 0 && rect.y == 0) {
+    return depth == 0 ? Color{0, 0, 0} : parent;
+  }
+  return codedTree.predict(rect, depth);
+}
+
+struct LevelNode {
+  QuadRect rect;
+  bool isSplit;
+};
+
+} // namespace
+
+bool encodeProgressive(const QuadtreeImage &quadtree,
+                       std::vector<unsigned char> &out) {
+  // a depth first walk in Z-order meets the nodes of every level in the
+  // Z-order of that level
+  std::vector<std::vector<LevelNode>> levels;
+  const int minBlockSize = quadtree.getMinBlockSize();
+  const bool isWalked = walkTree(
+      quadtree, [&](const QuadRect &rect, int depth, bool isSplit) {
+        if (isSplit &&
+            !QuadtreeImage::isDivisible(rect.width, rect.height,
+                                        minBlockSize)) {
+          return false;
+        }
+        if (static_cast<int>(levels.size()) <= depth) {
+          levels.resize(depth + 1);
+        }
+        levels[depth].push_back({rect, isSplit});
+        return true;
+      });
+  if (!isWalked) {
+    return false;
+  }
+
+  writeHeader(out, kProgressiveMagic, quadtree);
+  std::array<RangeCoder::BitModel, kMaxContextDepth + 1> splitModels;
+  ColorModels colorModels;
+  CodedTree codedTree(quadtree.getImage().getWidth(),
+                      quadtree.getImage().getHeight());
+  // coded node and colour of every node of the level, parent first
+  std::vector<uint32_t> codedNodes = {CodedTree::kRoot};
+  std::vector<Color> parentColors = {{0, 0, 0}};
+  std::vector<unsigned char> chunk;
+
+  for (size_t depth = 0; depth < levels.size(); ++depth) {
+    const std::vector<LevelNode> &level = levels[depth];
+    if (level.size() != codedNodes.size()) {
+      return false;
+    }
+    std::vector<uint32_t> nextCodedNodes;
+    std::vector<Color> nextParentColors;
+    chunk.clear();
+    RangeCoder::Encoder encoder(chunk);
+    for (size_t i = 0; i < level.size(); ++i) {
+      const QuadRect &rect = level[i].rect;
+      Color color = parentColors[i];
+      if (rect.width > 0 && rect.height > 0) {
+        color = quadtree.getBlockColor(rect);
+        colorModels.encode(encoder, color,
+                           predictColor(codedTree, rect,
+                                        static_cast<int>(depth),
+                                        parentColors[i]));
+        codedTree.setColor(codedNodes[i], color);
+      }
+      if (QuadtreeImage::isDivisible(rect.width, rect.height,
+                                     minBlockSize)) {
+        encoder.encodeBit(splitModels[splitContext(static_cast<int>(depth))],
+                          level[i].isSplit);
+      }
+      if (level[i].isSplit) {
+        const uint32_t firstChild = codedTree.split(codedNodes[i]);
+        for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+          nextCodedNodes.push_back(firstChild + quadrant);
+          nextParentColors.push_back(color);
+        }
+      }
+    }
+    encoder.flush();
+    writeWord(out, static_cast<uint32_t>(chunk.size()));
+    out.insert(out.end(), chunk.begin(), chunk.end());
+    codedNodes.swap(nextCodedNodes);
+    parentColors.swap(nextParentColors);
+  }
+  patchCount(out, static_cast<uint32_t>(levels.size()));
+  return true;
+}
+
+struct ProgressiveReader::State {
+  Header header;
+  std::optional<CodedTree> codedTree;
+  // coded tree nodes of the next level, in Z-order
+  std::vector<uint32_t> codedNodes = {CodedTree::kRoot};
+  std::array<RangeCoder::BitModel, kMaxContextDepth + 1> splitModels;
+  ColorModels colorModels;
+};
+
+ProgressiveReader::ProgressiveReader()
+    : mState(std::make_unique<State>()), mNodeCount(0), mIsValid(true) {}
+
+ProgressiveReader::~ProgressiveReader() = default;
+
+int ProgressiveReader::getTotalLevels() const {
+  return mState->codedTree ? static_cast<int>(mState->header.count) : 0;
+}
+
+bool ProgressiveReader::isComplete() const {
+  return mIsValid && mState->codedTree &&
+         mLevels.size() == mState->header.count;
+}
+
+bool ProgressiveReader::push(const unsigned char *data, size_t size) {
+  if (!mIsValid) {
+    return false;
+  }
+  mPending.insert(mPending.end(), data, data + size);
+
+  size_t position = 0;
+  if (!mState->codedTree) {
+    if (mPending.size() < kHeaderSize) {
+      return true;
+    }
+    Header &header = mState->header;
+    if (!hasMagic(mPending.data(), mPending.size(), kProgressiveMagic) ||
+        !readHeader(mPending.data(), mPending.size(), header) ||
+        header.count == 0 ||
+        header.count > static_cast<uint32_t>(LinearQuadtree::MAX_DEPTH) + 1) {
+      mIsValid = false;
+      return false;
+    }
+    mState->codedTree.emplace(static_cast<int>(header.width),
+                              static_cast<int>(header.height));
+    position = kHeaderSize;
+  }
+
+  // a chunk is decoded once all of it is there
+  while (mLevels.size() < mState->header.count &&
+         mPending.size() - position >= sizeof(uint32_t)) {
+    const size_t chunkSize = readWord(mPending.data() + position);
+    if (mPending.size() - position - sizeof(uint32_t) < chunkSize) {
+      break;
+    }
+    position += sizeof(uint32_t);
+    if (!decodeLevel(mPending.data() + position, chunkSize)) {
+      mIsValid = false;
+      return false;
+    }
+    position += chunkSize;
+  }
+  mPending.erase(mPending.begin(), mPending.begin() + position);
+  return true;
+}
+
+bool ProgressiveReader::decodeLevel(const unsigned char *data, size_t size) {
+  State &state = *mState;
+  const int depth = static_cast<int>(mLevels.size());
+  const int minBlockSize = static_cast<int>(state.header.minBlockSize);
+
+  // the children of the split nodes of the level above, in Z-order
+  std::vector<NodeRecord> level;
+  if (depth == 0) {
+    level.push_back({{0, 0, static_cast<int>(state.header.width),
+                      static_cast<int>(state.header.height)},
+                     {0, 0, 0},
+                     false});
+  } else {
+    for (const NodeRecord &parent : mLevels.back()) {
+      if (!parent.isSplit) {
+        continue;
+      }
+      for (int quadrant = 0; quadrant < 4; ++quadrant) {
+        level.push_back(
+            {LinearQuadtree::childRect(parent.rect, quadrant, kSplitAlignment),
+             parent.color, false});
+      }
+    }
+  }
+
+  RangeCoder::Decoder decoder(data, size);
+  std::vector<uint32_t> nextCodedNodes;
+  for (size_t i = 0; i < level.size(); ++i) {
+    NodeRecord &node = level[i];
+    const uint32_t codedNode = state.codedNodes[i];
+    // empty blocks keep the colour of their parent, they paint nothing
+    if (node.rect.width > 0 && node.rect.height > 0) {
+      node.color = state.colorModels.decode(
+          decoder,
+          predictColor(*state.codedTree, node.rect, depth, node.color));
+      state.codedTree->setColor(codedNode, node.color);
+    }
+    node.isSplit =
+        QuadtreeImage::isDivisible(node.rect.width, node.rect.height,
+                                   minBlockSize) &&
+        decoder.decodeBit(state.splitModels[splitContext(depth)]);
+    if (node.isSplit) {
+      const uint32_t firstChild = state.codedTree->split(codedNode);
+      for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+        nextCodedNodes.push_back(firstChild + quadrant);
+      }
+    }
+  }
+  // the last level splits nothing and every other one splits something
+  const bool isLast = depth + 1 == static_cast<int>(state.header.count);
+  if (decoder.isOverrun() || nextCodedNodes.empty() != isLast) {
+    return false;
+  }
+
+  state.codedNodes.swap(nextCodedNodes);
+  mNodeCount += level.size();
+  mLevels.push_back(std::move(level));
+  return true;
+}
+
+bool ProgressiveReader::render(Image &image) const {
+  if (mLevels.empty()) {
+    return false;
+  }
+  image = Image(static_cast<int>(mState->header.width),
+                static_cast<int>(mState->header.height), 3,
+                image.getFileExt());
+  // every pixel is painted once, by a leaf or by a node of the last level
+  for (size_t depth = 0; depth < mLevels.size(); ++depth) {
+    const bool isDeepest = depth + 1 == mLevels.size();
+    for (const NodeRecord &node : mLevels[depth]) {
+      if (!node.isSplit || isDeepest) {
+        fillBlock(image, node.rect, node.color);
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace QTC
@@ -0,0 +1,77 @@
+#ifndef QTC_PROGRESSIVE_H
+#define QTC_PROGRESSIVE_H
+
+#include "image/image.h"
+#include "quadtree/quadtreeimage.h"
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// The progressive .qtc layout (QTC::Layout::Progressive): after the header
+// (counting levels), every level of the tree is a chunk of its own, a
+// 32-bit byte length followed by a range coded stream. Level n holds, for
+// each of its nodes in Z-order, the block average colour and the split
+// flag, so the nodes of level n + 1 are known once it is read. A colour is
+// predicted from the nodes of the same level left of and above it, which
+// were all read before it.
+//
+// Levels refine the image the way QuadtreeImage::applyAnimation() shows
+// it: the first few levels are a few hundred bytes and already render a
+// coarse preview of the whole image.
+namespace QTC {
+
+bool encodeProgressive(const QuadtreeImage &quadtree,
+                       std::vector<unsigned char> &out);
+
+// Incremental decoder of a progressive stream. Bytes are pushed as they
+// arrive, from a pipe or a file still being read, and every level whose
+// chunk is complete is decoded at once, at a cost proportional to its
+// nodes. render() paints the levels read so far.
+class ProgressiveReader {
+public:
+  ProgressiveReader();
+  ~ProgressiveReader();
+
+  ProgressiveReader(const ProgressiveReader &) = delete;
+  ProgressiveReader &operator=(const ProgressiveReader &) = delete;
+
+  // false once the stream is found to be malformed, every later push fails
+  // as well
+  bool push(const unsigned char *data, size_t size);
+  // false once a push found the stream malformed; a stream that is only
+  // cut short stays valid
+  bool isValid() const { return mIsValid; }
+
+  // levels decoded so far, of the getTotalLevels() in the stream (0 until
+  // the header is read)
+  int getLevelCount() const { return static_cast<int>(mLevels.size()); }
+  int getTotalLevels() const;
+  bool isComplete() const;
+  size_t getNodeCount() const { return mNodeCount; }
+
+  // the leaves of the levels read and the nodes of the deepest of them, as
+  // a 3 channel image saved as the file extension the image had before;
+  // false before the first level is read
+  bool render(Image &image) const;
+
+private:
+  struct State;
+  struct NodeRecord {
+    QuadRect rect;
+    std::array<unsigned char, 3> color;
+    bool isSplit;
+  };
+
+  std::unique_ptr<State> mState;
+  std::vector<unsigned char> mPending;
+  std::vector<std::vector<NodeRecord>> mLevels;
+  size_t mNodeCount;
+  bool mIsValid;
+
+  bool decodeLevel(const unsigned char *data, size_t size);
+};
+
+} // namespace QTC
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef RANGE_CODER_H
+#define RANGE_CODER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Adaptive binary range coder (the carry-propagating coder of LZMA).
+// Every binary decision is coded against a BitModel, the probability of a 0
+// in 1/kProbabilityOne units, which moves 1/2^kAdaptShift of the way towards
+// each coded bit. Bytes are coded as eight decisions down a ByteModel, a
+// binary tree whose node probabilities adapt separately, so small values
+// that share their high bits also share most of their cost.
+namespace RangeCoder {
+
+constexpr int kProbabilityBits = 11;
+constexpr uint32_t kProbabilityOne = 1u << kProbabilityBits;
+constexpr int kAdaptShift = 5;
+constexpr uint32_t kTopValue = 1u << 24;
+
+struct BitModel {
+  uint16_t probability = kProbabilityOne / 2;
+};
+
+struct ByteModel {
+  // node 0 is unused, the children of node n are 2n and 2n + 1
+  std::array<BitModel, 256> nodes;
+};
+
+class Encoder {
+public:
+  explicit Encoder(std::vector<unsigned char> &out)
+      : mOut(out), mLow(0), mRange(0xFFFFFFFFu), mCache(0), mCacheSize(1) {}
+
+  void encodeBit(BitModel &model, int bit) {
+    const uint32_t bound = (mRange >> kProbabilityBits) * model.probability;
+    if (bit == 0) {
+      mRange = bound;
+      model.probability += (kProbabilityOne - model.probability) >> kAdaptShift;
+    } else {
+      mLow += bound;
+      mRange -= bound;
+      model.probability -= model.probability >> kAdaptShift;
+    }
+    while (mRange < kTopValue) {
+      mRange <<= 8;
+      shiftLow();
+    }
+  }
+
+  void encodeByte(ByteModel &model, unsigned char value) {
+    uint32_t node = 1;
+    for (int bit = 7; bit >= 0; --bit) {
+      const int current = (value >> bit) & 1;
+      encodeBit(model.nodes[node], current);
+      node = (node << 1) | current;
+    }
+  }
+
+  // pushes out the pending bytes, the encoder can't be used afterwards
+  void flush() {
+    for (int i = 0; i < 5; ++i) {
+      shiftLow();
+    }
+  }
+
+private:
+  std::vector<unsigned char> &mOut;
+  uint64_t mLow;
+  uint32_t mRange;
+  unsigned char mCache;
+  uint64_t mCacheSize;
+
+  // a byte is held back while a carry out of the low bits can still ripple
+  // into it
+  void shiftLow() {
+    if (static_cast<uint32_t>(mLow) < 0xFF000000u || (mLow >> 32) != 0) {
+      const unsigned char carry = static_cast<unsigned char>(mLow >> 32);
+      unsigned char pending = mCache;
+      do {
+        mOut.push_back(static_cast<unsigned char>(pending + carry));
+        pending = 0xFF;
+      } while (--mCacheSize != 0);
+      mCache = static_cast<unsigned char>(mLow >> 24);
+    }
+    ++mCacheSize;
+    mLow = (mLow & 0x00FFFFFFu) << 8;
+  }
+};
+
+class Decoder {
+public:
+  Decoder(const unsigned char *data, size_t size)
+      : mData(data), mSize(size), mPosition(0), mRange(0xFFFFFFFFu),
+        mCode(0) {
+    for (int i = 0; i < 5; ++i) {
+      mCode = (mCode << 8) | nextByte();
+    }
+  }
+
+  int decodeBit(BitModel &model) {
+    const uint32_t bound = (mRange >> kProbabilityBits) * model.probability;
+    int bit;
+    if (mCode < bound) {
+      mRange = bound;
+      model.probability += (kProbabilityOne - model.probability) >> kAdaptShift;
+      bit = 0;
+    } else {
+      mCode -= bound;
+      mRange -= bound;
+      model.probability -= model.probability >> kAdaptShift;
+      bit = 1;
+    }
+    while (mRange < kTopValue) {
+      mRange <<= 8;
+      mCode = (mCode << 8) | nextByte();
+    }
+    return bit;
+  }
+
+  unsigned char decodeByte(ByteModel &model) {
+    uint32_t node = 1;
+    while (node < 256) {
+      node = (node << 1) | decodeBit(model.nodes[node]);
+    }
+    return static_cast<unsigned char>(node - 256);
+  }
+
+  // a truncated stream reads as zeros past its end; the decoder stays
+  // behind the encoder by the bytes flush() wrote
+  bool isOverrun() const { return mPosition > mSize; }
+
+private:
+  const unsigned char *mData;
+  size_t mSize;
+  size_t mPosition;
+  uint32_t mRange;
+  uint32_t mCode;
+
+  uint32_t nextByte() {
+    const uint32_t byte = mPosition < mSize ? mData[mPosition] : 0;
+    ++mPosition;
+    return byte;
+  }
+};
+
+} // namespace RangeCoder
+
+#endif
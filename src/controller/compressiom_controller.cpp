@@ -1,14 +1,60 @@
 #include "controller/compression_controller.h"
+#include "codec/png_encoder.h"
+#include "codec/qtc_codec.h"
+#include "image/color_palette.h"
 #include "quadtree/quadtreeimage.h"
+#include "quadtree/size_predictor.h"
+#include "utils/instrumentation.h"
+#include "utils/thread_pool.h"
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cmath>
 #include <cstdlib>
 #include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <set>
 #include <string>
 #include <utility>
 
 namespace fs = std::filesystem;
 
+const char *progressStageName(ProgressStage stage) {
+  switch (stage) {
+  case ProgressStage::Loading:
+    return "loading";
+  case ProgressStage::Precompute:
+    return "precompute";
+  case ProgressStage::FindingTarget:
+    return "finding_target";
+  case ProgressStage::BuildingTree:
+    return "building_tree";
+  case ProgressStage::TransformingImage:
+    return "transforming_image";
+  case ProgressStage::SavingImage:
+    return "saving_image";
+  case ProgressStage::CreatingGif:
+    return "creating_gif";
+  case ProgressStage::Finished:
+    return "finished";
+  }
+  return "unknown";
+}
+
+CompressionController::CompressionController()
+    : mErrorMethod(nullptr), mTargetCompression(0.0),
+      mThreadCount(ThreadPool::defaultThreadCount()), mTargetProbeCount(1),
+      mUseLinearTree(false), mTileSize(0), mIsQtcOutput(false),
+      mQtcLayout(QTC::Layout::DepthFirst),
+      mPaletteMode(QuadtreeImage::PaletteMode::Exact),
+      mAlignSplitsToMcu(false) {}
+
+CompressionController::~CompressionController() { delete mErrorMethod; }
+
 bool CompressionController::setInputPath(std::string path) {
   fs::path filePath(path);
   filePath = fs::absolute(filePath);
@@ -50,12 +96,53 @@ bool CompressionController::setMinBlockSize(int blockSize) {
   return true;
 }
 bool CompressionController::setTargetCompression(double target) {
+  if (target > 0.0 && mTileSize > 0) {
+    std::cerr << "Error: a target compression can't be combined with tiles"
+              << std::endl;
+    return false;
+  }
   if (target >= 0.0 && target <= 1.0) {
     mTargetCompression = target;
     return true;
   }
   return false;
 }
+bool CompressionController::setThreadCount(int threadCount) {
+  if (threadCount >= 1) {
+    mThreadCount = threadCount;
+    return true;
+  }
+  return false;
+}
+bool CompressionController::setTargetProbeCount(int probeCount) {
+  if (probeCount >= 1) {
+    mTargetProbeCount = probeCount;
+    return true;
+  }
+  return false;
+}
+bool CompressionController::setUseLinearTree(bool useLinearTree) {
+  mUseLinearTree = useLinearTree;
+  return true;
+}
+bool CompressionController::setTileSize(int tileSize) {
+  // each tile is searched and saved on its own, a target, a GIF or a tree
+  // would have to span them
+  if (tileSize > 0 && (mTargetCompression > 0.0 ||
+                       !mGifOutputPath.empty() || mIsQtcOutput)) {
+    std::cerr << "Error: tiles can't be combined with "
+              << (mTargetCompression > 0.0 ? "a target compression"
+                  : mIsQtcOutput           ? "a .qtc output"
+                                           : "a GIF output")
+              << std::endl;
+    return false;
+  }
+  if (tileSize >= 0) {
+    mTileSize = tileSize;
+    return true;
+  }
+  return false;
+}
 bool CompressionController::setOutputPath(std::string path) {
   fs::path filePath(path);
   filePath = fs::absolute(filePath);
@@ -64,12 +151,31 @@ bool CompressionController::setOutputPath(std::string path) {
   std::transform(ext.begin(), ext.end(), ext.begin(),
                  [](unsigned char c) { return std::tolower(c); });
 
-  if (ext == mFileExt) {
+  if (ext == QTC::kFileExt && mTileSize > 0) {
+    std::cerr << "Error: a .qtc output can't be combined with tiles"
+              << std::endl;
+    return false;
+  }
+  if (ext == mFileExt || ext == QTC::kFileExt) {
     mOutputPath = filePath.string();
+    mIsQtcOutput = ext == QTC::kFileExt;
     return true;
   }
   return false;
 }
+bool CompressionController::setQtcLayout(QTC::Layout layout) {
+  mQtcLayout = layout;
+  return true;
+}
+bool CompressionController::setPaletteMode(
+    QuadtreeImage::PaletteMode paletteMode) {
+  mPaletteMode = paletteMode;
+  return true;
+}
+bool CompressionController::setAlignSplitsToMcu(bool alignSplitsToMcu) {
+  mAlignSplitsToMcu = alignSplitsToMcu;
+  return true;
+}
 bool CompressionController::setGifOutputPath(std::string path) {
   fs::path filePath(path);
   if (filePath.empty()) {
@@ -82,117 +188,615 @@ bool CompressionController::setGifOutputPath(std::string path) {
   std::transform(ext.begin(), ext.end(), ext.begin(),
                  [](unsigned char c) { return std::tolower(c); });
 
+  if (ext == ".gif" && mTileSize > 0) {
+    std::cerr << "Error: a GIF output can't be combined with tiles"
+              << std::endl;
+    return false;
+  }
   if (ext == ".gif") {
     mGifOutputPath = filePath.string();
     return true;
   }
   return false;
 }
+bool CompressionController::setReportPath(std::string path) {
+  if (path.empty()) {
+    mReportPath = "";
+    return true;
+  }
+  mReportPath = fs::absolute(fs::path(path)).string();
+  return true;
+}
+
 bool CompressionController::run(
     std::function<void(const ProgressStage &)> progressCallback) {
+  result = CompressionResult();
+  // the CPU time of this run alone, while other images of a batch run on
+  // other threads of the process
+  CpuAccount cpuAccount;
+  const CpuAccount::Scope cpuScope(&cpuAccount);
+  const StageStopwatch runStopwatch;
+  StageStopwatch stageStopwatch;
+
+  // closes the metrics of the running stage before the callback so the time
+  // spent in the callback (drawing progress bars) is not billed to any stage
+  auto enterStage = [&](ProgressStage stage) {
+    if (!result.stageMetrics.empty()) {
+      result.stageMetrics.back().wallMs = stageStopwatch.wallMs();
+      result.stageMetrics.back().cpuMs = stageStopwatch.cpuMs();
+    }
+    progressCallback(stage);
+    if (stage != ProgressStage::Finished) {
+      result.stageMetrics.push_back({stage});
+    }
+    stageStopwatch.restart();
+  };
 
-  progressCallback(ProgressStage::Loading);
+  enterStage(ProgressStage::Loading);
   Image image(mInputPath);
-  image.load();
+  // a tiled PNG is read a row of tiles at a time, when its pixels allow
+  PngReader reader;
+  const bool isStreamed =
+      mTileSize > 0 && mFileExt == ".png" && reader.open(mInputPath);
+  if (!isStreamed && image.load()) {
+    return false;
+  }
+  if (mIsQtcOutput &&
+      !QTC::isEncodable(image.getWidth(), image.getHeight())) {
+    std::cerr << "Error: " << image.getWidth() << "x" << image.getHeight()
+              << " is too large for a " << QTC::kFileExt << " output"
+              << std::endl;
+    return false;
+  }
+  // a leaf edge inside an MCU is a sharp edge the encoder spends AC
+  // coefficients on, a leaf of whole MCUs leaves them flat
+  if (mAlignSplitsToMcu && !mIsQtcOutput &&
+      (mFileExt == ".jpg" || mFileExt == ".jpeg")) {
+    image.setSplitAlignment(Image::kJpegMcuSize);
+  }
 
-  progressCallback(ProgressStage::Precompute);
-  image.computeSummedAreaTable();
-  std::string methodId = mErrorMethod->getIdentifier();
-  if (methodId == "SIM" || methodId == "VAR") {
-    image.computeSummedSquareTable();
+  if (mTileSize > 0) {
+    if (!runTiled(image, isStreamed ? &reader : nullptr, enterStage)) {
+      return false;
+    }
+    enterStage(ProgressStage::Finished);
+    result.computationTime = runStopwatch.wallMs();
+    return mReportPath.empty() || writeReport();
   }
 
+  enterStage(ProgressStage::Precompute);
+  mErrorMethod->prepareImage(image);
+
+  // the target search cuts one maximal tree instead of re-evaluating every
+  // block for each probed threshold, the final build reuses it as well
+  ErrorTree errorTree;
   if (mTargetCompression) {
-    progressCallback(ProgressStage::FindingTarget);
+    enterStage(ProgressStage::FindingTarget);
+    errorTree.build(image, mMinBlockSize, mErrorMethod, mThreadCount);
+    addBuildCounters(errorTree.getCounters());
     long long targetSize = (1.0 - mTargetCompression) * image.getFileSize();
-    findTargetCompression(image, targetSize);
+    findTargetCompression(image, targetSize, errorTree);
   }
 
-  progressCallback(ProgressStage::BuildingTree);
+  enterStage(ProgressStage::BuildingTree);
   QuadtreeImage quadtree(image, mThreshold, mMinBlockSize, mErrorMethod);
+  quadtree.setThreadCount(mThreadCount);
+  quadtree.setErrorTree(&errorTree);
+  quadtree.setPaletteMode(getOutputPaletteMode());
+  if (mUseLinearTree) {
+    quadtree.setRepresentation(QuadtreeImage::Representation::Linear);
+  }
   if (!quadtree.build()) {
     return false;
   }
+  addBuildCounters(quadtree.getCounters());
 
-  progressCallback(ProgressStage::TransformingImage);
-  Image resultImage = quadtree.apply();
+  size_t outputSize = 0;
+  if (mIsQtcOutput) {
+    // the tree is written as it is, no pixels are painted
+    enterStage(ProgressStage::SavingImage);
+    if (!QTC::save(quadtree, mOutputPath, mQtcLayout)) {
+      return false;
+    }
+    std::error_code ec;
+    outputSize = static_cast<size_t>(fs::file_size(mOutputPath, ec));
+  } else {
+    enterStage(ProgressStage::TransformingImage);
+    Image resultImage = quadtree.apply();
 
-  progressCallback(ProgressStage::SavingImage);
-  resultImage.save(mOutputPath);
+    enterStage(ProgressStage::SavingImage);
+    resultImage.save(mOutputPath, mThreadCount);
+    outputSize = resultImage.getFileSize();
+  }
+  result.bytesEncoded += outputSize;
+  result.encodeCount++;
 
   result.originalFileSize = image.getFileSize();
-  result.compressedFileSize = resultImage.getFileSize();
+  result.compressedFileSize = outputSize;
   result.compressionPercentage =
-      (1.0 -
-       static_cast<double>(resultImage.getFileSize()) / image.getFileSize()) *
-      100;
+      (1.0 - static_cast<double>(outputSize) / image.getFileSize()) * 100;
   result.quadtreeDepth = quadtree.getDepth();
   result.quadtreeNodeCount = quadtree.getNodeCount();
+  result.nodeArenaSlabCount = quadtree.getArenaSlabCount();
+  result.nodeArenaBytesReserved = quadtree.getArenaBytesReserved();
+  result.nodeArenaBytesUsed = quadtree.getArenaBytesUsed();
+  result.nodesPerLevel = quadtree.computeNodesPerLevel();
+  result.summedTableBytes = image.getSummedTable().getBytesUsed();
   result.outputFilePath = mOutputPath;
   result.gifOutputPath = mGifOutputPath;
 
   if (!mGifOutputPath.empty()) {
-    progressCallback(ProgressStage::CreatingGif);
+    enterStage(ProgressStage::CreatingGif);
     ImageSequence resultSequence = quadtree.applyAnimation();
     resultSequence.save(mGifOutputPath);
   }
 
-  progressCallback(ProgressStage::Finished);
+  enterStage(ProgressStage::Finished);
+  result.computationTime = runStopwatch.wallMs();
+  if (!mReportPath.empty() && !writeReport()) {
+    return false;
+  }
   return true;
 }
 
-void CompressionController::findTargetCompression(Image &image,
-                                                  long long targetSize) {
-  long long leftSize, rightSize, middleSize;
-  Image res(mInputPath);
-  double rightThreshold = mErrorMethod->getUpperBound();
-  double leftThreshold = mErrorMethod->getLowerBound();
-  if (mErrorMethod->getIdentifier() == "SIM") {
-    std::swap(rightThreshold, leftThreshold);
-  }
-  double middleThreshold;
-  QuadtreeImage quadtreeLeft(image, leftThreshold, mMinBlockSize, mErrorMethod);
-  quadtreeLeft.build();
-  res = quadtreeLeft.apply();
-  leftSize = res.estimateFileSize();
-  if (targetSize > leftSize) {
-    mThreshold = leftThreshold;
-    return;
+bool CompressionController::runTiled(
+    Image &image, PngReader *reader,
+    const std::function<void(ProgressStage)> &enterStage) {
+  enterStage(ProgressStage::BuildingTree);
+  const int imageWidth = reader ? reader->getWidth() : image.getWidth();
+  const int imageHeight = reader ? reader->getHeight() : image.getHeight();
+  const int channels = reader ? reader->getChannels() : image.getChannels();
+  const int tilesX = (imageWidth + mTileSize - 1) / mTileSize;
+  const int tilesY = (imageHeight + mTileSize - 1) / mTileSize;
+
+  // a streamed image only ever holds one row of tiles: it is read into the
+  // band, compressed in place and written out before the next is read.
+  // Its output can't be indexed, the palette is only known at the end.
+  PngEncoder::StreamWriter writer;
+  Image band(reader ? imageWidth : 0,
+             reader ? std::min(mTileSize, imageHeight) : 0, channels,
+             mFileExt);
+  Image &source = reader ? band : image;
+  const QuadtreeImage::PaletteMode paletteMode =
+      reader ? QuadtreeImage::PaletteMode::Off : getOutputPaletteMode();
+  if (reader &&
+      !writer.open(mOutputPath, imageWidth, imageHeight, channels)) {
+    std::cerr << "Error: can't write " << mOutputPath << std::endl;
+    return false;
   }
 
-  QuadtreeImage quadtreeRight(image, rightThreshold, mMinBlockSize,
-                              mErrorMethod);
-  quadtreeRight.build();
-  res = quadtreeRight.apply();
-  rightSize = res.estimateFileSize();
+  // tiles cover disjoint pixels, so they are cropped from and pasted back
+  // into the source concurrently; at most one tile per thread (its pixels,
+  // table and tree) is resident at a time
+  std::mutex resultMutex;
+  std::atomic<bool> isFailed(false);
+  // the colours of every tile, while each of them had a palette
+  std::set<std::array<unsigned char, 3>> palette;
+  bool hasPalette = true;
+  {
+    ThreadPool pool(mThreadCount);
+    for (int tileY = 0; tileY < tilesY && !isFailed; ++tileY) {
+      const int rows = std::min(mTileSize, imageHeight - tileY * mTileSize);
+      if (reader && !reader->readRows(band.getImageData(), rows)) {
+        std::cerr << "Error: " << mInputPath << " is truncated or corrupt"
+                  << std::endl;
+        isFailed = true;
+        break;
+      }
+      for (int tileX = 0; tileX < tilesX; ++tileX) {
+        pool.submit([&, tileX, tileY, rows]() {
+          const int x = tileX * mTileSize;
+          const int y = reader ? 0 : tileY * mTileSize;
+          const int width = std::min(mTileSize, source.getWidth() - x);
+
+          Image tile = source.crop(x, y, width, rows);
+          tile.setSplitAlignment(source.getSplitAlignment());
+          mErrorMethod->prepareImage(tile);
+          QuadtreeImage quadtree(tile, mThreshold, mMinBlockSize,
+                                 mErrorMethod);
+          quadtree.setPaletteMode(paletteMode);
+          if (mUseLinearTree) {
+            quadtree.setRepresentation(QuadtreeImage::Representation::Linear);
+          }
+          if (!quadtree.build()) {
+            isFailed = true;
+            return;
+          }
+          const Image painted = quadtree.apply();
+          source.paste(painted, x, y);
 
-  if (targetSize < rightSize) {
-    mThreshold = rightThreshold;
+          std::lock_guard<std::mutex> lock(resultMutex);
+          if (painted.getPalette().empty()) {
+            hasPalette = false;
+          } else if (hasPalette) {
+            palette.insert(painted.getPalette().begin(),
+                           painted.getPalette().end());
+          }
+          addBuildCounters(quadtree.getCounters());
+          result.quadtreeDepth =
+              std::max(result.quadtreeDepth, quadtree.getDepth());
+          result.quadtreeNodeCount += quadtree.getNodeCount();
+          result.nodeArenaSlabCount += quadtree.getArenaSlabCount();
+          result.nodeArenaBytesReserved += quadtree.getArenaBytesReserved();
+          result.nodeArenaBytesUsed += quadtree.getArenaBytesUsed();
+          result.summedTableBytes =
+              std::max(result.summedTableBytes,
+                       tile.getSummedTable().getBytesUsed());
+          const std::vector<int> levels = quadtree.computeNodesPerLevel();
+          if (result.nodesPerLevel.size() < levels.size()) {
+            result.nodesPerLevel.resize(levels.size(), 0);
+          }
+          for (size_t level = 0; level < levels.size(); ++level) {
+            result.nodesPerLevel[level] += levels[level];
+          }
+        });
+      }
+      if (reader) {
+        pool.wait();
+        if (!isFailed &&
+            !writer.writeRows(band.getImageData(), rows, mThreadCount)) {
+          std::cerr << "Error: can't write " << mOutputPath << std::endl;
+          isFailed = true;
+        }
+      }
+    }
+    pool.wait();
+  }
+
+  enterStage(ProgressStage::SavingImage);
+  std::error_code ec;
+  if (reader) {
+    if (!writer.close() || isFailed) {
+      fs::remove(mOutputPath, ec);
+      return false;
+    }
+    result.originalFileSize =
+        static_cast<size_t>(fs::file_size(mInputPath, ec));
+    result.compressedFileSize =
+        static_cast<size_t>(fs::file_size(mOutputPath, ec));
+  } else {
+    if (isFailed) {
+      return false;
+    }
+    if (hasPalette &&
+        static_cast<int>(palette.size()) <= ColorPalette::kMaxColors) {
+      image.setPalette({palette.begin(), palette.end()});
+    }
+    result.originalFileSize = image.getFileSize();
+    image.save(mOutputPath, mThreadCount);
+    result.compressedFileSize = image.getFileSize();
+  }
+  result.bytesEncoded += result.compressedFileSize;
+  result.encodeCount++;
+  result.compressionPercentage =
+      (1.0 - static_cast<double>(result.compressedFileSize) /
+                 result.originalFileSize) *
+      100;
+  result.outputFilePath = mOutputPath;
+  result.tileCount = tilesX * tilesY;
+  return true;
+}
+
+QuadtreeImage::PaletteMode CompressionController::getOutputPaletteMode() const {
+  // only a PNG can be saved indexed, any other output would pay for the
+  // leaf colours for nothing, and a quantized one would lose quality too
+  if (mIsQtcOutput || mFileExt != ".png") {
+    return QuadtreeImage::PaletteMode::Off;
+  }
+  return mPaletteMode;
+}
+
+void CompressionController::addBuildCounters(
+    const EvaluationCounters &counters) {
+  result.errorEvaluations += counters.errorEvaluations;
+  result.scannedPixels += counters.scannedPixels;
+}
+
+bool CompressionController::writeReport() const {
+  std::ofstream out(mReportPath);
+  if (!out) {
+    return false;
+  }
+  auto escape = [](const std::string &text) {
+    std::string escaped;
+    for (char c : text) {
+      if (c == '"' || c == '\\') {
+        escaped += '\\';
+      }
+      escaped += c;
+    }
+    return escaped;
+  };
+
+  out << "{\n"
+      << "  \"input\": \"" << escape(mInputPath) << "\",\n"
+      << "  \"output\": \"" << escape(result.outputFilePath) << "\",\n"
+      << "  \"method\": \"" << mErrorMethod->getIdentifier() << "\",\n"
+      << "  \"threshold\": " << mThreshold << ",\n"
+      << "  \"min_block_size\": " << mMinBlockSize << ",\n"
+      << "  \"threads\": " << mThreadCount << ",\n"
+      << "  \"target_probes\": " << mTargetProbeCount << ",\n"
+      << "  \"wall_ms\": " << result.computationTime << ",\n"
+      << "  \"stages\": [";
+  for (size_t i = 0; i < result.stageMetrics.size(); ++i) {
+    const StageMetrics &metrics = result.stageMetrics[i];
+    out << (i ? ",\n" : "\n") << "    {\"name\": \""
+        << progressStageName(metrics.stage)
+        << "\", \"wall_ms\": " << metrics.wallMs
+        << ", \"cpu_ms\": " << metrics.cpuMs << "}";
+  }
+  out << "\n  ],\n"
+      << "  \"error_evaluations\": " << result.errorEvaluations << ",\n"
+      << "  \"scanned_pixels\": " << result.scannedPixels << ",\n"
+      << "  \"tree_depth\": " << result.quadtreeDepth << ",\n"
+      << "  \"node_count\": " << result.quadtreeNodeCount << ",\n"
+      << "  \"nodes_per_level\": [";
+  for (size_t i = 0; i < result.nodesPerLevel.size(); ++i) {
+    out << (i ? ", " : "") << result.nodesPerLevel[i];
+  }
+  out << "],\n"
+      << "  \"original_bytes\": " << result.originalFileSize << ",\n"
+      << "  \"compressed_bytes\": " << result.compressedFileSize << ",\n"
+      << "  \"bytes_encoded\": " << result.bytesEncoded << ",\n"
+      << "  \"encode_count\": " << result.encodeCount << ",\n"
+      << "  \"node_arena_bytes_used\": " << result.nodeArenaBytesUsed
+      << ",\n"
+      << "  \"summed_table_bytes\": " << result.summedTableBytes << ",\n"
+      << "  \"tile_count\": " << result.tileCount << "\n"
+      << "}\n";
+  return static_cast<bool>(out);
+}
+
+std::vector<long long> CompressionController::probeEncodedSizes(
+    const Image &image, const std::vector<double> &thresholds,
+    const ErrorTree &errorTree, std::vector<bool> *isIndexed) {
+  // every threshold is built, painted and encoded on a worker of its own
+  // with an even share of the build threads; the counters are summed in
+  // threshold order once all of them are done
+  const int probeCount = static_cast<int>(thresholds.size());
+  std::vector<long long> sizes(thresholds.size());
+  std::vector<EvaluationCounters> counters(thresholds.size());
+  std::vector<char> hasPalette(thresholds.size(), 0);
+  auto probe = [&](size_t index, int threadCount) {
+    QuadtreeImage quadtree(image, thresholds[index], mMinBlockSize,
+                           mErrorMethod);
+    quadtree.setThreadCount(threadCount);
+    quadtree.setErrorTree(&errorTree);
+    quadtree.setPaletteMode(getOutputPaletteMode());
+    quadtree.build();
+    counters[index] = quadtree.getCounters();
+    if (mIsQtcOutput) {
+      std::vector<unsigned char> data;
+      QTC::encode(quadtree, data, mQtcLayout);
+      sizes[index] = static_cast<long long>(data.size());
+    } else {
+      const Image painted = quadtree.apply();
+      hasPalette[index] =
+          painted.getFileExt() == ".png" && !painted.getPalette().empty();
+      sizes[index] = painted.estimateFileSize(threadCount);
+    }
+  };
+  if (probeCount == 1) {
+    probe(0, mThreadCount);
+  } else {
+    const int threadCount = (std::max)(1, mThreadCount / probeCount);
+    ThreadPool pool(probeCount);
+    for (size_t index = 0; index < thresholds.size(); ++index) {
+      pool.submit([&, index]() { probe(index, threadCount); });
+    }
+    pool.wait();
+  }
+
+  for (size_t index = 0; index < thresholds.size(); ++index) {
+    addBuildCounters(counters[index]);
+    result.bytesEncoded += sizes[index];
+    result.encodeCount++;
+  }
+  if (isIndexed) {
+    isIndexed->assign(hasPalette.begin(), hasPalette.end());
+  }
+  return sizes;
+}
+
+void CompressionController::findTargetCompression(
+    Image &image, long long targetSize, const ErrorTree &errorTree) {
+  // the cuts of the maximal tree are ranked by the error tree, one per
+  // candidate threshold in order of growing leaf count, and the encoded size
+  // grows with the rank. The full and the flat cut are encoded to bracket
+  // the target and calibrate a SizePredictor, then the rank whose predicted
+  // size is closest to the target is searched within the bracket and
+  // encoded to confirm it, which calibrates the predictor further and
+  // narrows the bracket, until a cut lands within kTargetTolerance of the
+  // target or kMaxTargetRounds rounds are spent and the last prediction is
+  // taken as it is.
+  //
+  // With more than one probe per round the ranks confirmed together are
+  // spread over the range the error bounds of the predictor leave for the
+  // target, so a round narrows the bracket up to mTargetProbeCount + 1
+  // ways. The ranks only depend on the sizes encoded so far and the sizes
+  // are read in rank order, never in the order the workers finish, so the
+  // result is the same on every run.
+  double fullThreshold = mErrorMethod->getLowerBound();
+  if (!mErrorMethod->isLowerErrorBetter()) {
+    fullThreshold = mErrorMethod->getUpperBound();
+  }
+
+  struct Probe {
+    size_t rank;
+    long long size;
+    bool isIndexed;
+  };
+  SizePredictor predictor(image, errorTree);
+  const std::vector<double> candidates = errorTree.getCandidateThresholds();
+
+  // QuadtreeImage keeps a float threshold, rounded here towards accepting
+  // the blocks the candidate was taken from so the build cuts as ranked
+  const bool isLowerErrorBetter = mErrorMethod->isLowerErrorBetter();
+  auto toBuildThreshold = [isLowerErrorBetter](double threshold) {
+    float rounded = static_cast<float>(threshold);
+    if (isLowerErrorBetter && rounded < threshold) {
+      rounded = std::nextafter(rounded, std::numeric_limits<float>::max());
+    } else if (!isLowerErrorBetter && rounded > threshold) {
+      rounded = std::nextafter(rounded, std::numeric_limits<float>::lowest());
+    }
+    return static_cast<double>(rounded);
+  };
+
+  // the full cut splits every block with a nonzero error, past the last
+  // candidate
+  auto thresholdAt = [&](size_t rank) {
+    return rank < candidates.size() ? toBuildThreshold(candidates[rank])
+                                    : fullThreshold;
+  };
+
+  // concurrent probes encode the flat cut alongside the full one, it only
+  // goes unused when the full cut already fits the target
+  std::vector<double> bracketThresholds = {fullThreshold};
+  if (mTargetProbeCount > 1 && !candidates.empty()) {
+    bracketThresholds.push_back(thresholdAt(0));
+  }
+  std::vector<bool> isIndexed;
+  const std::vector<long long> bracketSizes =
+      probeEncodedSizes(image, bracketThresholds, errorTree, &isIndexed);
+  Probe above = {candidates.size(), bracketSizes[0], isIndexed[0]};
+  mThreshold = fullThreshold;
+  if (targetSize >= above.size || candidates.empty()) {
+    return;
+  }
+
+  Probe below = {0, 0, false};
+  if (bracketSizes.size() > 1) {
+    below = {0, bracketSizes[1], isIndexed[1]};
+  } else {
+    below.size =
+        probeEncodedSizes(image, {thresholdAt(0)}, errorTree, &isIndexed)[0];
+    below.isIndexed = isIndexed[0];
+  }
+  if (below.size >= targetSize) {
+    mThreshold = thresholdAt(0);
     return;
   }
 
-  for (int i = 1; i < 32; i++) {
-    middleThreshold = (leftThreshold + rightThreshold) / 2.0;
-    if (std::abs(middleThreshold - rightThreshold) < 0.00001 &&
-        std::abs(middleThreshold - leftThreshold) < 0.00001) {
-      break;
+  // a .qtc size costs a walk over the leaves, less than a prediction, so
+  // the bracket is bisected on real sizes down to adjacent ranks
+  while (mIsQtcOutput && above.rank - below.rank >= 2) {
+    const size_t middle = below.rank + (above.rank - below.rank) / 2;
+    const long long size =
+        probeEncodedSizes(image, {thresholdAt(middle)}, errorTree)[0];
+    (size > targetSize ? above : below) = {middle, size, false};
+  }
+  // the predictor models truecolour PNGs; in Exact mode only the coarsest
+  // cuts, with few enough leaf colours, are saved indexed, far smaller than
+  // that model, and would skew the correction of the cuts next to them
+  auto calibrate = [&](double threshold, long long size, bool isIndexed) {
+    if (!isIndexed ||
+        getOutputPaletteMode() != QuadtreeImage::PaletteMode::Exact) {
+      predictor.calibrate(threshold, size);
     }
-    QuadtreeImage quadtreeMiddle(image, middleThreshold, mMinBlockSize,
-                                 mErrorMethod);
-    quadtreeMiddle.build();
-    res = quadtreeMiddle.apply();
-    middleSize = res.estimateFileSize();
+  };
+  if (above.rank - below.rank >= 2) {
+    calibrate(thresholdAt(above.rank), above.size, above.isIndexed);
+    calibrate(thresholdAt(below.rank), below.size, below.isIndexed);
+  }
 
-    if (std::abs(middleSize - targetSize) < 10) {
-      mThreshold = middleThreshold;
+  // images too short to sample are predicted from whole encodes, which
+  // count as much as the probes
+  auto addPredictionEncodes = [&]() {
+    result.encodeCount += predictor.getEncodeCount();
+    result.bytesEncoded += predictor.getBytesEncoded();
+  };
+
+  // the first rank inside the bracket predicted to reach `size`, or the one
+  // before it when that one is closer
+  auto predictRank = [&](long long size) {
+    size_t low = below.rank + 1;
+    size_t high = above.rank - 1;
+    while (low < high) {
+      const size_t middle = low + (high - low) / 2;
+      if (predictor.predict(thresholdAt(middle)) < size) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+    if (low > below.rank + 1 &&
+        size - predictor.predict(thresholdAt(low - 1)) <
+            predictor.predict(thresholdAt(low)) - size) {
+      --low;
+    }
+    return low;
+  };
+
+  for (int rounds = 2;; ++rounds) {
+    // no cut left strictly inside the bracket, the closer end is the result
+    if (above.rank - below.rank < 2) {
+      const bool isAboveCloser =
+          above.size - targetSize < targetSize - below.size;
+      mThreshold = thresholdAt(isAboveCloser ? above.rank : below.rank);
+      addPredictionEncodes();
       return;
     }
-    if (targetSize > middleSize) {
-      rightThreshold = middleThreshold;
-    } else {
-      leftThreshold = middleThreshold;
+
+    const size_t predictedRank = predictRank(targetSize);
+    mThreshold = thresholdAt(predictedRank);
+    // the final save confirms the last prediction
+    if (rounds == kMaxTargetRounds) {
+      addPredictionEncodes();
+      return;
+    }
+
+    // a real size is expected between predicted * (1 + lower) and
+    // predicted * (1 + upper), so the ranks of the round span the ones
+    // predicted to reach targetSize / (1 + upper) to targetSize / (1 + lower)
+    std::vector<size_t> ranks = {predictedRank};
+    if (mTargetProbeCount > 1) {
+      const SizePredictor::ErrorBounds bounds = predictor.getErrorBounds();
+      ranks.clear();
+      for (int probe = 0; probe < mTargetProbeCount; ++probe) {
+        const double error = bounds.upper - (bounds.upper - bounds.lower) *
+                                                probe /
+                                                (mTargetProbeCount - 1);
+        ranks.push_back(
+            predictRank(std::llround(targetSize / (1.0 + error))));
+      }
+      std::sort(ranks.begin(), ranks.end());
+      ranks.erase(std::unique(ranks.begin(), ranks.end()), ranks.end());
+    }
+    std::vector<double> thresholds;
+    for (size_t rank : ranks) {
+      thresholds.push_back(thresholdAt(rank));
+    }
+    const std::vector<long long> sizes =
+        probeEncodedSizes(image, thresholds, errorTree, &isIndexed);
+
+    // the closest cut within the tolerance ends the search, the lower rank
+    // on a tie
+    long long closestMiss = std::numeric_limits<long long>::max();
+    for (size_t index = 0; index < ranks.size(); ++index) {
+      const long long miss = std::abs(sizes[index] - targetSize);
+      if (miss <= targetSize * kTargetTolerance && miss < closestMiss) {
+        closestMiss = miss;
+        mThreshold = thresholds[index];
+      }
+    }
+    if (closestMiss != std::numeric_limits<long long>::max()) {
+      addPredictionEncodes();
+      return;
+    }
+
+    // the lowest rank over the target bounds the bracket from above and the
+    // highest rank under the target below that bounds it from below
+    for (size_t index = 0; index < ranks.size(); ++index) {
+      calibrate(thresholds[index], sizes[index], isIndexed[index]);
+      if (sizes[index] > targetSize && ranks[index] < above.rank) {
+        above = {ranks[index], sizes[index], isIndexed[index]};
+      }
+    }
+    for (size_t index = 0; index < ranks.size(); ++index) {
+      if (sizes[index] < targetSize && ranks[index] > below.rank &&
+          ranks[index] < above.rank) {
+        below = {ranks[index], sizes[index], isIndexed[index]};
+      }
     }
   }
-  mThreshold = middleThreshold;
-  return;
 }
@@ -1,9 +1,14 @@
 #ifndef COMPRESSION_CONTROLLER_H
 #define COMPRESSION_CONTROLLER_H
 
+#include "codec/png_reader.h"
+#include "codec/qtc_codec.h"
 #include "error_measurement/error_method.h"
+#include "quadtree/error_tree.h"
+#include "quadtree/quadtreeimage.h"
 #include <functional>
 #include <string>
+#include <vector>
 
 enum class ProgressStage {
   Loading,
@@ -16,15 +21,40 @@ enum class ProgressStage {
   Finished
 };
 
+const char *progressStageName(ProgressStage stage);
+
+// time spent between entering a stage and entering the next one
+struct StageMetrics {
+  ProgressStage stage;
+  double wallMs = 0.0;
+  double cpuMs = 0.0; // summed over the threads working for the run
+};
+
 struct CompressionResult {
-  double computationTime;
-  size_t originalFileSize;
-  size_t compressedFileSize;
-  double compressionPercentage;
-  int quadtreeDepth;
-  int quadtreeNodeCount;
+  double computationTime = 0.0; // wall milliseconds of the whole run
+  size_t originalFileSize = 0;
+  size_t compressedFileSize = 0;
+  double compressionPercentage = 0.0;
+  int quadtreeDepth = 0;
+  int quadtreeNodeCount = 0;
+  size_t nodeArenaSlabCount = 0;
+  size_t nodeArenaBytesReserved = 0;
+  size_t nodeArenaBytesUsed = 0;
   std::string outputFilePath;
   std::string gifOutputPath;
+
+  std::vector<StageMetrics> stageMetrics;
+  // calculateError calls and pixels scanned by them over every tree build
+  long long errorEvaluations = 0;
+  long long scannedPixels = 0;
+  // nodes of the final tree on each level, root first
+  std::vector<int> nodesPerLevel;
+  // bytes produced by every encode, size probes of the target search
+  // included, and how many encodes that took
+  size_t bytesEncoded = 0;
+  int encodeCount = 0;
+  size_t summedTableBytes = 0; // largest table resident at a time
+  int tileCount = 1;
 };
 
 class CompressionController {
@@ -34,25 +64,66 @@ private:
   double mThreshold;
   int mMinBlockSize;
   double mTargetCompression;
+  int mThreadCount;
+  int mTargetProbeCount;
+  bool mUseLinearTree;
+  int mTileSize;
   std::string mOutputPath;
+  // the output path ends in .qtc, the tree is saved instead of the pixels
+  bool mIsQtcOutput;
+  QTC::Layout mQtcLayout;
+  QuadtreeImage::PaletteMode mPaletteMode;
+  bool mAlignSplitsToMcu;
   std::string mGifOutputPath;
+  std::string mReportPath;
 
   std::string mFileExt;
 
   CompressionResult result;
 
-  void findTargetCompression(Image &, long long);
+  // rounds of encodes spent by the target search, the full and flat cuts
+  // included, and how close to the target a probe must land to end it early
+  static constexpr int kMaxTargetRounds = 4;
+  static constexpr double kTargetTolerance = 0.01;
+
+  void findTargetCompression(Image &, long long, const ErrorTree &);
+  // isIndexed, when given, tells which sizes are of indexed PNGs
+  std::vector<long long> probeEncodedSizes(const Image &,
+                                           const std::vector<double> &,
+                                           const ErrorTree &,
+                                           std::vector<bool> *isIndexed =
+                                               nullptr);
+  // the pixels come from the reader when given, from the loaded image
+  // otherwise
+  bool runTiled(Image &, PngReader *,
+                const std::function<void(ProgressStage)> &);
+  void addBuildCounters(const EvaluationCounters &);
+  // the palette mode applied to the leaves, Off unless the output is a PNG
+  QuadtreeImage::PaletteMode getOutputPaletteMode() const;
+  bool writeReport() const;
 
 public:
-  CompressionController() : mErrorMethod(nullptr){};
+  CompressionController();
+  ~CompressionController();
+
+  CompressionController(const CompressionController &) = delete;
+  CompressionController &operator=(const CompressionController &) = delete;
 
   std::string getInputPath() const { return mInputPath; }
   ErrorMethod *getErrorMethod() const { return mErrorMethod; }
   double getThreshold() const { return mThreshold; }
   int getMinBlockSize() const { return mMinBlockSize; }
   double getTargetCompression() const { return mTargetCompression; }
+  int getThreadCount() const { return mThreadCount; }
+  int getTargetProbeCount() const { return mTargetProbeCount; }
+  bool getUseLinearTree() const { return mUseLinearTree; }
+  int getTileSize() const { return mTileSize; }
   std::string getOutputPath() const { return mOutputPath; }
+  QTC::Layout getQtcLayout() const { return mQtcLayout; }
+  QuadtreeImage::PaletteMode getPaletteMode() const { return mPaletteMode; }
+  bool getAlignSplitsToMcu() const { return mAlignSplitsToMcu; }
   std::string getGifOutputPath() const { return mGifOutputPath; }
+  std::string getReportPath() const { return mReportPath; }
   std::string getFileExt() const { return mFileExt; }
   CompressionResult getResult() const { return result; }
 
@@ -61,8 +132,37 @@ public:
   bool setThreshold(double);
   bool setMinBlockSize(int);
   bool setTargetCompression(double);
+  bool setThreadCount(int);
+  // thresholds the target search encodes concurrently per round, each on a
+  // worker of its own sharing the build threads; 1 probes one at a time
+  bool setTargetProbeCount(int);
+  bool setUseLinearTree(bool);
+  // compresses the image as a grid of independent tileSize x tileSize
+  // quadtrees, each with its own summed table; 0 compresses the image as a
+  // single tree. An 8-bit RGB(A) PNG is read and written one row of tiles
+  // at a time (see PngReader), in the memory of that row whatever its
+  // height, and saved unindexed; other images are loaded whole (stb_image,
+  // up to 2^31 bytes) and only their analysis is bounded. Fails, saying
+  // why, with a target compression, a GIF or a .qtc output, and so do
+  // those setters once tiles are set.
+  bool setTileSize(int);
+  // the extension of the input image, or .qtc to save the tree itself
   bool setOutputPath(std::string);
+  // how a .qtc output is laid out, depth first by default
+  bool setQtcLayout(QTC::Layout);
+  // whether a PNG output is saved indexed (see QuadtreeImage::PaletteMode),
+  // Exact by default, other outputs ignore it; tiles are quantized one by
+  // one, so a tiled output is only indexed when the palettes of all tiles
+  // fit in 256 colours together, and a streamed one never is
+  bool setPaletteMode(QuadtreeImage::PaletteMode);
+  // splits blocks of a JPEG output on its MCU grid (Image::kJpegMcuSize)
+  // instead of at the middle, so every leaf covers whole MCUs; no effect on
+  // other outputs. Tiles stay on the grid when the tile size is a multiple
+  // of the MCU size.
+  bool setAlignSplitsToMcu(bool);
   bool setGifOutputPath(std::string);
+  // an empty path disables the JSON report
+  bool setReportPath(std::string);
 
   bool run(std::function<void(const ProgressStage &)>);
 };
@@ -2,50 +2,71 @@
 #define EMM_ENTROPY_H
 
 #include "error_method.h"
+#include "image/scan_kernels.h"
 #include <array>
-#include <cmath>
 
 namespace EMM {
 
-class Entropy : public ErrorMethod {
+class Entropy final : public ErrorMethod {
 private:
   // 8-bit channel: log2(256) = 8.
   static constexpr double kErrorUpperBound = 8.0;
   static constexpr double kErrorLowerBound = 0.0;
+  // blocks up to this area sort their values instead of filling histograms
+  static constexpr int kSortedBlockArea = 64;
 
 public:
   double calculateError(const Image &image, int x, int y, int width,
                         int height) const override {
-    int count = width * height;
-    std::array<int, 256> histR = {0};
-    std::array<int, 256> histG = {0};
-    std::array<int, 256> histB = {0};
+    // every block the tree splits down to is a pyramid cell when the image
+    // has one, only the small blocks below its finest level are scanned
+    double entropy;
+    if (image.getEntropyPyramid().findBlockEntropy(x, y, width, height,
+                                                   entropy)) {
+      return entropy;
+    }
 
-    for (int i = y; i < y + height; ++i) {
-      for (int j = x; j < x + width; ++j) {
-        std::array<unsigned char, 3> color = image.getColorAt(j, i);
-        ++histR[color[0]];
-        ++histG[color[1]];
-        ++histB[color[2]];
+    int count = width * height;
+    const unsigned char *block = image.getImageData() + image.getIdxAt(x, y, 0);
+    const size_t rowStride =
+        static_cast<size_t>(image.getWidth()) * image.getChannels();
+    countScannedPixels(count);
+    if (count <= kSortedBlockArea) {
+      std::array<std::array<unsigned char, kSortedBlockArea>, 3> values;
+      for (int i = 0; i < height; ++i) {
+        const unsigned char *pixel = block + i * rowStride;
+        for (int j = 0; j < width; ++j, pixel += image.getChannels()) {
+          for (int channel = 0; channel < 3; ++channel) {
+            values[channel][i * width + j] = pixel[channel];
+          }
+        }
       }
+      return computeSortedMeanEntropy(
+          {values[0].data(), values[1].data(), values[2].data()}, count);
     }
 
-    double entropyR = 0.0, entropyG = 0.0, entropyB = 0.0;
-    for (int i = 0; i < 256; ++i) {
-      if (histR[i] > 0) {
-        double p = static_cast<double>(histR[i]) / count;
-        entropyR -= p * std::log2(p);
-      }
-      if (histG[i] > 0) {
-        double p = static_cast<double>(histG[i]) / count;
-        entropyG -= p * std::log2(p);
+    ChannelHistograms histograms = {};
+    ScanKernels::addToHistograms(block, rowStride, width, height,
+                                 image.getChannels(), histograms);
+    return computeMeanEntropy(histograms, count);
+  }
+
+  // a pyramid lookup per block for all but the smallest ones, so the batch
+  // is the block path above without the virtual calls
+  void calculateErrors(const Image &image, const QuadRect *rects,
+                       size_t count, double threshold, double *errors,
+                       unsigned char *accepted) const override {
+    for (size_t i = 0; i < count; ++i) {
+      const QuadRect &rect = rects[i];
+      const double error = Entropy::calculateError(
+          image, rect.x, rect.y, rect.width, rect.height);
+      if (errors) {
+        errors[i] = error;
       }
-      if (histB[i] > 0) {
-        double p = static_cast<double>(histB[i]) / count;
-        entropyB -= p * std::log2(p);
+      if (accepted) {
+        accepted[i] = isQualityAcceptable(error, threshold);
       }
     }
-    return (entropyR + entropyG + entropyB) / 3.0;
   }
 
   inline bool isInErrorBound(double error) const override {
@@ -58,6 +79,10 @@ public:
   bool isQualityAcceptable(double entropy, double threshold) const override {
     return entropy <= threshold;
   }
+  void prepareImage(Image &image) const override {
+    ErrorMethod::prepareImage(image);
+    image.computeEntropyPyramid();
+  }
   std::string getIdentifier() const override { return "ENT"; }
 };
 
@@ -2,41 +2,61 @@
 #define EMM_MAD_H
 
 #include "error_method.h"
+#include "image/scan_kernels.h"
 #include <array>
 #include <cmath>
 #include <cstdlib>
 
 namespace EMM {
-class MeanAbsoluteDeviation : public ErrorMethod {
+class MeanAbsoluteDeviation final : public ErrorMethod {
 private:
   static constexpr double kErrorUpperBound = 127.5;
   static constexpr double kErrorLowerBound = 0;
 
-public:
-  double calculateError(const Image &image, int x, int y, int width,
-                        int height) const override {
+  // below this area the truncating accumulation of the scan adds exactly
+  // floor(|value - mean|) per pixel, which the kernels sum in integers
+  static constexpr int kMaxKernelArea = 1 << 21;
+  // keeps the standard deviation bound clear of rounding
+  static constexpr double kBoundSlack = 1e-9;
+
+  double calculateErrorFromStats(const Image &image, int x, int y,
+                                 int width, int height,
+                                 const BlockStats &stats) const {
     std::array<unsigned int, 3> sum = {0, 0, 0};
     int count = width * height;
 
-    double avgR =
-        static_cast<double>(image.getChannelBlockSum(x, y, width, height, 0)) /
-        count;
-    double avgG =
-        static_cast<double>(image.getChannelBlockSum(x, y, width, height, 1)) /
-        count;
-    double avgB =
-        static_cast<double>(image.getChannelBlockSum(x, y, width, height, 2)) /
-        count;
-
-    for (int i = y; i < y + height; ++i) {
-      for (int j = x; j < x + width; ++j) {
-        std::array<unsigned char, 3> color = image.getColorAt(j, i);
-        sum[0] += std::abs(color[0] - avgR);
-        sum[1] += std::abs(color[1] - avgG);
-        sum[2] += std::abs(color[2] - avgB);
+    if (count > 0 && count < kMaxKernelArea) {
+      std::array<int, 3> floorMean;
+      std::array<bool, 3> hasFraction;
+      for (int channel = 0; channel < 3; ++channel) {
+        floorMean[channel] = static_cast<int>(stats.sum[channel] / count);
+        hasFraction[channel] = stats.sum[channel] % count != 0;
+      }
+      const std::array<long long, 3> deviations =
+          ScanKernels::sumFlooredDeviations(
+              image.getImageData() + image.getIdxAt(x, y, 0),
+              static_cast<size_t>(image.getWidth()) * image.getChannels(),
+              width, height, image.getChannels(), floorMean, hasFraction);
+      for (int channel = 0; channel < 3; ++channel) {
+        sum[channel] = static_cast<unsigned int>(deviations[channel]);
+      }
+    } else {
+      double avgR = static_cast<double>(stats.sum[0]) / count;
+      double avgG = static_cast<double>(stats.sum[1]) / count;
+      double avgB = static_cast<double>(stats.sum[2]) / count;
+
+      for (int i = y; i < y + height; ++i) {
+        for (int j = x; j < x + width; ++j) {
+          std::array<unsigned char, 3> color = image.getColorAt(j, i);
+          sum[0] += std::abs(color[0] - avgR);
+          sum[1] += std::abs(color[1] - avgG);
+          sum[2] += std::abs(color[2] - avgB);
+        }
       }
     }
 
+    countScannedPixels(count);
+
     double madR = static_cast<double>(sum[0]) / count;
     double madG = static_cast<double>(sum[1]) / count;
     double madB = static_cast<double>(sum[2]) / count;
@@ -44,6 +64,75 @@ public:
     return (madR + madG + madB) / 3;
   }
 
+  // the mean absolute deviation of a channel never exceeds its standard
+  // deviation, which the square sums give without a scan
+  bool isAcceptableFromStats(const Image &image, int x, int y, int width,
+                             int height, const BlockStats &stats,
+                             double threshold) const {
+    const int count = width * height;
+    if (count > 0 && count < kMaxKernelArea &&
+        image.getSummedTable().hasSquares()) {
+      double deviationSum = 0.0;
+      for (int channel = 0; channel < 3; ++channel) {
+        // count^2 * variance, exact in 64 bits at this area
+        const long long spread =
+            count * stats.squareSum[channel] -
+            stats.sum[channel] * stats.sum[channel];
+        deviationSum += std::sqrt(static_cast<double>(spread));
+      }
+      if (deviationSum / count / 3 + kBoundSlack <= threshold) {
+        return true;
+      }
+    }
+    return isQualityAcceptable(
+        calculateErrorFromStats(image, x, y, width, height, stats),
+        threshold);
+  }
+
+public:
+  double calculateError(const Image &image, int x, int y, int width,
+                        int height) const override {
+    return calculateErrorFromStats(image, x, y, width, height,
+                                   image.getBlockStats(x, y, width, height));
+  }
+
+  bool isBlockAcceptable(const Image &image, int x, int y, int width,
+                         int height, double threshold) const override {
+    return isAcceptableFromStats(image, x, y, width, height,
+                                 image.getBlockStats(x, y, width, height),
+                                 threshold);
+  }
+
+  void calculateErrors(const Image &image, const QuadRect *rects,
+                       size_t count, double threshold, double *errors,
+                       unsigned char *accepted) const override {
+    for (size_t i = 0; i < count && i < kPrefetchDistance; ++i) {
+      prefetchBlockStats(image, rects[i]);
+    }
+    for (size_t i = 0; i < count; ++i) {
+      if (i + kPrefetchDistance < count) {
+        prefetchBlockStats(image, rects[i + kPrefetchDistance]);
+      }
+      const QuadRect &rect = rects[i];
+      const BlockStats stats =
+          image.getBlockStats(rect.x, rect.y, rect.width, rect.height);
+      if (!errors) {
+        // only the flags, the blocks the bound accepts skip the scan
+        if (accepted) {
+          accepted[i] = isAcceptableFromStats(image, rect.x, rect.y,
+                                              rect.width, rect.height, stats,
+                                              threshold);
+        }
+        continue;
+      }
+      errors[i] = calculateErrorFromStats(image, rect.x, rect.y, rect.width,
+                                          rect.height, stats);
+      if (accepted) {
+        accepted[i] = isQualityAcceptable(errors[i], threshold);
+      }
+    }
+  }
+
   inline bool isInErrorBound(double error) const override {
     return error <= kErrorUpperBound && error >= kErrorLowerBound;
   };
@@ -54,6 +143,10 @@ public:
   bool isQualityAcceptable(double mad, double threshold) const override {
     return mad <= threshold;
   }
+  // the square sums feed the standard deviation bound
+  void prepareImage(Image &image) const override {
+    image.computeSummedTables(true);
+  }
   std::string getIdentifier() const override { return "MAD"; }
 };
 } // namespace EMM
@@ -2,13 +2,10 @@
 #define EMM_MPD_H
 
 #include "error_method.h"
-#include <algorithm>
-#include <array>
-#include <cmath>
-#include <cstdlib>
+#include "image/scan_kernels.h"
 
 namespace EMM {
-class MaximumPixelDifference : public ErrorMethod {
+class MaximumPixelDifference final : public ErrorMethod {
 private:
   static constexpr double kErrorUpperBound = 255;
   static constexpr double kErrorLowerBound = 0;
@@ -16,35 +13,41 @@ private:
 public:
   double calculateError(const Image &image, int x, int y, int width,
                         int height) const override {
-    std::array<unsigned char, 3> firstColor = image.getColorAt(x, y);
-    unsigned char maxR = firstColor[0];
-    unsigned char maxG = firstColor[1];
-    unsigned char maxB = firstColor[2];
-
-    unsigned char minR = firstColor[0];
-    unsigned char minG = firstColor[1];
-    unsigned char minB = firstColor[2];
-
-    for (int i = y; i < y + height; ++i) {
-      for (int j = x; j < x + width; ++j) {
-        std::array<unsigned char, 3> color = image.getColorAt(j, i);
-        maxR = (std::max)(maxR, color[0]);
-        maxG = (std::max)(maxG, color[1]);
-        maxB = (std::max)(maxB, color[2]);
-
-        minR = (std::min)(minR, color[0]);
-        minG = (std::min)(minG, color[1]);
-        minB = (std::min)(minB, color[2]);
-
-        // early exit if maximum difference is reached for all channels
-        if (maxR == 255 && minR == 0 && maxG == 255 && minG == 0 &&
-            maxB == 255 && minB == 0) {
-          return 255.0;
-        }
+    // every block the tree splits down to is a pyramid cell when the image
+    // has one, only the small blocks below its finest level are scanned
+    ChannelRange range;
+    if (!image.getMinMaxPyramid().findBlockRange(x, y, width, height,
+                                                 range)) {
+      if (width <= 0 || height <= 0) {
+        return 0.0;
       }
+      range = ScanKernels::findChannelRange(
+          image.getImageData() + image.getIdxAt(x, y, 0),
+          static_cast<size_t>(image.getWidth()) * image.getChannels(), width,
+          height, image.getChannels());
+      countScannedPixels(static_cast<long long>(width) * height);
     }
+    return static_cast<double>(range.max[0] - range.min[0] + range.max[1] -
+                               range.min[1] + range.max[2] - range.min[2]) /
+           3;
+  }
 
-    return static_cast<double>(maxR - minR + maxG - minG + maxB - minB) / 3;
+  // a pyramid lookup per block for all but the smallest ones, so the batch
+  // is the block path above without the virtual calls
+  void calculateErrors(const Image &image, const QuadRect *rects,
+                       size_t count, double threshold, double *errors,
+                       unsigned char *accepted) const override {
+    for (size_t i = 0; i < count; ++i) {
+      const QuadRect &rect = rects[i];
+      const double error = MaximumPixelDifference::calculateError(
+          image, rect.x, rect.y, rect.width, rect.height);
+      if (errors) {
+        errors[i] = error;
+      }
+      if (accepted) {
+        accepted[i] = isQualityAcceptable(error, threshold);
+      }
+    }
   }
 
   inline bool isInErrorBound(double error) const override {
@@ -57,6 +60,10 @@ public:
   bool isQualityAcceptable(double mpd, double threshold) const override {
     return mpd <= threshold;
   }
+  void prepareImage(Image &image) const override {
+    ErrorMethod::prepareImage(image);
+    image.computeMinMaxPyramid();
+  }
   std::string getIdentifier() const override { return "MPD"; }
 };
 } // namespace EMM
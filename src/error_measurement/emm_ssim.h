@@ -2,40 +2,33 @@
 #define EMM_SSIM_H
 
 #include "error_method.h"
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdlib>
 
 namespace EMM {
-class StructuralSimilarityIndexMeasure : public ErrorMethod {
+class StructuralSimilarityIndexMeasure final : public ErrorMethod {
 private:
   static constexpr double kErrorUpperBound = 1;
   static constexpr double kErrorLowerBound = 0;
   static constexpr double kC2 = 58.5225;
 
-public:
-  double calculateError(const Image &image, int x, int y, int width,
-                        int height) const override {
+  static double errorFromStats(const BlockStats &stats, int count) {
     // because the ssim compares with the image with its average
     // the equation can be simplified as:
     // (C2) / (Var_x ^ 2 + C2)
 
-    int count = width * height;
-
-    long long sumR = image.getChannelBlockSum(x, y, width, height, 0);
-    long long sumG = image.getChannelBlockSum(x, y, width, height, 1);
-    long long sumB = image.getChannelBlockSum(x, y, width, height, 2);
+    double meanR = static_cast<double>(stats.sum[0]) / count;
+    double meanG = static_cast<double>(stats.sum[1]) / count;
+    double meanB = static_cast<double>(stats.sum[2]) / count;
 
-    long long sumSqR = image.getChannelSquareBlockSum(x, y, width, height, 0);
-    long long sumSqG = image.getChannelSquareBlockSum(x, y, width, height, 1);
-    long long sumSqB = image.getChannelSquareBlockSum(x, y, width, height, 2);
-
-    double meanR = static_cast<double>(sumR) / count;
-    double meanG = static_cast<double>(sumG) / count;
-    double meanB = static_cast<double>(sumB) / count;
-
-    double varianceR = static_cast<double>(sumSqR) / count - meanR * meanR;
-    double varianceG = static_cast<double>(sumSqG) / count - meanG * meanG;
-    double varianceB = static_cast<double>(sumSqB) / count - meanB * meanB;
+    double varianceR =
+        static_cast<double>(stats.squareSum[0]) / count - meanR * meanR;
+    double varianceG =
+        static_cast<double>(stats.squareSum[1]) / count - meanG * meanG;
+    double varianceB =
+        static_cast<double>(stats.squareSum[2]) / count - meanB * meanB;
 
     double ssimR = kC2 / (varianceR + kC2);
     double ssimG = kC2 / (varianceG + kC2);
@@ -44,6 +37,35 @@ public:
     return (ssimR + ssimG + ssimB) / 3;
   }
 
+public:
+  double calculateError(const Image &image, int x, int y, int width,
+                        int height) const override {
+    return errorFromStats(image.getBlockStats(x, y, width, height),
+                          width * height);
+  }
+
+  void calculateErrors(const Image &image, const QuadRect *rects,
+                       size_t count, double threshold, double *errors,
+                       unsigned char *accepted) const override {
+    // the stats of a chunk are gathered first so the table lookups overlap
+    std::array<BlockStats, kBatchChunk> stats;
+    for (size_t begin = 0; begin < count; begin += kBatchChunk) {
+      const size_t size = (std::min)(kBatchChunk, count - begin);
+      gatherBlockStats(image, rects + begin, size, stats.data());
+      for (size_t i = 0; i < size; ++i) {
+        const QuadRect &rect = rects[begin + i];
+        const double error =
+            errorFromStats(stats[i], rect.width * rect.height);
+        if (errors) {
+          errors[begin + i] = error;
+        }
+        if (accepted) {
+          accepted[begin + i] = isQualityAcceptable(error, threshold);
+        }
+      }
+    }
+  }
+
   inline bool isInErrorBound(double error) const override {
     return error <= kErrorUpperBound && error >= kErrorLowerBound;
   };
@@ -54,6 +76,10 @@ public:
   bool isQualityAcceptable(double ssim, double threshold) const override {
     return ssim >= threshold;
   }
+  bool isLowerErrorBetter() const override { return false; }
+  void prepareImage(Image &image) const override {
+    image.computeSummedTables(true);
+  }
   std::string getIdentifier() const override { return "SIM"; }
 };
 } // namespace EMM
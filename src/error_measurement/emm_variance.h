@@ -2,37 +2,59 @@
 #define EMM_VARIANCE_H
 
 #include "error_method.h"
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdlib>
 
 namespace EMM {
-class Variance : public ErrorMethod {
+class Variance final : public ErrorMethod {
 private:
   static constexpr double kErrorUpperBound = 127.5 * 127.5;
   static constexpr double kErrorLowerBound = 0;
 
-public:
-  double calculateError(const Image &image, int x, int y, int width,
-                        int height) const override {
-    int count = width * height;
+  static double errorFromStats(const BlockStats &stats, int count) {
+    double meanR = static_cast<double>(stats.sum[0]) / count;
+    double meanG = static_cast<double>(stats.sum[1]) / count;
+    double meanB = static_cast<double>(stats.sum[2]) / count;
 
-    long long sumR = image.getChannelBlockSum(x, y, width, height, 0);
-    long long sumG = image.getChannelBlockSum(x, y, width, height, 1);
-    long long sumB = image.getChannelBlockSum(x, y, width, height, 2);
+    double varianceR =
+        static_cast<double>(stats.squareSum[0]) / count - meanR * meanR;
+    double varianceG =
+        static_cast<double>(stats.squareSum[1]) / count - meanG * meanG;
+    double varianceB =
+        static_cast<double>(stats.squareSum[2]) / count - meanB * meanB;
 
-    long long sumSqR = image.getChannelSquareBlockSum(x, y, width, height, 0);
-    long long sumSqG = image.getChannelSquareBlockSum(x, y, width, height, 1);
-    long long sumSqB = image.getChannelSquareBlockSum(x, y, width, height, 2);
-
-    double meanR = static_cast<double>(sumR) / count;
-    double meanG = static_cast<double>(sumG) / count;
-    double meanB = static_cast<double>(sumB) / count;
+    return (varianceR + varianceG + varianceB) / 3;
+  }
 
-    double varianceR = static_cast<double>(sumSqR) / count - meanR * meanR;
-    double varianceG = static_cast<double>(sumSqG) / count - meanG * meanG;
-    double varianceB = static_cast<double>(sumSqB) / count - meanB * meanB;
+public:
+  double calculateError(const Image &image, int x, int y, int width,
+                        int height) const override {
+    return errorFromStats(image.getBlockStats(x, y, width, height),
+                          width * height);
+  }
 
-    return (varianceR + varianceG + varianceB) / 3;
+  void calculateErrors(const Image &image, const QuadRect *rects,
+                       size_t count, double threshold, double *errors,
+                       unsigned char *accepted) const override {
+    // the stats of a chunk are gathered first so the table lookups overlap
+    std::array<BlockStats, kBatchChunk> stats;
+    for (size_t begin = 0; begin < count; begin += kBatchChunk) {
+      const size_t size = (std::min)(kBatchChunk, count - begin);
+      gatherBlockStats(image, rects + begin, size, stats.data());
+      for (size_t i = 0; i < size; ++i) {
+        const QuadRect &rect = rects[begin + i];
+        const double error =
+            errorFromStats(stats[i], rect.width * rect.height);
+        if (errors) {
+          errors[begin + i] = error;
+        }
+        if (accepted) {
+          accepted[begin + i] = isQualityAcceptable(error, threshold);
+        }
+      }
+    }
   }
 
   inline bool isInErrorBound(double error) const override {
@@ -46,6 +68,9 @@ public:
     return variance <= threshold;
   }
 
+  void prepareImage(Image &image) const override {
+    image.computeSummedTables(true);
+  }
   std::string getIdentifier() const override { return "VAR"; }
 };
 } // namespace EMM
@@ -2,6 +2,8 @@
 #define ERROR_METHOD_H
 
 #include "image/image.h"
+#include "image/quad_rect.h"
+#include <cstddef>
 
 class ErrorMethod {
 public:
@@ -14,7 +16,93 @@ public:
   virtual double getLowerBound() const = 0;
 
   virtual bool isQualityAcceptable(double error, double threshold) const = 0;
+  // whether the block meets the threshold; a method with a cheap bound on
+  // its error can answer without calculateError
+  virtual bool isBlockAcceptable(const Image &image, int x, int y, int width,
+                                 int height, double threshold) const {
+    return isQualityAcceptable(calculateError(image, x, y, width, height),
+                               threshold);
+  }
+  // evaluates a batch of blocks, typically a level of a tree: errors[i]
+  // gets the error of rects[i] and accepted[i] whether it meets the
+  // threshold. Either output may be null; a method only asked for the flags
+  // may answer them from a bound, like isBlockAcceptable.
+  virtual void calculateErrors(const Image &image, const QuadRect *rects,
+                               size_t count, double threshold, double *errors,
+                               unsigned char *accepted) const {
+    for (size_t i = 0; i < count; ++i) {
+      const QuadRect &rect = rects[i];
+      if (!errors) {
+        if (accepted) {
+          accepted[i] = isBlockAcceptable(image, rect.x, rect.y, rect.width,
+                                          rect.height, threshold);
+        }
+        continue;
+      }
+      errors[i] =
+          calculateError(image, rect.x, rect.y, rect.width, rect.height);
+      if (accepted) {
+        accepted[i] = isQualityAcceptable(errors[i], threshold);
+      }
+    }
+  }
+  // computes the tables the method reads, once per image before any tree
+  // is built; the block averages always need the summed-area table
+  virtual void prepareImage(Image &image) const {
+    image.computeSummedTables(false);
+  }
+  // false when a higher error means a better block (SSIM)
+  virtual bool isLowerErrorBetter() const { return true; }
   virtual std::string getIdentifier() const = 0;
+
+  // pixels read one by one by calculateError on the calling thread, scan
+  // based methods add to it so the tree builders can report their work
+  static long long &scannedPixelCounter() {
+    static thread_local long long counter = 0;
+    return counter;
+  }
+
+protected:
+  // blocks a batch gathers the stats of at once, and how many blocks ahead
+  // their summed table corners are prefetched
+  static constexpr size_t kBatchChunk = 256;
+  static constexpr size_t kPrefetchDistance = 8;
+
+  static void countScannedPixels(long long pixels) {
+    scannedPixelCounter() += pixels;
+  }
+
+  static void prefetchBlockStats(const Image &image, const QuadRect &rect) {
+    image.getSummedTable().prefetchBlock(rect.x, rect.y, rect.width,
+                                         rect.height);
+  }
+  // stats of rects[0, count), with the corners of the blocks ahead in
+  // flight while the current one is summed
+  static void gatherBlockStats(const Image &image, const QuadRect *rects,
+                               size_t count, BlockStats *stats) {
+    for (size_t i = 0; i < count && i < kPrefetchDistance; ++i) {
+      prefetchBlockStats(image, rects[i]);
+    }
+    for (size_t i = 0; i < count; ++i) {
+      if (i + kPrefetchDistance < count) {
+        prefetchBlockStats(image, rects[i + kPrefetchDistance]);
+      }
+      const QuadRect &rect = rects[i];
+      stats[i] = image.getBlockStats(rect.x, rect.y, rect.width, rect.height);
+    }
+  }
+};
+
+// work done by the error method during a tree build
+struct EvaluationCounters {
+  long long errorEvaluations = 0;
+  long long scannedPixels = 0;
+
+  EvaluationCounters &operator+=(const EvaluationCounters &other) {
+    errorEvaluations += other.errorEvaluations;
+    scannedPixels += other.scannedPixels;
+    return *this;
+  }
 };
 
 #endif
@@ -0,0 +1,58 @@
+#ifndef ERROR_METHOD_FACTORY_H
+#define ERROR_METHOD_FACTORY_H
+
+#include "emm_entropy.h"
+#include "emm_mad.h"
+#include "emm_mpd.h"
+#include "emm_ssim.h"
+#include "emm_variance.h"
+#include "error_method.h"
+#include <algorithm>
+#include <string>
+
+namespace EMM {
+
+// creates the method whose getIdentifier() matches (case insensitive),
+// nullptr for an unknown identifier. the caller owns the result.
+inline ErrorMethod *createFromIdentifier(std::string identifier) {
+  std::transform(identifier.begin(), identifier.end(), identifier.begin(),
+                 [](unsigned char c) { return std::toupper(c); });
+
+  if (identifier == "VAR") {
+    return new Variance();
+  } else if (identifier == "MAD") {
+    return new MeanAbsoluteDeviation();
+  } else if (identifier == "MPD") {
+    return new MaximumPixelDifference();
+  } else if (identifier == "ENT") {
+    return new Entropy();
+  } else if (identifier == "SIM") {
+    return new StructuralSimilarityIndexMeasure();
+  }
+  return nullptr;
+}
+
+// calls fn with the method as its concrete (final) type, so every call fn
+// makes on it is resolved at compile time. A method defined elsewhere is
+// passed as a plain ErrorMethod and goes through the virtual calls.
+template <typename Fn>
+decltype(auto) dispatch(const ErrorMethod &method, Fn &&fn) {
+  if (auto *var = dynamic_cast<const Variance *>(&method)) {
+    return fn(*var);
+  } else if (auto *mad = dynamic_cast<const MeanAbsoluteDeviation *>(&method)) {
+    return fn(*mad);
+  } else if (auto *mpd =
+                 dynamic_cast<const MaximumPixelDifference *>(&method)) {
+    return fn(*mpd);
+  } else if (auto *ent = dynamic_cast<const Entropy *>(&method)) {
+    return fn(*ent);
+  } else if (auto *sim = dynamic_cast<const StructuralSimilarityIndexMeasure *>(
+                 &method)) {
+    return fn(*sim);
+  }
+  return fn(method);
+}
+
+} // namespace EMM
+
+#endif
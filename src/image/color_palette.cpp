@@ -0,0 +1,99 @@
+#include "color_palette.h"
+#include <algorithm>
+#include <numeric>
+
+namespace ColorPalette {
+namespace {
+
+// a run of the colour order, with the channel of its widest range
+struct Box {
+  size_t begin;
+  size_t end;
+  int channel;
+  int range;
+};
+
+Box makeBox(const std::vector<Color> &colors,
+            const std::vector<size_t> &order, size_t begin, size_t end) {
+  Box box = {begin, end, 0, 0};
+  for (int channel = 0; channel < 3; ++channel) {
+    int low = 255;
+    int high = 0;
+    for (size_t i = begin; i < end; ++i) {
+      low = (std::min)(low, static_cast<int>(colors[order[i]][channel]));
+      high = (std::max)(high, static_cast<int>(colors[order[i]][channel]));
+    }
+    if (high - low > box.range) {
+      box.range = high - low;
+      box.channel = channel;
+    }
+  }
+  return box;
+}
+
+} // namespace
+
+std::vector<Color> medianCut(const std::vector<Color> &colors,
+                             const std::vector<uint64_t> &weights,
+                             int maxColors, std::vector<int> &indices) {
+  std::vector<size_t> order(colors.size());
+  std::iota(order.begin(), order.end(), size_t(0));
+  std::vector<Box> boxes;
+  if (!colors.empty()) {
+    boxes.push_back(makeBox(colors, order, 0, colors.size()));
+  }
+
+  while (static_cast<int>(boxes.size()) < maxColors) {
+    // the first of the widest boxes, a box of one colour has no range
+    auto widest = std::max_element(
+        boxes.begin(), boxes.end(),
+        [](const Box &a, const Box &b) { return a.range < b.range; });
+    if (widest->range == 0) {
+      break;
+    }
+    const Box box = *widest;
+    std::stable_sort(order.begin() + box.begin, order.begin() + box.end,
+                     [&](size_t a, size_t b) {
+                       return colors[a][box.channel] < colors[b][box.channel];
+                     });
+    uint64_t total = 0;
+    for (size_t i = box.begin; i < box.end; ++i) {
+      total += weights[order[i]];
+    }
+    // the median goes to the lower half, and both halves keep a colour
+    size_t split = box.begin;
+    for (uint64_t below = 0; split < box.end - 1 && 2 * below < total;
+         ++split) {
+      below += weights[order[split]];
+    }
+    split = (std::max)(split, box.begin + 1);
+    *widest = makeBox(colors, order, box.begin, split);
+    boxes.push_back(makeBox(colors, order, split, box.end));
+  }
+
+  std::vector<Color> palette;
+  indices.assign(colors.size(), 0);
+  for (const Box &box : boxes) {
+    uint64_t total = 0;
+    std::array<uint64_t, 3> sums = {0, 0, 0};
+    for (size_t i = box.begin; i < box.end; ++i) {
+      const size_t color = order[i];
+      // a colour covering no pixel still counts for the average
+      const uint64_t weight = (std::max)(weights[color], uint64_t(1));
+      total += weight;
+      for (int channel = 0; channel < 3; ++channel) {
+        sums[channel] += weight * colors[color][channel];
+      }
+      indices[color] = static_cast<int>(palette.size());
+    }
+    Color average;
+    for (int channel = 0; channel < 3; ++channel) {
+      average[channel] =
+          static_cast<unsigned char>((sums[channel] + total / 2) / total);
+    }
+    palette.push_back(average);
+  }
+  return palette;
+}
+
+} // namespace ColorPalette
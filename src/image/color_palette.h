@@ -0,0 +1,27 @@
+#ifndef COLOR_PALETTE_H
+#define COLOR_PALETTE_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Palettes of rendered images, which are painted with one colour per
+// quadtree leaf, for the indexed PNG output (see PngEncoder::encodeIndexed).
+namespace ColorPalette {
+
+using Color = std::array<unsigned char, 3>;
+
+// entries of an 8-bit palette
+constexpr int kMaxColors = 256;
+
+// median cut: the box of colours with the widest channel range is split at
+// its weighted median along that channel until there are maxColors boxes,
+// and every box becomes its weighted average. `weights` are the pixels each
+// colour covers, indices[i] is the entry colors[i] maps to.
+std::vector<Color> medianCut(const std::vector<Color> &colors,
+                             const std::vector<uint64_t> &weights,
+                             int maxColors, std::vector<int> &indices);
+
+} // namespace ColorPalette
+
+#endif
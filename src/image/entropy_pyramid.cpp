@@ -0,0 +1,82 @@
+#include "entropy_pyramid.h"
+#include "scan_kernels.h"
+
+void EntropyPyramid::clear() {
+  mGrid.clear();
+  mEntropies.clear();
+}
+
+size_t EntropyPyramid::getBytesUsed() const {
+  size_t bytes = mGrid.getBytesUsed();
+  for (const std::vector<double> &entropies : mEntropies) {
+    bytes += entropies.size() * sizeof(double);
+  }
+  return bytes;
+}
+
+void EntropyPyramid::compute(const unsigned char *data, int width, int height,
+                             int channels, int splitAlignment) {
+  clear();
+  if (!data) {
+    return;
+  }
+  mGrid.compute(width, height, kLeafArea, splitAlignment);
+  mEntropies.resize(mGrid.getLevelCount());
+  for (int depth = 0; depth < mGrid.getLevelCount(); ++depth) {
+    mEntropies[depth].resize(mGrid.getLevel(depth).getCellCount());
+  }
+  if (mGrid.isEmpty()) {
+    return;
+  }
+
+  ChannelHistograms histograms;
+  computeCell(data, width, channels, 0, 0, 0, histograms);
+}
+
+void EntropyPyramid::computeCell(const unsigned char *data, int width,
+                                 int channels, int depth, int row,
+                                 int column, ChannelHistograms &histograms) {
+  const QuadtreeGrid::Level &level = mGrid.getLevel(depth);
+  const int left = level.columns.starts[column];
+  const int top = level.rows.starts[row];
+  const int cellWidth = level.columns.getSize(column);
+  const int cellHeight = level.rows.getSize(row);
+
+  for (std::array<int, 256> &histogram : histograms) {
+    histogram.fill(0);
+  }
+  if (depth + 1 == mGrid.getLevelCount()) {
+    ScanKernels::addToHistograms(
+        data + (static_cast<size_t>(top) * width + left) * channels,
+        static_cast<size_t>(width) * channels, cellWidth, cellHeight,
+        channels, histograms);
+  } else {
+    // the non-empty halves, found the way the grid split them
+    const QuadtreeGrid::Level &finer = mGrid.getLevel(depth + 1);
+    const int halfWidth = splitOffset(cellWidth, mGrid.getSplitAlignment());
+    const int halfHeight = splitOffset(cellHeight, mGrid.getSplitAlignment());
+    ChannelHistograms childHistograms;
+    for (int bottom = 0; bottom < 2; ++bottom) {
+      if (!bottom && halfHeight == 0) {
+        continue;
+      }
+      for (int right = 0; right < 2; ++right) {
+        if (!right && halfWidth == 0) {
+          continue;
+        }
+        const int childTop = top + bottom * halfHeight;
+        const int childLeft = left + right * halfWidth;
+        computeCell(data, width, channels, depth + 1,
+                    finer.rows.indexAt[childTop],
+                    finer.columns.indexAt[childLeft], childHistograms);
+        for (int channel = 0; channel < 3; ++channel) {
+          for (int bin = 0; bin < 256; ++bin) {
+            histograms[channel][bin] += childHistograms[channel][bin];
+          }
+        }
+      }
+    }
+  }
+  mEntropies[depth][level.getCellIndex(row, column)] =
+      computeMeanEntropy(histograms, cellWidth * cellHeight);
+}
@@ -0,0 +1,93 @@
+#ifndef ENTROPY_PYRAMID_H
+#define ENTROPY_PYRAMID_H
+
+#include "quadtree_grid.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// 256-bin histograms of the first three channels
+using ChannelHistograms = std::array<std::array<int, 256>, 3>;
+
+// mean Shannon entropy (bits) of the channels of `count` pixels
+inline double computeMeanEntropy(const ChannelHistograms &histograms,
+                                 int count) {
+  double entropy = 0.0;
+  for (const std::array<int, 256> &histogram : histograms) {
+    double channelEntropy = 0.0;
+    for (int bin : histogram) {
+      if (bin > 0) {
+        double p = static_cast<double>(bin) / count;
+        channelEntropy -= p * std::log2(p);
+      }
+    }
+    entropy += channelEntropy;
+  }
+  return entropy / 3.0;
+}
+
+// the same value for a few pixels without touching 256 bins: sorted, the
+// runs of equal values are the non-empty bins in the same order. Sorts the
+// `count` values of every channel in place.
+inline double
+computeSortedMeanEntropy(std::array<unsigned char *, 3> channelValues,
+                         int count) {
+  double entropy = 0.0;
+  for (unsigned char *values : channelValues) {
+    std::sort(values, values + count);
+    double channelEntropy = 0.0;
+    for (int start = 0, end = 0; start < count; start = end) {
+      while (end < count && values[end] == values[start]) {
+        ++end;
+      }
+      double p = static_cast<double>(end - start) / count;
+      channelEntropy -= p * std::log2(p);
+    }
+    entropy += channelEntropy;
+  }
+  return entropy / 3.0;
+}
+
+// Mean channel entropy of every quadtree block, one QuadtreeGrid cell each.
+// Built depth first: a cell of the finest level (at most kLeafArea pixels)
+// histograms its pixels, every coarser cell adds up the histograms of the
+// cells below it, so each pixel is read once and the per-cell cost does
+// not depend on the block area. Blocks below the finest level are small
+// enough to be scanned directly.
+class EntropyPyramid {
+public:
+  static constexpr long long kLeafArea = 256;
+
+  // cut like a quadtree of the given split alignment (see splitOffset)
+  void compute(const unsigned char *data, int width, int height,
+               int channels, int splitAlignment);
+  void clear();
+
+  bool isEmpty() const { return mGrid.isEmpty(); }
+  size_t getBytesUsed() const;
+
+  // false when the block is not a cell of any level (or is empty), the
+  // caller scans the pixels then
+  bool findBlockEntropy(int x, int y, int width, int height,
+                        double &entropy) const {
+    int depth;
+    size_t cell;
+    if (!mGrid.findCell(x, y, width, height, depth, cell)) {
+      return false;
+    }
+    entropy = mEntropies[depth][cell];
+    return true;
+  }
+
+private:
+  QuadtreeGrid mGrid;
+  std::vector<std::vector<double>> mEntropies; // per level
+
+  void computeCell(const unsigned char *data, int width, int channels,
+                   int depth, int row, int column,
+                   ChannelHistograms &histograms);
+};
+
+#endif
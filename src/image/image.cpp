@@ -4,91 +4,113 @@
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_writer.h"
+#include "codec/png_encoder.h"
 // #include "utils/debug.h"
 #include <algorithm>
+#include <cstdlib>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <utility>
 
 namespace fs = std::filesystem;
 
 Image::Image(const std::string &imagePath)
     : mImagePath(fs::absolute(imagePath).string()), mFileExt(""),
       mImageWidth(0), mImageHeight(0), mChannels(0), mImageData(nullptr),
-      mFileSize(0), mSummedAreaTable(nullptr), mSummedSquareTable(nullptr) {}
+      mFileSize(0), mSplitAlignment(1) {}
+
+Image::Image(int width, int height, int channels, const std::string &fileExt)
+    : mImagePath(""), mFileExt(fileExt), mImageWidth(width),
+      mImageHeight(height), mChannels(channels), mImageData(nullptr),
+      mFileSize(0), mSplitAlignment(1) {
+  // same allocator as stbi_load, the destructor frees with stbi_image_free
+  mImageData = static_cast<unsigned char *>(
+      std::calloc(static_cast<size_t>(width) * height * channels, 1));
+}
 
 Image::Image(const Image &other)
     : mImagePath(other.mImagePath), mFileExt(other.mFileExt),
       mImageWidth(other.mImageWidth), mImageHeight(other.mImageHeight),
       mChannels(other.mChannels), mImageData(nullptr),
-      mFileSize(other.mFileSize), mSummedAreaTable(nullptr),
-      mSummedSquareTable(nullptr) {
-
-  if (other.mImageData) {
-    int dataSize = mImageWidth * mImageHeight * mChannels;
-    mImageData = new unsigned char[dataSize];
-    std::memcpy(mImageData, other.mImageData, dataSize);
-  }
+      mFileSize(other.mFileSize), mPalette(other.mPalette),
+      mSplitAlignment(other.mSplitAlignment) {
+  copyDataFrom(other);
+}
 
-  if (other.mSummedAreaTable) {
-    int tableSize = mImageWidth * mImageHeight * mChannels;
-    mSummedAreaTable = new long long[tableSize];
-    std::memcpy(mSummedAreaTable, other.mSummedAreaTable,
-                tableSize * sizeof(long long));
-  }
-  if (other.mSummedSquareTable) {
-    int tableSize = mImageWidth * mImageHeight * mChannels;
-    mSummedSquareTable = new long long[tableSize];
-    std::memcpy(mSummedSquareTable, other.mSummedSquareTable,
-                tableSize * sizeof(long long));
-  }
+Image::Image(Image &&other) noexcept
+    : mImagePath(std::move(other.mImagePath)),
+      mFileExt(std::move(other.mFileExt)), mImageWidth(other.mImageWidth),
+      mImageHeight(other.mImageHeight), mChannels(other.mChannels),
+      mImageData(other.mImageData), mFileSize(other.mFileSize),
+      mPalette(std::move(other.mPalette)),
+      mSplitAlignment(other.mSplitAlignment),
+      mSummedTable(std::move(other.mSummedTable)),
+      mMinMaxPyramid(std::move(other.mMinMaxPyramid)),
+      mEntropyPyramid(std::move(other.mEntropyPyramid)) {
+  other.mImageData = nullptr;
 }
 
 Image &Image::operator=(const Image &other) {
   if (this != &other) {
-    delete[] mImageData;
-    delete[] mSummedAreaTable;
-    delete[] mSummedSquareTable;
+    releaseData();
+    mSummedTable.clear();
+    mMinMaxPyramid.clear();
+    mEntropyPyramid.clear();
 
     mImagePath = other.mImagePath;
     mImageWidth = other.mImageWidth;
     mImageHeight = other.mImageHeight;
     mFileExt = other.mFileExt;
     mChannels = other.mChannels;
+    mFileSize = other.mFileSize;
+    mPalette = other.mPalette;
+    mSplitAlignment = other.mSplitAlignment;
+    copyDataFrom(other);
+  }
+  return *this;
+}
 
-    if (other.mImageData) {
-      int dataSize = mImageWidth * mImageHeight * mChannels;
-      mImageData = new unsigned char[dataSize];
-      std::memcpy(mImageData, other.mImageData, dataSize);
-    } else {
-      mImageData = nullptr;
-    }
+Image &Image::operator=(Image &&other) noexcept {
+  if (this != &other) {
+    releaseData();
 
-    if (other.mSummedAreaTable) {
-      int tableSize = mImageWidth * mImageHeight * mChannels;
-      mSummedAreaTable = new long long[tableSize];
-      std::memcpy(mSummedAreaTable, other.mSummedAreaTable,
-                  tableSize * sizeof(long long));
-    } else {
-      mSummedAreaTable = nullptr;
-    }
-    if (other.mSummedSquareTable) {
-      int tableSize = mImageWidth * mImageHeight * mChannels;
-      mSummedSquareTable = new long long[tableSize];
-      std::memcpy(mSummedSquareTable, other.mSummedSquareTable,
-                  tableSize * sizeof(long long));
-    } else {
-      mSummedSquareTable = nullptr;
-    }
+    mImagePath = std::move(other.mImagePath);
+    mImageWidth = other.mImageWidth;
+    mImageHeight = other.mImageHeight;
+    mFileExt = std::move(other.mFileExt);
+    mChannels = other.mChannels;
+    mFileSize = other.mFileSize;
+    mPalette = std::move(other.mPalette);
+    mSplitAlignment = other.mSplitAlignment;
+    mImageData = other.mImageData;
+    other.mImageData = nullptr;
+    mSummedTable = std::move(other.mSummedTable);
+    mMinMaxPyramid = std::move(other.mMinMaxPyramid);
+    mEntropyPyramid = std::move(other.mEntropyPyramid);
   }
   return *this;
 }
 
-Image::~Image() {
+Image::~Image() { releaseData(); }
+
+void Image::copyDataFrom(const Image &other) {
+  // same allocator as stbi_load, so every buffer is freed the same way
+  if (other.mImageData) {
+    size_t dataSize =
+        static_cast<size_t>(mImageWidth) * mImageHeight * mChannels;
+    mImageData = static_cast<unsigned char *>(std::malloc(dataSize));
+    std::memcpy(mImageData, other.mImageData, dataSize);
+  } else {
+    mImageData = nullptr;
+  }
+}
+
+void Image::releaseData() {
   if (mImageData) {
     stbi_image_free(mImageData);
+    mImageData = nullptr;
   }
-  delete[] mSummedAreaTable;
-  delete[] mSummedSquareTable;
 }
 
 bool Image::load() {
@@ -105,6 +127,10 @@ bool Image::load() {
     std::cerr << "Error getting file size: " << e.what() << std::endl;
   }
 
+  releaseData();
+  mSummedTable.clear();
+  mMinMaxPyramid.clear();
+  mEntropyPyramid.clear();
   mImageData =
       stbi_load(mImagePath.c_str(), &mImageWidth, &mImageHeight, &mChannels, 0);
   if (!mImageData) {
@@ -118,7 +144,25 @@ bool Image::load() {
   return false;
 }
 
-bool Image::save(const std::string &outputPath = "") {
+bool Image::encodePng(int threadCount, std::vector<unsigned char> &png) const {
+  if (!mPalette.empty() &&
+      PngEncoder::encodeIndexed(mImageData, mImageWidth, mImageHeight,
+                                mChannels, mPalette, threadCount, png)) {
+    return true;
+  }
+  return PngEncoder::encode(mImageData, mImageWidth, mImageHeight, mChannels,
+                            threadCount, png);
+}
+
+static bool writeFile(const std::string &path,
+                      const std::vector<unsigned char> &png) {
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char *>(png.data()),
+             static_cast<std::streamsize>(png.size()));
+  return static_cast<bool>(file);
+}
+
+bool Image::save(const std::string &outputPath = "", int threadCount) {
   std::string savePath = outputPath;
   bool isSuccess = false;
 
@@ -129,15 +173,12 @@ bool Image::save(const std::string &outputPath = "") {
   }
 
   if (mFileExt == ".png") {
-    isSuccess =
-        stbi_write_png(savePath.c_str(), mImageWidth, mImageHeight, mChannels,
-                       mImageData, mImageWidth * mChannels) != 0;
+    std::vector<unsigned char> png;
+    isSuccess = encodePng(threadCount, png) && writeFile(savePath, png);
   } else if (mFileExt == ".jpg" || mFileExt == ".jpeg") {
 
     isSuccess = stbi_write_jpg(savePath.c_str(), mImageWidth, mImageHeight,
-                               mChannels, mImageData,
-                               68 // quality
-                               ) != 0;
+                               mChannels, mImageData, kJpegQuality) != 0;
   } else if (mFileExt == ".bmp") {
     isSuccess = stbi_write_bmp(savePath.c_str(), mImageWidth, mImageHeight,
                                mChannels, mImageData) != 0;
@@ -150,9 +191,8 @@ bool Image::save(const std::string &outputPath = "") {
                    ? fs::path(mImagePath).replace_extension("png").string()
                    : outputPath;
 
-    isSuccess =
-        stbi_write_png(savePath.c_str(), mImageWidth, mImageHeight, mChannels,
-                       mImageData, mImageWidth * mChannels) != 0;
+    std::vector<unsigned char> png;
+    isSuccess = encodePng(threadCount, png) && writeFile(savePath, png);
   }
   if (isSuccess) {
     try {
@@ -170,15 +210,16 @@ static void count_bytes(void *context, void *data, int size) {
   *total += static_cast<size_t>(size);
 }
 
-long long Image::estimateFileSize() const {
+long long Image::estimateFileSize(int threadCount) const {
   size_t totalBytes = 0;
 
+  std::vector<unsigned char> png;
   if (mFileExt == ".png") {
-    stbi_write_png_to_func(count_bytes, &totalBytes, mImageWidth, mImageHeight,
-                           mChannels, mImageData, mImageWidth * mChannels);
+    encodePng(threadCount, png);
+    totalBytes = png.size();
   } else if (mFileExt == ".jpg" || mFileExt == ".jpeg") {
     stbi_write_jpg_to_func(count_bytes, &totalBytes, mImageWidth, mImageHeight,
-                           mChannels, mImageData, 68);
+                           mChannels, mImageData, kJpegQuality);
   } else if (mFileExt == ".bmp") {
     stbi_write_bmp_to_func(count_bytes, &totalBytes, mImageWidth, mImageHeight,
                            mChannels, mImageData);
@@ -186,68 +227,52 @@ long long Image::estimateFileSize() const {
     stbi_write_tga_to_func(count_bytes, &totalBytes, mImageWidth, mImageHeight,
                            mChannels, mImageData);
   } else {
-    stbi_write_png_to_func(count_bytes, &totalBytes, mImageWidth, mImageHeight,
-                           mChannels, mImageData, mImageWidth * mChannels);
+    encodePng(threadCount, png);
+    totalBytes = png.size();
   }
   return totalBytes;
 }
 
-void Image::computeSummedAreaTable() {
-  // DEBUG_TIMER("Compute summed area table");
-  int totalPixels = mImageWidth * mImageHeight;
-  int tableSize = totalPixels * mChannels;
-  mSummedAreaTable = new long long[tableSize];
-  std::fill(mSummedAreaTable, mSummedAreaTable + tableSize, 0);
-
-  for (int y = 0; y < mImageHeight; ++y) {
-    for (int x = 0; x < mImageWidth; ++x) {
-      int idx = y * (mImageWidth * mChannels) + x * mChannels;
-      for (int c = 0; c < mChannels; ++c) {
-        long long currentVal = static_cast<long long>(mImageData[idx + c]);
-        long long left = (x > 0) ? mSummedAreaTable[idx - mChannels + c] : 0;
-        long long above =
-            (y > 0) ? mSummedAreaTable[idx - (mImageWidth * mChannels) + c] : 0;
-        long long aboveLeft =
-            (x > 0 && y > 0)
-                ? mSummedAreaTable[idx - (mImageWidth * mChannels) - mChannels +
-                                   c]
-                : 0;
-        mSummedAreaTable[idx + c] = currentVal + left + above - aboveLeft;
-      }
-    }
-  }
+void Image::computeSummedTables(bool withSquares) {
+  // DEBUG_TIMER("Compute summed tables");
+  mSummedTable.compute(mImageData, mImageWidth, mImageHeight, mChannels,
+                       withSquares);
 }
 
-void Image::computeSummedSquareTable() {
-  // DEBUG_TIMER("Compute square area table");
-  int totalPixels = mImageWidth * mImageHeight;
-  int tableSize = totalPixels * mChannels;
-  mSummedSquareTable = new long long[tableSize];
-  std::fill(mSummedSquareTable, mSummedSquareTable + tableSize, 0);
-
-  for (int y = 0; y < mImageHeight; ++y) {
-    for (int x = 0; x < mImageWidth; ++x) {
-      int idx = y * (mImageWidth * mChannels) + x * mChannels;
-      for (int c = 0; c < mChannels; ++c) {
-        long long currentVal = static_cast<long long>(mImageData[idx + c]);
-        long long squareVal = currentVal * currentVal;
-        long long left = (x > 0) ? mSummedSquareTable[idx - mChannels + c] : 0;
-        long long above =
-            (y > 0) ? mSummedSquareTable[idx - (mImageWidth * mChannels) + c]
-                    : 0;
-        long long aboveLeft =
-            (x > 0 && y > 0)
-                ? mSummedSquareTable[idx - (mImageWidth * mChannels) -
-                                     mChannels + c]
-                : 0;
-        mSummedSquareTable[idx + c] = squareVal + left + above - aboveLeft;
-      }
-    }
+void Image::computeSummedAreaTable() { computeSummedTables(false); }
+
+void Image::computeSummedSquareTable() { computeSummedTables(true); }
+
+void Image::computeMinMaxPyramid() {
+  mMinMaxPyramid.compute(mImageData, mImageWidth, mImageHeight, mChannels,
+                         mSplitAlignment);
+}
+
+void Image::computeEntropyPyramid() {
+  mEntropyPyramid.compute(mImageData, mImageWidth, mImageHeight, mChannels,
+                          mSplitAlignment);
+}
+
+size_t Image::getIdxAt(int x, int y, int channel) const {
+  return (static_cast<size_t>(y) * mImageWidth + x) * mChannels + channel;
+}
+
+Image Image::crop(int x, int y, int width, int height) const {
+  Image region(width, height, mChannels, mFileExt);
+  const size_t rowSize = static_cast<size_t>(width) * mChannels;
+  for (int row = 0; row < height; ++row) {
+    std::memcpy(region.mImageData + row * rowSize,
+                mImageData + getIdxAt(x, y + row, 0), rowSize);
   }
+  return region;
 }
 
-int Image::getIdxAt(int x, int y, int channel) const {
-  return y * (mImageWidth * mChannels) + x * mChannels + channel;
+void Image::paste(const Image &region, int x, int y) {
+  const size_t rowSize = static_cast<size_t>(region.mImageWidth) * mChannels;
+  for (int row = 0; row < region.mImageHeight; ++row) {
+    std::memcpy(mImageData + getIdxAt(x, y + row, 0),
+                region.mImageData + row * rowSize, rowSize);
+  }
 }
 
 std::array<unsigned char, 3> Image::getColorAt(int x, int y) const {
@@ -268,36 +293,6 @@ unsigned char Image::getAlphaAt(int x, int y) const {
   return 255;
 }
 
-long long Image::getChannelBlockSum(int x, int y, int width, int height,
-                                    int channel) const {
-
-  long long A =
-      (x > 0 && y > 0) ? mSummedAreaTable[getIdxAt(x - 1, y - 1, channel)] : 0;
-  long long B =
-      (y > 0) ? mSummedAreaTable[getIdxAt(x + width - 1, y - 1, channel)] : 0;
-  long long C =
-      (x > 0) ? mSummedAreaTable[getIdxAt(x - 1, y + height - 1, channel)] : 0;
-  long long D =
-      mSummedAreaTable[getIdxAt(x + width - 1, y + height - 1, channel)];
-
-  return D - B - C + A;
-}
-
-long long Image::getChannelSquareBlockSum(int x, int y, int width, int height,
-                                          int channel) const {
-  long long A = (x > 0 && y > 0)
-                    ? mSummedSquareTable[getIdxAt(x - 1, y - 1, channel)]
-                    : 0;
-  long long B =
-      (y > 0) ? mSummedSquareTable[getIdxAt(x + width - 1, y - 1, channel)] : 0;
-  long long C =
-      (x > 0) ? mSummedSquareTable[getIdxAt(x - 1, y + height - 1, channel)]
-              : 0;
-  long long D =
-      mSummedSquareTable[getIdxAt(x + width - 1, y + height - 1, channel)];
-  return D - B - C + A;
-}
-
 void Image::setColorAt(int x, int y, unsigned char r, unsigned char g,
                        unsigned char b) {
   mImageData[getIdxAt(x, y, 0)] = r;
@@ -336,7 +331,7 @@ void Image::setBlockColorAt(int startX, int startY, int blockWidth,
   }
 
   for (int y = startY; y < endY; ++y) {
-    unsigned char *rowPtr = mImageData + (y * mImageWidth + startX) * mChannels;
+    unsigned char *rowPtr = mImageData + getIdxAt(startX, y, 0);
     std::memcpy(rowPtr, rowBuffer.data(), rowSize);
   }
 }
@@ -1,16 +1,34 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include "entropy_pyramid.h"
+#include "minmax_pyramid.h"
+#include "summed_table.h"
 #include <array>
 #include <cstring>
 #include <string>
+#include <utility>
+#include <vector>
 
 class Image {
 public:
+  // stb_image_write subsamples chroma 2x2 at quality 90 and below, its
+  // MCUs are then 16x16 pixels instead of 8x8
+  static constexpr int kJpegQuality = 68;
+  static constexpr int kJpegMcuSize = kJpegQuality <= 90 ? 16 : 8;
+
   Image(const std::string &imagePath);
+  // blank (black) in-memory image, saved as fileExt
+  Image(int width, int height, int channels,
+        const std::string &fileExt = ".png");
+  // copies the pixels only, the summed table and the pyramids describe the
+  // source pixels and output copies never query them; compute them again
+  // on the copy if needed
   Image(const Image &other);
+  Image(Image &&other) noexcept;
 
   Image &operator=(const Image &other);
+  Image &operator=(Image &&other) noexcept;
 
   ~Image();
 
@@ -18,8 +36,10 @@ public:
   std::string getFileExt() const { return mFileExt; }
 
   bool load();
-  bool save(const std::string &outputPath);
-  long long estimateFileSize() const;
+  // PNG output is deflated on up to threadCount threads (see PngEncoder),
+  // the other formats on one
+  bool save(const std::string &outputPath, int threadCount = 1);
+  long long estimateFileSize(int threadCount = 1) const;
 
   int getWidth() const { return mImageWidth; }
   int getHeight() const { return mImageHeight; }
@@ -27,15 +47,48 @@ public:
   long long getFileSize() const { return mFileSize; }
   unsigned char *getImageData() const { return mImageData; }
 
+  // the colours the image is painted with, when known and no more than
+  // 256 (see QuadtreeImage::PaletteMode); a PNG is then saved indexed,
+  // unless a pixel turns out to have another colour
+  const std::vector<std::array<unsigned char, 3>> &getPalette() const {
+    return mPalette;
+  }
+  void setPalette(std::vector<std::array<unsigned char, 3>> palette) {
+    mPalette = std::move(palette);
+  }
+
+  // the grid quadtree blocks of this image are split on (see splitOffset),
+  // 1 splits them at the middle; set it before the error method prepares
+  // the image, the pyramids are cut the same way
+  int getSplitAlignment() const { return mSplitAlignment; }
+  void setSplitAlignment(int alignment) { mSplitAlignment = alignment; }
+
   std::array<unsigned char, 3> getColorAt(int x, int y) const;
   unsigned char getAlphaAt(int x, int y) const;
 
-  int getIdxAt(int x, int y, int channel) const;
+  size_t getIdxAt(int x, int y, int channel) const;
 
+  // copy of a rectangle of pixels (no summed table), and its way back; the
+  // region must lie inside the image and have the same channel count
+  Image crop(int x, int y, int width, int height) const;
+  void paste(const Image &region, int x, int y);
+
+  // all channels of a block from one lookup per corner
+  BlockStats getBlockStats(int x, int y, int width, int height) const {
+    return mSummedTable.getBlockStats(x, y, width, height);
+  }
   long long getChannelBlockSum(int x, int y, int width, int height,
-                               int channel) const;
+                               int channel) const {
+    return mSummedTable.getChannelBlockSum(x, y, width, height, channel);
+  }
   long long getChannelSquareBlockSum(int x, int y, int width, int height,
-                                     int channel) const;
+                                     int channel) const {
+    return mSummedTable.getChannelSquareBlockSum(x, y, width, height,
+                                                 channel);
+  }
+  const SummedTable &getSummedTable() const { return mSummedTable; }
+  const MinMaxPyramid &getMinMaxPyramid() const { return mMinMaxPyramid; }
+  const EntropyPyramid &getEntropyPyramid() const { return mEntropyPyramid; }
 
   void setColorAt(int x, int y, unsigned char r, unsigned char g,
                   unsigned char b);
@@ -43,8 +96,16 @@ public:
 
   void setBlockColorAt(int x, int y, int width, int height, unsigned char r,
                        unsigned char g, unsigned char b);
+  // builds both tables in a single pass over the pixels when withSquares
+  // is set, otherwise only the summed-area table
+  void computeSummedTables(bool withSquares);
+  // also refreshes the summed-area table, it comes for free in the same pass
   void computeSummedSquareTable();
   void computeSummedAreaTable();
+  // per-channel min/max of every quadtree block, for MPD
+  void computeMinMaxPyramid();
+  // channel entropy of every quadtree block, for ENT
+  void computeEntropyPyramid();
 
 private:
   std::string mImagePath;
@@ -55,9 +116,16 @@ private:
   unsigned char *mImageData;
 
   long long mFileSize;
+  std::vector<std::array<unsigned char, 3>> mPalette;
+  int mSplitAlignment;
+
+  SummedTable mSummedTable;
+  MinMaxPyramid mMinMaxPyramid;
+  EntropyPyramid mEntropyPyramid;
 
-  long long *mSummedAreaTable;
-  long long *mSummedSquareTable;
+  bool encodePng(int threadCount, std::vector<unsigned char> &png) const;
+  void copyDataFrom(const Image &other);
+  void releaseData();
 };
 
 #endif
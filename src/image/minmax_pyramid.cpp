@@ -0,0 +1,67 @@
+#include "minmax_pyramid.h"
+#include <algorithm>
+
+void MinMaxPyramid::clear() {
+  mGrid.clear();
+  mCells.clear();
+}
+
+size_t MinMaxPyramid::getBytesUsed() const {
+  size_t bytes = mGrid.getBytesUsed();
+  for (const std::vector<ChannelRange> &cells : mCells) {
+    bytes += cells.size() * sizeof(ChannelRange);
+  }
+  return bytes;
+}
+
+void MinMaxPyramid::compute(const unsigned char *data, int width, int height,
+                            int channels, int splitAlignment) {
+  clear();
+  if (!data) {
+    return;
+  }
+  mGrid.compute(width, height, kLeafArea, splitAlignment);
+  mCells.resize(mGrid.getLevelCount());
+  if (mGrid.isEmpty()) {
+    return;
+  }
+
+  // the finest level in one row-major pass over the pixels
+  const int finestDepth = mGrid.getLevelCount() - 1;
+  const QuadtreeGrid::Level &finest = mGrid.getLevel(finestDepth);
+  std::vector<ChannelRange> &finestCells = mCells[finestDepth];
+  finestCells.assign(finest.getCellCount(), ChannelRange());
+  for (int row = 0; row < finest.rows.getCount(); ++row) {
+    ChannelRange *cellRow = finestCells.data() + finest.getCellIndex(row, 0);
+    for (int y = finest.rows.starts[row]; y < finest.rows.starts[row + 1];
+         ++y) {
+      const unsigned char *pixel =
+          data + static_cast<size_t>(y) * width * channels;
+      for (int column = 0; column < finest.columns.getCount(); ++column) {
+        ChannelRange &cell = cellRow[column];
+        const int end = finest.columns.starts[column + 1];
+        for (int x = finest.columns.starts[column]; x < end;
+             ++x, pixel += channels) {
+          for (int channel = 0; channel < 3; ++channel) {
+            cell.min[channel] = std::min(cell.min[channel], pixel[channel]);
+            cell.max[channel] = std::max(cell.max[channel], pixel[channel]);
+          }
+        }
+      }
+    }
+  }
+
+  // every coarser cell is the union of the cells below it
+  for (int depth = finestDepth; depth > 0; --depth) {
+    const QuadtreeGrid::Level &finer = mGrid.getLevel(depth);
+    const QuadtreeGrid::Level &coarser = mGrid.getLevel(depth - 1);
+    mCells[depth - 1].assign(coarser.getCellCount(), ChannelRange());
+    for (int row = 0; row < finer.rows.getCount(); ++row) {
+      for (int column = 0; column < finer.columns.getCount(); ++column) {
+        mCells[depth - 1][coarser.getCellIndex(finer.rows.parent[row],
+                                               finer.columns.parent[column])]
+            .merge(mCells[depth][finer.getCellIndex(row, column)]);
+      }
+    }
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef MINMAX_PYRAMID_H
+#define MINMAX_PYRAMID_H
+
+#include "quadtree_grid.h"
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// smallest and largest value of the first three channels over a block
+struct ChannelRange {
+  std::array<unsigned char, 3> min = {255, 255, 255};
+  std::array<unsigned char, 3> max = {0, 0, 0};
+
+  void merge(const ChannelRange &other) {
+    for (int channel = 0; channel < 3; ++channel) {
+      if (other.min[channel] < min[channel]) {
+        min[channel] = other.min[channel];
+      }
+      if (other.max[channel] > max[channel]) {
+        max[channel] = other.max[channel];
+      }
+    }
+  }
+};
+
+// Per-channel min/max of every quadtree block, one QuadtreeGrid cell each.
+// The finest level stops once its cells cover at most kLeafArea pixels; it
+// is scanned once, every coarser level merges the up to four cells below
+// it, so the whole build is linear. Blocks below the finest level are small
+// enough to be scanned directly.
+class MinMaxPyramid {
+public:
+  static constexpr long long kLeafArea = 64;
+
+  // cut like a quadtree of the given split alignment (see splitOffset)
+  void compute(const unsigned char *data, int width, int height,
+               int channels, int splitAlignment);
+  void clear();
+
+  bool isEmpty() const { return mGrid.isEmpty(); }
+  size_t getBytesUsed() const;
+
+  // false when the block is not a cell of any level (or is empty), the
+  // caller scans the pixels then
+  bool findBlockRange(int x, int y, int width, int height,
+                      ChannelRange &range) const {
+    int depth;
+    size_t cell;
+    if (!mGrid.findCell(x, y, width, height, depth, cell)) {
+      return false;
+    }
+    range = mCells[depth][cell];
+    return true;
+  }
+
+private:
+  QuadtreeGrid mGrid;
+  std::vector<std::vector<ChannelRange>> mCells; // per level
+};
+
+#endif
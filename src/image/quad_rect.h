@@ -0,0 +1,28 @@
+#ifndef QUAD_RECT_H
+#define QUAD_RECT_H
+
+// a block of the image, in pixels
+struct QuadRect {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+// where a block `length` pixels long is split, from its start: the middle,
+// the first half getting the floor. With an alignment above 1 the split
+// snaps to the multiple of it nearest the middle instead, so blocks that
+// start on the alignment grid split on it; a block no longer than the
+// alignment has no such split and is split at the middle.
+inline int splitOffset(int length, int alignment) {
+  const int half = length / 2;
+  if (alignment > 1) {
+    const int snapped = (half + alignment / 2) / alignment * alignment;
+    if (snapped > 0 && snapped < length) {
+      return snapped;
+    }
+  }
+  return half;
+}
+
+#endif
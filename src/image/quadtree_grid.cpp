@@ -0,0 +1,85 @@
+#include "quadtree_grid.h"
+#include <algorithm>
+
+namespace {
+
+int getMaxSize(const std::vector<int> &starts) {
+  int maxSize = 0;
+  for (size_t span = 0; span + 1 < starts.size(); ++span) {
+    maxSize = std::max(maxSize, starts[span + 1] - starts[span]);
+  }
+  return maxSize;
+}
+
+} // namespace
+
+QuadtreeGrid::Axis QuadtreeGrid::makeRootAxis(int length) {
+  Axis axis;
+  axis.starts = {0, length};
+  axis.indexAt.assign(length + 1, -1);
+  axis.indexAt[0] = 0;
+  axis.parent = {-1};
+  return axis;
+}
+
+QuadtreeGrid::Axis QuadtreeGrid::splitAxis(const Axis &axis, int length,
+                                           int splitAlignment) {
+  // same split as QuadtreeNode::divide, empty halves are dropped
+  Axis finer;
+  finer.indexAt.assign(length + 1, -1);
+  auto addSpan = [&finer](int start, int parent) {
+    finer.indexAt[start] = static_cast<int>(finer.parent.size());
+    finer.starts.push_back(start);
+    finer.parent.push_back(parent);
+  };
+  for (int span = 0; span < axis.getCount(); ++span) {
+    const int start = axis.starts[span];
+    const int half = splitOffset(axis.getSize(span), splitAlignment);
+    // a span of one keeps only its right/bottom half, itself
+    if (half > 0) {
+      addSpan(start, span);
+    }
+    addSpan(start + half, span);
+  }
+  finer.starts.push_back(length);
+  return finer;
+}
+
+void QuadtreeGrid::compute(int width, int height, long long leafArea,
+                           int splitAlignment) {
+  mLevels.clear();
+  mSplitAlignment = splitAlignment;
+  if (width <= 0 || height <= 0) {
+    return;
+  }
+
+  Level root;
+  root.columns = makeRootAxis(width);
+  root.rows = makeRootAxis(height);
+  mLevels.push_back(std::move(root));
+  for (;;) {
+    Level &level = mLevels.back();
+    level.maxColumnSize = getMaxSize(level.columns.starts);
+    level.maxRowSize = getMaxSize(level.rows.starts);
+    if (static_cast<long long>(level.maxColumnSize) * level.maxRowSize <=
+        leafArea) {
+      break;
+    }
+    Level finer;
+    finer.columns = splitAxis(level.columns, width, mSplitAlignment);
+    finer.rows = splitAxis(level.rows, height, mSplitAlignment);
+    mLevels.push_back(std::move(finer));
+  }
+}
+
+size_t QuadtreeGrid::getBytesUsed() const {
+  size_t bytes = 0;
+  for (const Level &level : mLevels) {
+    for (const Axis *axis : {&level.columns, &level.rows}) {
+      bytes += (axis->starts.size() + axis->indexAt.size() +
+                axis->parent.size()) *
+               sizeof(int);
+    }
+  }
+  return bytes;
+}
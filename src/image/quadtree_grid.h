@@ -0,0 +1,82 @@
+#ifndef QUADTREE_GRID_H
+#define QUADTREE_GRID_H
+
+#include "quad_rect.h"
+#include <cstddef>
+#include <vector>
+
+// The blocks of a quadtree over an image, one level per tree depth.
+// Level d cuts the image the way the quadtree does at depth d (see
+// splitOffset), so every non-empty block the tree can evaluate down
+// to the finest level is exactly one cell. Levels are added until the cells
+// cover at most the requested leaf area. Per-cell data lives with the
+// owner, indexed by getCellIndex.
+class QuadtreeGrid {
+public:
+  // the positive-size spans of one axis at one depth
+  struct Axis {
+    std::vector<int> starts; // span count + 1 entries, the last is the end
+    // span starting at a coordinate, -1 for none (one past the end as well)
+    std::vector<int> indexAt;
+    std::vector<int> parent; // span of the coarser level containing it
+
+    int getCount() const { return static_cast<int>(starts.size()) - 1; }
+    int getSize(int span) const { return starts[span + 1] - starts[span]; }
+  };
+
+  struct Level {
+    Axis columns;
+    Axis rows;
+    int maxColumnSize = 0;
+    int maxRowSize = 0;
+
+    size_t getCellCount() const {
+      return static_cast<size_t>(columns.getCount()) * rows.getCount();
+    }
+    // row major
+    size_t getCellIndex(int row, int column) const {
+      return static_cast<size_t>(row) * columns.getCount() + column;
+    }
+  };
+
+  void compute(int width, int height, long long leafArea,
+               int splitAlignment = 1);
+  void clear() { mLevels.clear(); }
+
+  int getSplitAlignment() const { return mSplitAlignment; }
+
+  bool isEmpty() const { return mLevels.empty(); }
+  int getLevelCount() const { return static_cast<int>(mLevels.size()); }
+  const Level &getLevel(int depth) const { return mLevels[depth]; }
+  size_t getBytesUsed() const;
+
+  // false when the block is not a cell of any level (or is empty)
+  bool findCell(int x, int y, int width, int height, int &depth,
+                size_t &cell) const {
+    for (depth = 0; depth < getLevelCount(); ++depth) {
+      const Level &level = mLevels[depth];
+      // levels only get finer, no deeper cell is wide or tall enough
+      if (level.maxColumnSize < width || level.maxRowSize < height) {
+        break;
+      }
+      const int column = level.columns.indexAt[x];
+      const int row = level.rows.indexAt[y];
+      if (column >= 0 && row >= 0 &&
+          level.columns.getSize(column) == width &&
+          level.rows.getSize(row) == height) {
+        cell = level.getCellIndex(row, column);
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  std::vector<Level> mLevels;
+  int mSplitAlignment = 1;
+
+  static Axis makeRootAxis(int length);
+  static Axis splitAxis(const Axis &axis, int length, int splitAlignment);
+};
+
+#endif
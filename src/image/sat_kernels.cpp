@@ -0,0 +1,379 @@
+#include "sat_kernels.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||             \
+    defined(_M_IX86)
+#define SAT_KERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC accepts every intrinsic without per-function target flags
+#define SAT_TARGET_SSE2
+#define SAT_TARGET_AVX2
+#else
+#define SAT_TARGET_SSE2 __attribute__((target("sse2")))
+#define SAT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace SatKernels {
+
+namespace {
+
+// reads the channels of one pixel into the low bytes of a 32-bit word, the
+// unused high byte of a 3 channel pixel is cleared
+inline uint32_t loadPixel(const unsigned char *pixel, int channels,
+                          bool isLastInRow) {
+  if (channels == 4) {
+    uint32_t bytes;
+    std::memcpy(&bytes, pixel, 4);
+    return bytes;
+  }
+  if (!isLastInRow) {
+    uint32_t bytes;
+    std::memcpy(&bytes, pixel, 4);
+    return bytes & 0x00FFFFFFu;
+  }
+  return pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+}
+
+// zero top row and left column, the kernels only write the image records
+template <typename T>
+void clearBorder(T *records, int width, int height, int recordLanes) {
+  const size_t rowLanes = static_cast<size_t>(width + 1) * recordLanes;
+  std::fill(records, records + rowLanes, T(0));
+  for (int y = 1; y <= height; ++y) {
+    std::fill(records + y * rowLanes, records + y * rowLanes + recordLanes,
+              T(0));
+  }
+}
+
+// unsigned 32-bit records simply wrap around, see SummedTable
+template <typename T, bool kSquares>
+void scalarKernel(const unsigned char *data, int width, int height,
+                  int channels, T *records) {
+  constexpr int kRecordLanes = kSquares ? 2 * kLanes : kLanes;
+  const size_t rowLanes = static_cast<size_t>(width + 1) * kRecordLanes;
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *pixel =
+        data + static_cast<size_t>(y) * width * channels;
+    T *out = records + (y + 1) * rowLanes + kRecordLanes;
+    const T *above = out - rowLanes;
+
+    T running[kRecordLanes] = {};
+    for (int x = 0; x < width; ++x) {
+      for (int c = 0; c < channels && c < kLanes; ++c) {
+        const T value = pixel[c];
+        running[c] += value;
+        if (kSquares) {
+          running[kLanes + c] += value * value;
+        }
+      }
+      for (int lane = 0; lane < kRecordLanes; ++lane) {
+        out[lane] = above[lane] + running[lane];
+      }
+      pixel += channels;
+      out += kRecordLanes;
+      above += kRecordLanes;
+    }
+  }
+}
+
+#ifdef SAT_KERNELS_X86
+
+// two 64-bit lanes per register: channels 0-1 in `low`, 2-3 in `high`
+template <bool kSquares>
+SAT_TARGET_SSE2 void sse2Kernel64(const unsigned char *data, int width,
+                                int height, int channels, long long *records) {
+  constexpr int kRecordLanes = kSquares ? 2 * kLanes : kLanes;
+  const size_t rowLanes = static_cast<size_t>(width + 1) * kRecordLanes;
+  const __m128i zero = _mm_setzero_si128();
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *row = data + static_cast<size_t>(y) * width * channels;
+    long long *out = records + (y + 1) * rowLanes + kRecordLanes;
+    const long long *above = out - rowLanes;
+
+    __m128i sumLow = zero, sumHigh = zero;
+    __m128i squareLow = zero, squareHigh = zero;
+    for (int x = 0; x < width; ++x) {
+      const __m128i bytes = _mm_cvtsi32_si128(static_cast<int>(
+          loadPixel(row + x * channels, channels, x == width - 1)));
+      const __m128i words =
+          _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero);
+      const __m128i low = _mm_unpacklo_epi32(words, zero);
+      const __m128i high = _mm_unpackhi_epi32(words, zero);
+
+      sumLow = _mm_add_epi64(sumLow, low);
+      sumHigh = _mm_add_epi64(sumHigh, high);
+      __m128i *record = reinterpret_cast<__m128i *>(out);
+      const __m128i *recordAbove = reinterpret_cast<const __m128i *>(above);
+      _mm_storeu_si128(record,
+                       _mm_add_epi64(_mm_loadu_si128(recordAbove), sumLow));
+      _mm_storeu_si128(
+          record + 1,
+          _mm_add_epi64(_mm_loadu_si128(recordAbove + 1), sumHigh));
+
+      if (kSquares) {
+        // the lanes hold values < 256, a 32x32 bit multiply is enough
+        squareLow = _mm_add_epi64(squareLow, _mm_mul_epu32(low, low));
+        squareHigh = _mm_add_epi64(squareHigh, _mm_mul_epu32(high, high));
+        _mm_storeu_si128(record + 2, _mm_add_epi64(
+                                         _mm_loadu_si128(recordAbove + 2),
+                                         squareLow));
+        _mm_storeu_si128(record + 3, _mm_add_epi64(
+                                         _mm_loadu_si128(recordAbove + 3),
+                                         squareHigh));
+      }
+      out += kRecordLanes;
+      above += kRecordLanes;
+    }
+  }
+}
+
+// one pixel per register
+template <bool kSquares>
+SAT_TARGET_AVX2 void avx2Kernel64(const unsigned char *data, int width,
+                                int height, int channels, long long *records) {
+  constexpr int kRecordLanes = kSquares ? 2 * kLanes : kLanes;
+  const size_t rowLanes = static_cast<size_t>(width + 1) * kRecordLanes;
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *row = data + static_cast<size_t>(y) * width * channels;
+    long long *out = records + (y + 1) * rowLanes + kRecordLanes;
+    const long long *above = out - rowLanes;
+
+    __m256i sum = _mm256_setzero_si256();
+    __m256i square = _mm256_setzero_si256();
+    for (int x = 0; x < width; ++x) {
+      const __m256i pixel = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(
+          static_cast<int>(
+              loadPixel(row + x * channels, channels, x == width - 1))));
+
+      sum = _mm256_add_epi64(sum, pixel);
+      __m256i *record = reinterpret_cast<__m256i *>(out);
+      const __m256i *recordAbove = reinterpret_cast<const __m256i *>(above);
+      _mm256_storeu_si256(
+          record, _mm256_add_epi64(_mm256_loadu_si256(recordAbove), sum));
+
+      if (kSquares) {
+        square = _mm256_add_epi64(square, _mm256_mul_epu32(pixel, pixel));
+        _mm256_storeu_si256(record + 1,
+                            _mm256_add_epi64(
+                                _mm256_loadu_si256(recordAbove + 1), square));
+      }
+      out += kRecordLanes;
+      above += kRecordLanes;
+    }
+  }
+}
+
+// 32-bit records: the channel sums in one register, the square sums in
+// another; squares of bytes fit in 16 bits so SSE2 can use mullo_epi16
+template <bool kSquares>
+SAT_TARGET_SSE2 void sse2Kernel32(const unsigned char *data, int width,
+                                  int height, int channels,
+                                  uint32_t *records) {
+  constexpr int kRecordLanes = kSquares ? 2 * kLanes : kLanes;
+  const size_t rowLanes = static_cast<size_t>(width + 1) * kRecordLanes;
+  const __m128i zero = _mm_setzero_si128();
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *row = data + static_cast<size_t>(y) * width * channels;
+    uint32_t *out = records + (y + 1) * rowLanes + kRecordLanes;
+    const uint32_t *above = out - rowLanes;
+
+    __m128i sum = zero, square = zero;
+    for (int x = 0; x < width; ++x) {
+      const __m128i bytes = _mm_cvtsi32_si128(static_cast<int>(
+          loadPixel(row + x * channels, channels, x == width - 1)));
+      const __m128i words = _mm_unpacklo_epi8(bytes, zero);
+
+      sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(words, zero));
+      __m128i *record = reinterpret_cast<__m128i *>(out);
+      const __m128i *recordAbove = reinterpret_cast<const __m128i *>(above);
+      _mm_storeu_si128(record,
+                       _mm_add_epi32(_mm_loadu_si128(recordAbove), sum));
+
+      if (kSquares) {
+        square = _mm_add_epi32(
+            square, _mm_unpacklo_epi16(_mm_mullo_epi16(words, words), zero));
+        _mm_storeu_si128(record + 1, _mm_add_epi32(
+                                         _mm_loadu_si128(recordAbove + 1),
+                                         square));
+      }
+      out += kRecordLanes;
+      above += kRecordLanes;
+    }
+  }
+}
+
+// a whole 32-bit record (sums and square sums) per register
+template <bool kSquares>
+SAT_TARGET_AVX2 void avx2Kernel32(const unsigned char *data, int width,
+                                  int height, int channels,
+                                  uint32_t *records) {
+  constexpr int kRecordLanes = kSquares ? 2 * kLanes : kLanes;
+  const size_t rowLanes = static_cast<size_t>(width + 1) * kRecordLanes;
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *row = data + static_cast<size_t>(y) * width * channels;
+    uint32_t *out = records + (y + 1) * rowLanes + kRecordLanes;
+    const uint32_t *above = out - rowLanes;
+
+    __m256i running = _mm256_setzero_si256();
+    __m128i runningSum = _mm_setzero_si128();
+    for (int x = 0; x < width; ++x) {
+      const __m128i pixel = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(
+          static_cast<int>(
+              loadPixel(row + x * channels, channels, x == width - 1))));
+      if (kSquares) {
+        // the high 16 bits of every lane are zero, so are their products
+        const __m256i record = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(pixel), _mm_mullo_epi16(pixel, pixel), 1);
+        running = _mm256_add_epi32(running, record);
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i *>(out),
+            _mm256_add_epi32(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(above)),
+                running));
+      } else {
+        runningSum = _mm_add_epi32(runningSum, pixel);
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i *>(out),
+            _mm_add_epi32(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(above)),
+                runningSum));
+      }
+      out += kRecordLanes;
+      above += kRecordLanes;
+    }
+  }
+}
+
+bool cpuSupportsAvx2() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  const bool hasOsXsave = (info[2] & (1 << 27)) != 0;
+  const bool hasAvx = (info[2] & (1 << 28)) != 0;
+  // the OS must also save the YMM registers on context switches
+  if (!hasOsXsave || !hasAvx || (_xgetbv(0) & 6) != 6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool cpuSupportsSse2() {
+#if defined(_M_X64) || defined(__x86_64__)
+  return true;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+#endif
+}
+
+#endif
+
+} // namespace
+
+bool isSupported(InstructionSet set) {
+  switch (set) {
+  case InstructionSet::Scalar:
+    return true;
+#ifdef SAT_KERNELS_X86
+  case InstructionSet::SSE2:
+    return cpuSupportsSse2();
+  case InstructionSet::AVX2:
+    return cpuSupportsAvx2();
+#endif
+  default:
+    return false;
+  }
+}
+
+InstructionSet detectInstructionSet() {
+  static const InstructionSet detected = []() {
+    if (isSupported(InstructionSet::AVX2)) {
+      return InstructionSet::AVX2;
+    }
+    if (isSupported(InstructionSet::SSE2)) {
+      return InstructionSet::SSE2;
+    }
+    return InstructionSet::Scalar;
+  }();
+  return detected;
+}
+
+const char *getInstructionSetName(InstructionSet set) {
+  switch (set) {
+  case InstructionSet::SSE2:
+    return "sse2";
+  case InstructionSet::AVX2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+namespace {
+
+template <typename T>
+void computeRecords(const unsigned char *data, int width, int height,
+                    int channels, T *records, bool withSquares,
+                    InstructionSet set) {
+  if (width <= 0 || height <= 0) {
+    return;
+  }
+  if (!isSupported(set)) {
+    set = detectInstructionSet();
+  }
+  if (channels != 3 && channels != 4) {
+    set = InstructionSet::Scalar;
+  }
+
+  using Kernel = void (*)(const unsigned char *, int, int, int, T *);
+  Kernel kernel = withSquares ? scalarKernel<T, true> : scalarKernel<T, false>;
+#ifdef SAT_KERNELS_X86
+  if constexpr (std::is_same_v<T, uint32_t>) {
+    if (set == InstructionSet::AVX2) {
+      kernel = withSquares ? avx2Kernel32<true> : avx2Kernel32<false>;
+    } else if (set == InstructionSet::SSE2) {
+      kernel = withSquares ? sse2Kernel32<true> : sse2Kernel32<false>;
+    }
+  } else {
+    if (set == InstructionSet::AVX2) {
+      kernel = withSquares ? avx2Kernel64<true> : avx2Kernel64<false>;
+    } else if (set == InstructionSet::SSE2) {
+      kernel = withSquares ? sse2Kernel64<true> : sse2Kernel64<false>;
+    }
+  }
+#endif
+
+  clearBorder(records, width, height, withSquares ? 2 * kLanes : kLanes);
+  kernel(data, width, height, channels, records);
+}
+
+} // namespace
+
+void computeSummedTables(const unsigned char *data, int width, int height,
+                         int channels, long long *records, bool withSquares,
+                         InstructionSet set) {
+  computeRecords(data, width, height, channels, records, withSquares, set);
+}
+
+void computeSummedTables(const unsigned char *data, int width, int height,
+                         int channels, uint32_t *records, bool withSquares,
+                         InstructionSet set) {
+  computeRecords(data, width, height, channels, records, withSquares, set);
+}
+
+} // namespace SatKernels
@@ -0,0 +1,40 @@
+#ifndef SAT_KERNELS_H
+#define SAT_KERNELS_H
+
+#include <cstdint>
+
+// Fused summed-area / summed-square table construction.
+// One pass over the pixels: every row keeps a running prefix sum per channel
+// and adds it to the row above. The output is the record layout of
+// SummedTable: kLanes channel sums per pixel, followed by kLanes square sums
+// when squares are kept, with a zero row and column in front of the image.
+// The 3 and 4 channel layouts are processed one pixel per vector (SSE2 or
+// AVX2, picked at runtime), every other layout goes through the scalar
+// kernel.
+
+namespace SatKernels {
+
+enum class InstructionSet { Scalar, SSE2, AVX2 };
+
+// channel lanes of a record, lanes past the image channels are zero
+constexpr int kLanes = 4;
+
+// whether the running CPU (and this build) can run kernels of `set`
+bool isSupported(InstructionSet set);
+// best instruction set supported by the running CPU, detected once
+InstructionSet detectInstructionSet();
+const char *getInstructionSetName(InstructionSet set);
+
+// fills `records`, (width + 1) * (height + 1) records of kLanes (or
+// 2 * kLanes withSquares) entries each. The 32-bit variant stores every
+// entry modulo 2^32.
+void computeSummedTables(const unsigned char *data, int width, int height,
+                         int channels, long long *records, bool withSquares,
+                         InstructionSet set = detectInstructionSet());
+void computeSummedTables(const unsigned char *data, int width, int height,
+                         int channels, uint32_t *records, bool withSquares,
+                         InstructionSet set = detectInstructionSet());
+
+} // namespace SatKernels
+
+#endif
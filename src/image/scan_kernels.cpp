@@ -0,0 +1,390 @@
+#include "scan_kernels.h"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||             \
+    defined(_M_IX86)
+#define SCAN_KERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define SCAN_TARGET_SSE2
+#define SCAN_TARGET_AVX2
+#else
+#define SCAN_TARGET_SSE2 __attribute__((target("sse2")))
+#define SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace ScanKernels {
+
+namespace {
+
+// floor(|value - mean|) with lower = floor(mean) and upper = ceil(mean):
+// above the mean the fraction rounds the distance down by one
+inline int flooredDeviation(int value, int lower, int upper) {
+  return value > lower ? value - upper : lower - value;
+}
+
+void scalarFlooredDeviations(const unsigned char *row, int fromX, int toX,
+                             int channels, const std::array<int, 3> &lower,
+                             const std::array<int, 3> &upper,
+                             std::array<long long, 3> &sums) {
+  const unsigned char *pixel = row + fromX * channels;
+  for (int x = fromX; x < toX; ++x, pixel += channels) {
+    for (int channel = 0; channel < 3; ++channel) {
+      sums[channel] +=
+          flooredDeviation(pixel[channel], lower[channel], upper[channel]);
+    }
+  }
+}
+
+void scalarChannelRange(const unsigned char *row, int fromX, int toX,
+                        int channels, ChannelRange &range) {
+  const unsigned char *pixel = row + fromX * channels;
+  for (int x = fromX; x < toX; ++x, pixel += channels) {
+    for (int channel = 0; channel < 3; ++channel) {
+      range.min[channel] = std::min(range.min[channel], pixel[channel]);
+      range.max[channel] = std::max(range.max[channel], pixel[channel]);
+    }
+  }
+}
+
+#ifdef SCAN_KERNELS_X86
+
+// A 3 channel row repeats every 3 vectors, so the vector loops step over
+// `phases` vectors at a time and phase k always sees the same channel at
+// a given byte. The channel of byte q of a step is q % channels whatever
+// the vector width, so one table covers both.
+constexpr int kMaxStepBytes = 3 * 32;
+
+struct ChannelMasks {
+  alignas(32) unsigned char bytes[3][kMaxStepBytes];
+};
+
+ChannelMasks makeChannelMasks(int channels) {
+  ChannelMasks masks = {};
+  for (int c = 0; c < 3; ++c) {
+    for (int q = 0; q < kMaxStepBytes; ++q) {
+      masks.bytes[c][q] = q % channels == c ? 0xFF : 0;
+    }
+  }
+  return masks;
+}
+
+const ChannelMasks &getChannelMasks(int channels) {
+  static const ChannelMasks masks[2] = {makeChannelMasks(3),
+                                        makeChannelMasks(4)};
+  return masks[channels == 4];
+}
+
+SCAN_TARGET_SSE2 std::array<long long, 3>
+sse2FlooredDeviations(const unsigned char *block, size_t rowStride, int width,
+                      int height, int channels,
+                      const std::array<int, 3> &lower,
+                      const std::array<int, 3> &upper) {
+  constexpr int kVectorBytes = 16;
+  const int phases = channels == 3 ? 3 : 1;
+  const int stepBytes = phases * kVectorBytes;
+  const int rowBytes = width * channels;
+  const int vectorBytes = rowBytes - rowBytes % stepBytes;
+  const ChannelMasks &masks = getChannelMasks(channels);
+
+  __m128i channelMask[3][3];
+  __m128i lowerPattern[3];
+  __m128i upperPattern[3];
+  for (int phase = 0; phase < phases; ++phase) {
+    lowerPattern[phase] = upperPattern[phase] = _mm_setzero_si128();
+    for (int c = 0; c < 3; ++c) {
+      channelMask[phase][c] = _mm_load_si128(reinterpret_cast<const __m128i *>(
+          masks.bytes[c] + phase * kVectorBytes));
+      lowerPattern[phase] = _mm_or_si128(
+          lowerPattern[phase],
+          _mm_and_si128(channelMask[phase][c],
+                        _mm_set1_epi8(static_cast<char>(lower[c]))));
+      upperPattern[phase] = _mm_or_si128(
+          upperPattern[phase],
+          _mm_and_si128(channelMask[phase][c],
+                        _mm_set1_epi8(static_cast<char>(upper[c]))));
+    }
+  }
+
+  const __m128i zero = _mm_setzero_si128();
+  __m128i totals[3] = {zero, zero, zero};
+  std::array<long long, 3> sums = {0, 0, 0};
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *row = block + y * rowStride;
+    for (int offset = 0; offset < vectorBytes; offset += stepBytes) {
+      for (int phase = 0; phase < phases; ++phase) {
+        const __m128i values =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                row + offset + phase * kVectorBytes));
+        // at most one of the saturated differences is non-zero
+        const __m128i deviations =
+            _mm_or_si128(_mm_subs_epu8(values, upperPattern[phase]),
+                         _mm_subs_epu8(lowerPattern[phase], values));
+        for (int c = 0; c < 3; ++c) {
+          totals[c] = _mm_add_epi64(
+              totals[c],
+              _mm_sad_epu8(_mm_and_si128(deviations, channelMask[phase][c]),
+                           zero));
+        }
+      }
+    }
+    scalarFlooredDeviations(row, vectorBytes / channels, width, channels,
+                            lower, upper, sums);
+  }
+
+  for (int c = 0; c < 3; ++c) {
+    alignas(16) long long lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), totals[c]);
+    sums[c] += lanes[0] + lanes[1];
+  }
+  return sums;
+}
+
+SCAN_TARGET_AVX2 std::array<long long, 3>
+avx2FlooredDeviations(const unsigned char *block, size_t rowStride, int width,
+                      int height, int channels,
+                      const std::array<int, 3> &lower,
+                      const std::array<int, 3> &upper) {
+  constexpr int kVectorBytes = 32;
+  const int phases = channels == 3 ? 3 : 1;
+  const int stepBytes = phases * kVectorBytes;
+  const int rowBytes = width * channels;
+  const int vectorBytes = rowBytes - rowBytes % stepBytes;
+  const ChannelMasks &masks = getChannelMasks(channels);
+
+  __m256i channelMask[3][3];
+  __m256i lowerPattern[3];
+  __m256i upperPattern[3];
+  for (int phase = 0; phase < phases; ++phase) {
+    lowerPattern[phase] = upperPattern[phase] = _mm256_setzero_si256();
+    for (int c = 0; c < 3; ++c) {
+      channelMask[phase][c] =
+          _mm256_load_si256(reinterpret_cast<const __m256i *>(
+              masks.bytes[c] + phase * kVectorBytes));
+      lowerPattern[phase] = _mm256_or_si256(
+          lowerPattern[phase],
+          _mm256_and_si256(channelMask[phase][c],
+                           _mm256_set1_epi8(static_cast<char>(lower[c]))));
+      upperPattern[phase] = _mm256_or_si256(
+          upperPattern[phase],
+          _mm256_and_si256(channelMask[phase][c],
+                           _mm256_set1_epi8(static_cast<char>(upper[c]))));
+    }
+  }
+
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i totals[3] = {zero, zero, zero};
+  std::array<long long, 3> sums = {0, 0, 0};
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *row = block + y * rowStride;
+    for (int offset = 0; offset < vectorBytes; offset += stepBytes) {
+      for (int phase = 0; phase < phases; ++phase) {
+        const __m256i values =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(
+                row + offset + phase * kVectorBytes));
+        const __m256i deviations =
+            _mm256_or_si256(_mm256_subs_epu8(values, upperPattern[phase]),
+                            _mm256_subs_epu8(lowerPattern[phase], values));
+        for (int c = 0; c < 3; ++c) {
+          totals[c] = _mm256_add_epi64(
+              totals[c],
+              _mm256_sad_epu8(
+                  _mm256_and_si256(deviations, channelMask[phase][c]), zero));
+        }
+      }
+    }
+    scalarFlooredDeviations(row, vectorBytes / channels, width, channels,
+                            lower, upper, sums);
+  }
+
+  for (int c = 0; c < 3; ++c) {
+    alignas(32) long long lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), totals[c]);
+    sums[c] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+  return sums;
+}
+
+SCAN_TARGET_SSE2 ChannelRange sse2ChannelRange(const unsigned char *block,
+                                               size_t rowStride, int width,
+                                               int height, int channels) {
+  constexpr int kVectorBytes = 16;
+  const int phases = channels == 3 ? 3 : 1;
+  const int stepBytes = phases * kVectorBytes;
+  const int rowBytes = width * channels;
+  const int vectorBytes = rowBytes - rowBytes % stepBytes;
+
+  __m128i minimum[3], maximum[3];
+  for (int phase = 0; phase < phases; ++phase) {
+    minimum[phase] = _mm_set1_epi8(static_cast<char>(0xFF));
+    maximum[phase] = _mm_setzero_si128();
+  }
+  ChannelRange range;
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *row = block + y * rowStride;
+    for (int offset = 0; offset < vectorBytes; offset += stepBytes) {
+      for (int phase = 0; phase < phases; ++phase) {
+        const __m128i values =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                row + offset + phase * kVectorBytes));
+        minimum[phase] = _mm_min_epu8(minimum[phase], values);
+        maximum[phase] = _mm_max_epu8(maximum[phase], values);
+      }
+    }
+    scalarChannelRange(row, vectorBytes / channels, width, channels, range);
+  }
+
+  if (vectorBytes > 0) {
+    for (int phase = 0; phase < phases; ++phase) {
+      alignas(16) unsigned char minBytes[kVectorBytes];
+      alignas(16) unsigned char maxBytes[kVectorBytes];
+      _mm_store_si128(reinterpret_cast<__m128i *>(minBytes), minimum[phase]);
+      _mm_store_si128(reinterpret_cast<__m128i *>(maxBytes), maximum[phase]);
+      for (int q = 0; q < kVectorBytes; ++q) {
+        const int c = (phase * kVectorBytes + q) % channels;
+        if (c < 3) {
+          range.min[c] = std::min(range.min[c], minBytes[q]);
+          range.max[c] = std::max(range.max[c], maxBytes[q]);
+        }
+      }
+    }
+  }
+  return range;
+}
+
+SCAN_TARGET_AVX2 ChannelRange avx2ChannelRange(const unsigned char *block,
+                                               size_t rowStride, int width,
+                                               int height, int channels) {
+  constexpr int kVectorBytes = 32;
+  const int phases = channels == 3 ? 3 : 1;
+  const int stepBytes = phases * kVectorBytes;
+  const int rowBytes = width * channels;
+  const int vectorBytes = rowBytes - rowBytes % stepBytes;
+
+  __m256i minimum[3], maximum[3];
+  for (int phase = 0; phase < phases; ++phase) {
+    minimum[phase] = _mm256_set1_epi8(static_cast<char>(0xFF));
+    maximum[phase] = _mm256_setzero_si256();
+  }
+  ChannelRange range;
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *row = block + y * rowStride;
+    for (int offset = 0; offset < vectorBytes; offset += stepBytes) {
+      for (int phase = 0; phase < phases; ++phase) {
+        const __m256i values =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(
+                row + offset + phase * kVectorBytes));
+        minimum[phase] = _mm256_min_epu8(minimum[phase], values);
+        maximum[phase] = _mm256_max_epu8(maximum[phase], values);
+      }
+    }
+    scalarChannelRange(row, vectorBytes / channels, width, channels, range);
+  }
+
+  if (vectorBytes > 0) {
+    for (int phase = 0; phase < phases; ++phase) {
+      alignas(32) unsigned char minBytes[kVectorBytes];
+      alignas(32) unsigned char maxBytes[kVectorBytes];
+      _mm256_store_si256(reinterpret_cast<__m256i *>(minBytes),
+                         minimum[phase]);
+      _mm256_store_si256(reinterpret_cast<__m256i *>(maxBytes),
+                         maximum[phase]);
+      for (int q = 0; q < kVectorBytes; ++q) {
+        const int c = (phase * kVectorBytes + q) % channels;
+        if (c < 3) {
+          range.min[c] = std::min(range.min[c], minBytes[q]);
+          range.max[c] = std::max(range.max[c], maxBytes[q]);
+        }
+      }
+    }
+  }
+  return range;
+}
+
+#endif
+
+// the vector kernels only know the 3 and 4 channel layouts, and rows
+// shorter than one of their steps would only pay for the setup
+InstructionSet pickInstructionSet(InstructionSet set, int width,
+                                  int channels) {
+  if (channels != 3 && channels != 4) {
+    return InstructionSet::Scalar;
+  }
+  set = std::min(set, SatKernels::detectInstructionSet());
+  const int rowBytes = width * channels;
+  const int phases = channels == 3 ? 3 : 1;
+  if (set == InstructionSet::AVX2 && rowBytes < 32 * phases) {
+    set = InstructionSet::SSE2;
+  }
+  if (set == InstructionSet::SSE2 && rowBytes < 16 * phases) {
+    set = InstructionSet::Scalar;
+  }
+  return set;
+}
+
+} // namespace
+
+std::array<long long, 3>
+sumFlooredDeviations(const unsigned char *block, size_t rowStride, int width,
+                     int height, int channels,
+                     const std::array<int, 3> &floorMean,
+                     const std::array<bool, 3> &hasFraction,
+                     InstructionSet set) {
+  std::array<int, 3> upper;
+  for (int c = 0; c < 3; ++c) {
+    upper[c] = floorMean[c] + (hasFraction[c] ? 1 : 0);
+  }
+  switch (pickInstructionSet(set, width, channels)) {
+#ifdef SCAN_KERNELS_X86
+  case InstructionSet::AVX2:
+    return avx2FlooredDeviations(block, rowStride, width, height, channels,
+                                 floorMean, upper);
+  case InstructionSet::SSE2:
+    return sse2FlooredDeviations(block, rowStride, width, height, channels,
+                                 floorMean, upper);
+#endif
+  default:
+    break;
+  }
+  std::array<long long, 3> sums = {0, 0, 0};
+  for (int y = 0; y < height; ++y) {
+    scalarFlooredDeviations(block + y * rowStride, 0, width, channels,
+                            floorMean, upper, sums);
+  }
+  return sums;
+}
+
+ChannelRange findChannelRange(const unsigned char *block, size_t rowStride,
+                              int width, int height, int channels,
+                              InstructionSet set) {
+  switch (pickInstructionSet(set, width, channels)) {
+#ifdef SCAN_KERNELS_X86
+  case InstructionSet::AVX2:
+    return avx2ChannelRange(block, rowStride, width, height, channels);
+  case InstructionSet::SSE2:
+    return sse2ChannelRange(block, rowStride, width, height, channels);
+#endif
+  default:
+    break;
+  }
+  ChannelRange range;
+  for (int y = 0; y < height; ++y) {
+    scalarChannelRange(block + y * rowStride, 0, width, channels, range);
+  }
+  return range;
+}
+
+void addToHistograms(const unsigned char *block, size_t rowStride, int width,
+                     int height, int channels, ChannelHistograms &histograms) {
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *pixel = block + y * rowStride;
+    for (int x = 0; x < width; ++x, pixel += channels) {
+      ++histograms[0][pixel[0]];
+      ++histograms[1][pixel[1]];
+      ++histograms[2][pixel[2]];
+    }
+  }
+}
+
+} // namespace ScanKernels
@@ -0,0 +1,44 @@
+#ifndef SCAN_KERNELS_H
+#define SCAN_KERNELS_H
+
+#include "entropy_pyramid.h"
+#include "minmax_pyramid.h"
+#include "sat_kernels.h"
+#include <array>
+#include <cstddef>
+
+// Block scans of the error methods over row pointers.
+// `block` points at the first channel of the top left pixel and rows are
+// `rowStride` bytes apart. Only the first three channels are read. The 3
+// and 4 channel layouts run 16 (SSE2) or 32 (AVX2) bytes per step, picked
+// at runtime like the summed table kernels; the end of each row and every
+// other layout is scalar.
+
+namespace ScanKernels {
+
+using SatKernels::InstructionSet;
+
+// per channel sum of floor(|value - mean|) over the block, given
+// floorMean = floor(mean) and whether the mean has a fractional part
+std::array<long long, 3>
+sumFlooredDeviations(const unsigned char *block, size_t rowStride, int width,
+                     int height, int channels,
+                     const std::array<int, 3> &floorMean,
+                     const std::array<bool, 3> &hasFraction,
+                     InstructionSet set = SatKernels::detectInstructionSet());
+
+// per channel min/max of the block, which must not be empty
+ChannelRange
+findChannelRange(const unsigned char *block, size_t rowStride, int width,
+                 int height, int channels,
+                 InstructionSet set = SatKernels::detectInstructionSet());
+
+// adds every pixel of the block to the histograms (scatter increments
+// have no vector form worth having, this one only drops the per pixel
+// bounds checks)
+void addToHistograms(const unsigned char *block, size_t rowStride, int width,
+                     int height, int channels, ChannelHistograms &histograms);
+
+} // namespace ScanKernels
+
+#endif
@@ -0,0 +1,110 @@
+#include "summed_table.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <utility>
+
+SummedTable::SummedTable()
+    : mRecords(nullptr), mWidth(0), mHeight(0), mRecordLanes(kLanes),
+      mIsCompact(true) {}
+
+SummedTable::SummedTable(const SummedTable &other) : SummedTable() {
+  *this = other;
+}
+
+SummedTable &SummedTable::operator=(const SummedTable &other) {
+  if (this == &other) {
+    return *this;
+  }
+  if (other.isEmpty()) {
+    clear();
+    return *this;
+  }
+  allocate(other.mWidth, other.mHeight, other.mRecordLanes, other.mIsCompact);
+  std::memcpy(mRecords, other.mRecords, getBytesUsed());
+  return *this;
+}
+
+SummedTable::SummedTable(SummedTable &&other) noexcept : SummedTable() {
+  *this = std::move(other);
+}
+
+SummedTable &SummedTable::operator=(SummedTable &&other) noexcept {
+  if (this == &other) {
+    return *this;
+  }
+  clear();
+  mRecords = other.mRecords;
+  mWidth = other.mWidth;
+  mHeight = other.mHeight;
+  mRecordLanes = other.mRecordLanes;
+  mIsCompact = other.mIsCompact;
+  other.mRecords = nullptr;
+  other.clear();
+  return *this;
+}
+
+SummedTable::~SummedTable() { clear(); }
+
+void SummedTable::clear() {
+  if (mRecords) {
+    ::operator delete(mRecords, std::align_val_t(kAlignment));
+  }
+  mRecords = nullptr;
+  mWidth = 0;
+  mHeight = 0;
+  mRecordLanes = kLanes;
+  mIsCompact = true;
+}
+
+void SummedTable::allocate(int width, int height, int recordLanes,
+                           bool isCompact) {
+  // the size is fixed once the image is loaded, recomputing reuses the
+  // records (every one of them is overwritten)
+  if (mRecords && width == mWidth && height == mHeight &&
+      recordLanes == mRecordLanes && isCompact == mIsCompact) {
+    return;
+  }
+  clear();
+  mWidth = width;
+  mHeight = height;
+  mRecordLanes = recordLanes;
+  mIsCompact = isCompact;
+  mRecords = ::operator new(getBytesUsed(), std::align_val_t(kAlignment));
+}
+
+void SummedTable::compute(const unsigned char *data, int width, int height,
+                          int channels, bool withSquares,
+                          Precision precision) {
+  const bool isCompact =
+      precision != Precision::Wide && width <= kMaxCompactWidth;
+  allocate(width, height, withSquares ? 2 * kLanes : kLanes, isCompact);
+  if (isCompact) {
+    SatKernels::computeSummedTables(data, width, height, channels,
+                                    static_cast<uint32_t *>(mRecords),
+                                    withSquares);
+  } else {
+    SatKernels::computeSummedTables(data, width, height, channels,
+                                    static_cast<long long *>(mRecords),
+                                    withSquares);
+  }
+}
+
+BlockStats SummedTable::getStripedBlockStats(int x, int y, int width,
+                                             int height) const {
+  const long long exactArea =
+      hasSquares() ? kMaxExactSquareArea : kMaxExactSumArea;
+  const int stripeRows =
+      static_cast<int>(std::max(1LL, exactArea / width));
+
+  BlockStats stats;
+  for (int top = y; top < y + height; top += stripeRows) {
+    const int rows = std::min(stripeRows, y + height - top);
+    const BlockStats stripe = blockStats<uint32_t>(x, top, width, rows);
+    for (int channel = 0; channel < 3; ++channel) {
+      stats.sum[channel] += stripe.sum[channel];
+      stats.squareSum[channel] += stripe.squareSum[channel];
+    }
+  }
+  return stats;
+}
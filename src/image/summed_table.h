@@ -0,0 +1,159 @@
+#ifndef SUMMED_TABLE_H
+#define SUMMED_TABLE_H
+
+#include "sat_kernels.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+// sums and square sums of the first three channels over a block, the square
+// sums stay zero when the table doesn't keep them
+struct BlockStats {
+  std::array<long long, 3> sum = {0, 0, 0};
+  std::array<long long, 3> squareSum = {0, 0, 0};
+};
+
+// Summed-area table with the channels of a pixel interleaved.
+// Every pixel owns one record: kLanes channel sums followed, when squares
+// are kept, by kLanes square sums. Records are aligned, so each corner of a
+// block query is a single cache line, and a zero row and column in front of
+// the image make the corner lookups branch free.
+//
+// Records are 32-bit unless the image is wider than kMaxCompactWidth. The
+// entries then wrap around modulo 2^32, but D - B - C + A is still exact
+// for every block whose true sum fits in 32 bits; bigger blocks are summed
+// as horizontal stripes that do fit.
+class SummedTable {
+public:
+  static constexpr int kLanes = SatKernels::kLanes;
+  static constexpr size_t kAlignment = 64;
+
+  // largest block areas whose sums / square sums of bytes fit in 32 bits
+  static constexpr long long kMaxExactSumArea = 0xFFFFFFFFLL / 255;
+  static constexpr long long kMaxExactSquareArea = 0xFFFFFFFFLL / (255 * 255);
+  // a stripe is at least one row, which must be exact on its own
+  static constexpr int kMaxCompactWidth =
+      static_cast<int>(kMaxExactSquareArea);
+
+  enum class Precision { Auto, Compact, Wide };
+
+  SummedTable();
+  SummedTable(const SummedTable &other);
+  SummedTable(SummedTable &&other) noexcept;
+  SummedTable &operator=(const SummedTable &other);
+  SummedTable &operator=(SummedTable &&other) noexcept;
+  ~SummedTable();
+
+  // Precision::Compact is ignored for images wider than kMaxCompactWidth
+  void compute(const unsigned char *data, int width, int height, int channels,
+               bool withSquares, Precision precision = Precision::Auto);
+  void clear();
+
+  bool isEmpty() const { return mRecords == nullptr; }
+  bool hasSquares() const { return mRecordLanes == 2 * kLanes; }
+  bool isCompact() const { return mIsCompact; }
+  size_t getBytesUsed() const {
+    return getRecordCount() * mRecordLanes *
+           (mIsCompact ? sizeof(uint32_t) : sizeof(long long));
+  }
+
+  BlockStats getBlockStats(int x, int y, int width, int height) const {
+    if (!mIsCompact) {
+      return blockStats<long long>(x, y, width, height);
+    }
+    const long long exactArea =
+        hasSquares() ? kMaxExactSquareArea : kMaxExactSumArea;
+    if (static_cast<long long>(width) * height <= exactArea) {
+      return blockStats<uint32_t>(x, y, width, height);
+    }
+    return getStripedBlockStats(x, y, width, height);
+  }
+
+  // starts loading the four corner records of a block query, so a batch of
+  // queries can overlap its cache misses
+  void prefetchBlock(int x, int y, int width, int height) const {
+    if (!mRecords) {
+      return;
+    }
+    const size_t recordBytes =
+        mRecordLanes * (mIsCompact ? sizeof(uint32_t) : sizeof(long long));
+    const char *records = static_cast<const char *>(mRecords);
+    for (int paddedY : {y, y + height}) {
+      for (int paddedX : {x, x + width}) {
+        prefetch(records +
+                 (static_cast<size_t>(paddedY) * (mWidth + 1) + paddedX) *
+                     recordBytes);
+      }
+    }
+  }
+
+  // channel < 3
+  long long getChannelBlockSum(int x, int y, int width, int height,
+                               int channel) const {
+    return getBlockStats(x, y, width, height).sum[channel];
+  }
+  long long getChannelSquareBlockSum(int x, int y, int width, int height,
+                                     int channel) const {
+    return getBlockStats(x, y, width, height).squareSum[channel];
+  }
+
+private:
+  void *mRecords;
+  int mWidth;
+  int mHeight;
+  int mRecordLanes;
+  bool mIsCompact;
+
+  static void prefetch(const void *address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_prefetch(static_cast<const char *>(address), _MM_HINT_T0);
+#else
+    (void)address;
+#endif
+  }
+
+  size_t getRecordCount() const {
+    return static_cast<size_t>(mWidth + 1) * (mHeight + 1);
+  }
+
+  template <typename T> const T *record(int paddedX, int paddedY) const {
+    return static_cast<const T *>(mRecords) +
+           (static_cast<size_t>(paddedY) * (mWidth + 1) + paddedX) *
+               mRecordLanes;
+  }
+
+  // unsigned 32-bit arithmetic wraps, so the corner combination is exact
+  // modulo 2^32 and therefore exact for blocks within the exact areas
+  template <typename T>
+  BlockStats blockStats(int x, int y, int width, int height) const {
+    // a pixel (x, y) lives at record (x + 1, y + 1)
+    const T *a = record<T>(x, y);
+    const T *b = record<T>(x + width, y);
+    const T *c = record<T>(x, y + height);
+    const T *d = record<T>(x + width, y + height);
+
+    BlockStats stats;
+    for (int channel = 0; channel < 3; ++channel) {
+      stats.sum[channel] =
+          static_cast<T>(d[channel] - b[channel] - c[channel] + a[channel]);
+    }
+    if (hasSquares()) {
+      for (int channel = 0; channel < 3; ++channel) {
+        const int lane = kLanes + channel;
+        stats.squareSum[channel] =
+            static_cast<T>(d[lane] - b[lane] - c[lane] + a[lane]);
+      }
+    }
+    return stats;
+  }
+
+  BlockStats getStripedBlockStats(int x, int y, int width, int height) const;
+  void allocate(int width, int height, int recordLanes, bool isCompact);
+};
+
+#endif
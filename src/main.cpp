@@ -1,6 +1,87 @@
+#include "batch/batch_runner.h"
 #include "cli/cli.h"
+#include "codec/qtc_codec.h"
+#include "codec/qtc_progressive.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+// renders a .qtc file, or standard input for "-", saved in the format of the
+// output extension. A progressive stream is decoded level by level as it is
+// read, and one cut short still renders the levels it holds; a corrupt one
+// fails like any other.
+int decode(const std::string &inputPath, const std::string &outputPath) {
+  std::ifstream file;
+  if (inputPath != "-") {
+    file.open(inputPath, std::ios::binary);
+  }
+  std::istream &input = inputPath == "-" ? std::cin : file;
+
+  std::vector<unsigned char> data;
+  QTC::ProgressiveReader reader;
+  bool isProgressive = false;
+  std::vector<char> buffer(1 << 16);
+  while (input) {
+    input.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    const auto *bytes = reinterpret_cast<const unsigned char *>(buffer.data());
+    data.insert(data.end(), bytes, bytes + input.gcount());
+    if (!isProgressive && QTC::isProgressive(data.data(), data.size())) {
+      isProgressive = true;
+    }
+    if (isProgressive) {
+      if (!reader.push(data.data(), data.size())) {
+        break;
+      }
+      data.clear();
+    }
+  }
+
+  Image image(0, 0, 3, std::filesystem::path(outputPath).extension().string());
+  const bool isDecoded =
+      isProgressive ? reader.isValid() && !input.bad() && reader.render(image)
+                    : QTC::decode(data.data(), data.size(), image);
+  if (!isDecoded || !image.save(outputPath)) {
+    std::cerr << "Error: can't decode " << inputPath << std::endl;
+    return 1;
+  }
+  if (isProgressive && !reader.isComplete()) {
+    std::cerr << "Note: " << inputPath << " is incomplete, rendered "
+              << reader.getLevelCount() << " of " << reader.getTotalLevels()
+              << " levels" << std::endl;
+  }
+  return 0;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc == 4 && std::string(argv[1]) == "--decode") {
+    return decode(argv[2], argv[3]);
+  }
+
+  if (argc > 1) {
+    // any argument switches to the headless batch mode
+    std::vector<std::string> args(argv + 1, argv + argc);
+    BatchOptions options;
+    std::string error;
+    if (!BatchRunner::parseArguments(args, options, error)) {
+      std::cerr << "Error: " << error << std::endl
+                << std::endl
+                << BatchRunner::usage();
+      return 1;
+    }
+
+    BatchRunner runner(options);
+    if (!runner.collectInputs(error)) {
+      std::cerr << "Error: " << error << std::endl;
+      return 1;
+    }
+    BatchSummary summary = runner.run();
+    return summary.failed == 0 ? 0 : 1;
+  }
 
-int main() {
   CLI cli;
   cli.run();
   return 0;
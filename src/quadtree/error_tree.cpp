@@ -0,0 +1,166 @@
+#include "error_tree.h"
+#include "linear_quadtree.h"
+#include "utils/thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+
+namespace {
+constexpr double kInfinity = std::numeric_limits<double>::infinity();
+// nodes per task when the errors of a level are evaluated in parallel
+constexpr size_t kEvaluationChunk = 4096;
+} // namespace
+
+ErrorTree::ErrorTree()
+    : mWidth(0), mHeight(0), mMinBlockSize(0), mSplitAlignment(1),
+      mErrorMethod(nullptr), mLowerIsBetter(true) {}
+
+void ErrorTree::clear() {
+  mErrors.clear();
+  mFirstChild.clear();
+  mSortedSplitScores.clear();
+  mLevelMaxScore.clear();
+  mCounters = EvaluationCounters();
+}
+
+void ErrorTree::build(const Image &image, int minBlockSize,
+                      const ErrorMethod *errorMethod, int threadCount) {
+  clear();
+  mWidth = image.getWidth();
+  mHeight = image.getHeight();
+  mMinBlockSize = minBlockSize;
+  mSplitAlignment = image.getSplitAlignment();
+  mErrorMethod = errorMethod;
+  mLowerIsBetter = errorMethod->isLowerErrorBetter();
+
+  std::unique_ptr<ThreadPool> pool;
+  if (threadCount > 1) {
+    pool = std::make_unique<ThreadPool>(threadCount);
+  }
+
+  std::atomic<long long> scannedPixels(0);
+  std::vector<QuadRect> level = {{0, 0, mWidth, mHeight}};
+  std::vector<double> parentScores = {kInfinity};
+  uint32_t nextIndex = 1;
+
+  while (!level.empty()) {
+    const size_t base = mErrors.size();
+    mErrors.resize(base + level.size());
+
+    auto evaluate = [&](size_t begin, size_t end) {
+      const long long scannedBefore = ErrorMethod::scannedPixelCounter();
+      // every node keeps its error, the threshold is not known yet
+      errorMethod->calculateErrors(image, level.data() + begin, end - begin,
+                                   0.0, mErrors.data() + base + begin,
+                                   nullptr);
+      scannedPixels += ErrorMethod::scannedPixelCounter() - scannedBefore;
+    };
+    if (pool && level.size() > kEvaluationChunk) {
+      for (size_t begin = 0; begin < level.size(); begin += kEvaluationChunk) {
+        const size_t end = (std::min)(begin + kEvaluationChunk, level.size());
+        pool->submit([&evaluate, begin, end]() { evaluate(begin, end); });
+      }
+      pool->wait();
+    } else {
+      evaluate(0, level.size());
+    }
+    mCounters.errorEvaluations += level.size();
+
+    std::vector<QuadRect> nextLevel;
+    std::vector<double> nextParentScores;
+    double levelMaxScore = -kInfinity;
+    bool hasDivisibleNode = false;
+
+    for (size_t i = 0; i < level.size(); ++i) {
+      const QuadRect &rect = level[i];
+      const double error = mErrors[base + i];
+      // a NaN error is never acceptable, so such a node always splits
+      const double score =
+          (std::min)(parentScores[i], std::isnan(error) ? kInfinity
+                                                        : orient(error));
+
+      if ((rect.width * rect.height) / 4 >= mMinBlockSize) {
+        mFirstChild.push_back(nextIndex);
+        nextIndex += 4;
+
+        mSortedSplitScores.push_back(score);
+        levelMaxScore = (std::max)(levelMaxScore, score);
+        hasDivisibleNode = true;
+
+        for (int quadrant = 0; quadrant < 4; ++quadrant) {
+          nextLevel.push_back(
+              LinearQuadtree::childRect(rect, quadrant, mSplitAlignment));
+          nextParentScores.push_back(score);
+        }
+      } else {
+        mFirstChild.push_back(NO_CHILDREN);
+      }
+    }
+
+    if (hasDivisibleNode) {
+      mLevelMaxScore.push_back(levelMaxScore);
+    }
+    level.swap(nextLevel);
+    parentScores.swap(nextParentScores);
+  }
+
+  std::sort(mSortedSplitScores.begin(), mSortedSplitScores.end());
+  mCounters.scannedPixels = scannedPixels;
+}
+
+bool ErrorTree::matches(const Image &image, int minBlockSize,
+                        const ErrorMethod *errorMethod) const {
+  return isBuilt() && mWidth == image.getWidth() &&
+         mHeight == image.getHeight() && mMinBlockSize == minBlockSize &&
+         mSplitAlignment == image.getSplitAlignment() &&
+         mErrorMethod == errorMethod;
+}
+
+int ErrorTree::countSplits(double threshold) const {
+  const auto firstSplit =
+      std::upper_bound(mSortedSplitScores.begin(), mSortedSplitScores.end(),
+                       orient(threshold));
+  return static_cast<int>(mSortedSplitScores.end() - firstSplit);
+}
+
+int ErrorTree::getNodeCount(double threshold) const {
+  return 1 + 4 * countSplits(threshold);
+}
+
+int ErrorTree::getLeafCount(double threshold) const {
+  return 1 + 3 * countSplits(threshold);
+}
+
+int ErrorTree::getDepth(double threshold) const {
+  // split scores never grow with depth, so the splitting levels are a prefix
+  const double orientedThreshold = orient(threshold);
+  int splitLevels = 0;
+  while (splitLevels < static_cast<int>(mLevelMaxScore.size()) &&
+         mLevelMaxScore[splitLevels] > orientedThreshold) {
+    ++splitLevels;
+  }
+  return splitLevels + 1;
+}
+
+std::vector<double> ErrorTree::getCandidateThresholds() const {
+  std::vector<double> thresholds;
+  for (auto it = mSortedSplitScores.rbegin(); it != mSortedSplitScores.rend();
+       ++it) {
+    if (std::isinf(*it)) {
+      continue;
+    }
+    if (thresholds.empty() || orient(thresholds.back()) != *it) {
+      thresholds.push_back(orient(*it));
+    }
+  }
+  return thresholds;
+}
+
+size_t ErrorTree::getBytesUsed() const {
+  return mErrors.capacity() * sizeof(double) +
+         mFirstChild.capacity() * sizeof(uint32_t) +
+         mSortedSplitScores.capacity() * sizeof(double) +
+         mLevelMaxScore.capacity() * sizeof(double);
+}
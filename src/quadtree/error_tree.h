@@ -0,0 +1,83 @@
+#ifndef ERROR_TREE_H
+#define ERROR_TREE_H
+
+#include "error_measurement/error_method.h"
+#include "image/image.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Error of every node of the maximal quadtree (every block split down to the
+// minimum block size), evaluated once.
+//
+// The tree a QuadtreeImage builds for any threshold is a cut of this maximal
+// tree, so once it exists a build only compares cached errors against the
+// threshold and never calls ErrorMethod::calculateError again. Node counts
+// and depth for a threshold are answered from sorted split keys without
+// walking the tree at all.
+class ErrorTree {
+public:
+  static constexpr uint32_t NO_CHILDREN = 0;
+
+  ErrorTree();
+
+  void build(const Image &image, int minBlockSize,
+             const ErrorMethod *errorMethod, int threadCount = 1);
+  void clear();
+
+  bool isBuilt() const { return !mErrors.empty(); }
+  bool matches(const Image &image, int minBlockSize,
+               const ErrorMethod *errorMethod) const;
+
+  // nodes are stored breadth-first; the children of a node are contiguous,
+  // in Z-order (top-left, top-right, bottom-left, bottom-right)
+  double getError(uint32_t node) const { return mErrors[node]; }
+  uint32_t getFirstChild(uint32_t node) const { return mFirstChild[node]; }
+  // whether the tree built for `threshold` splits the node
+  bool isSplit(uint32_t node, double threshold) const {
+    return mFirstChild[node] != NO_CHILDREN &&
+           !mErrorMethod->isQualityAcceptable(mErrors[node], threshold);
+  }
+  size_t size() const { return mErrors.size(); }
+
+  // statistics of the tree QuadtreeImage::build() would produce
+  int getNodeCount(double threshold) const;
+  int getLeafCount(double threshold) const;
+  int getDepth(double threshold) const;
+
+  // every threshold at which the cut changes, sorted in the direction of
+  // increasing leaf count
+  std::vector<double> getCandidateThresholds() const;
+
+  int getWidth() const { return mWidth; }
+  int getHeight() const { return mHeight; }
+  int getMinBlockSize() const { return mMinBlockSize; }
+  // split alignment of the image it was built for (see splitOffset)
+  int getSplitAlignment() const { return mSplitAlignment; }
+  size_t getBytesUsed() const;
+  const EvaluationCounters &getCounters() const { return mCounters; }
+
+private:
+  int mWidth;
+  int mHeight;
+  int mMinBlockSize;
+  int mSplitAlignment;
+  const ErrorMethod *mErrorMethod;
+  bool mLowerIsBetter;
+
+  std::vector<double> mErrors;
+  std::vector<uint32_t> mFirstChild;
+
+  // split score of every divisible node: the least "bad" error on its path
+  // from the root, oriented so that the node splits iff score > threshold
+  std::vector<double> mSortedSplitScores;
+  // highest split score among the divisible nodes of each level
+  std::vector<double> mLevelMaxScore;
+
+  EvaluationCounters mCounters;
+
+  double orient(double value) const { return mLowerIsBetter ? value : -value; }
+  int countSplits(double threshold) const;
+};
+
+#endif
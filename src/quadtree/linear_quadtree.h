@@ -0,0 +1,99 @@
+#ifndef LINEAR_QUADTREE_H
+#define LINEAR_QUADTREE_H
+
+#include "image/quad_rect.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Pointerless quadtree: only the leaves are stored, as 64-bit locational
+// codes sorted in Z-order (Morton order).
+//
+// A code is a leading 1 bit followed by two bits per level giving the
+// quadrant taken from the root (bit 0 = right half, bit 1 = bottom half).
+// The leading bit encodes the depth, so a leaf is 8 bytes and its rectangle,
+// parent and children are all derived from the code, the root size and the
+// split alignment.
+class LinearQuadtree {
+public:
+  static constexpr uint64_t ROOT_CODE = 1;
+  static constexpr int MAX_DEPTH = 31;
+
+  LinearQuadtree() : mWidth(0), mHeight(0), mSplitAlignment(1) {}
+
+  void reset(int width, int height, int splitAlignment) {
+    mWidth = width;
+    mHeight = height;
+    mSplitAlignment = splitAlignment;
+    mLeaves.clear();
+  }
+
+  // leaves must be added in Z-order
+  void addLeaf(uint64_t code) { mLeaves.push_back(code); }
+
+  static uint64_t childCode(uint64_t code, int quadrant) {
+    return (code << 2) | static_cast<uint64_t>(quadrant);
+  }
+  static uint64_t ancestorCode(uint64_t code, int depth) {
+    return code >> (2 * (codeDepth(code) - depth));
+  }
+  static int codeDepth(uint64_t code) {
+    int depth = 0;
+    while (code > 1) {
+      code >>= 2;
+      ++depth;
+    }
+    return depth;
+  }
+
+  // same split as QuadtreeNode::divide (see splitOffset)
+  static QuadRect childRect(const QuadRect &rect, int quadrant,
+                            int splitAlignment) {
+    const int halfWidth = splitOffset(rect.width, splitAlignment);
+    const int halfHeight = splitOffset(rect.height, splitAlignment);
+    QuadRect child = rect;
+    if (quadrant & 1) {
+      child.x += halfWidth;
+      child.width -= halfWidth;
+    } else {
+      child.width = halfWidth;
+    }
+    if (quadrant & 2) {
+      child.y += halfHeight;
+      child.height -= halfHeight;
+    } else {
+      child.height = halfHeight;
+    }
+    return child;
+  }
+
+  QuadRect decode(uint64_t code) const {
+    QuadRect rect = {0, 0, mWidth, mHeight};
+    for (int level = codeDepth(code) - 1; level >= 0; --level) {
+      rect = childRect(rect, static_cast<int>((code >> (2 * level)) & 3),
+                       mSplitAlignment);
+    }
+    return rect;
+  }
+
+  template <typename Fn> void forEachLeaf(Fn fn) const {
+    for (uint64_t code : mLeaves) {
+      fn(decode(code));
+    }
+  }
+
+  int getWidth() const { return mWidth; }
+  int getHeight() const { return mHeight; }
+  int getSplitAlignment() const { return mSplitAlignment; }
+  size_t getLeafCount() const { return mLeaves.size(); }
+  const std::vector<uint64_t> &getLeaves() const { return mLeaves; }
+  size_t getBytesUsed() const { return mLeaves.size() * sizeof(uint64_t); }
+
+private:
+  int mWidth;
+  int mHeight;
+  int mSplitAlignment;
+  std::vector<uint64_t> mLeaves;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "node_arena.h"
+#include <iterator>
+
+static_assert(std::is_trivially_destructible<QuadtreeNode>::value,
+              "NodeArena never runs QuadtreeNode destructors");
+
+NodeArena::NodeArena(size_t slabNodes)
+    : mSlabNodes(slabNodes < 4 ? 4 : slabNodes), mCurrentSlab(0) {}
+
+void NodeArena::nextSlab() {
+  // reuse slabs left over from a previous reset() before allocating
+  while (mCurrentSlab < mSlabs.size() &&
+         mSlabs[mCurrentSlab].used == mSlabs[mCurrentSlab].capacity) {
+    ++mCurrentSlab;
+  }
+  if (mCurrentSlab < mSlabs.size()) {
+    return;
+  }
+  mSlabs.push_back(
+      {std::make_unique<NodeStorage[]>(mSlabNodes), mSlabNodes, 0});
+  mCurrentSlab = mSlabs.size() - 1;
+}
+
+void NodeArena::reset() {
+  for (auto &slab : mSlabs) {
+    slab.used = 0;
+  }
+  mCurrentSlab = 0;
+}
+
+void NodeArena::release() {
+  mSlabs.clear();
+  mCurrentSlab = 0;
+}
+
+size_t NodeArena::getNodeCount() const {
+  size_t count = 0;
+  for (const auto &slab : mSlabs) {
+    count += slab.used;
+  }
+  return count;
+}
+
+size_t NodeArena::getBytesReserved() const {
+  size_t bytes = 0;
+  for (const auto &slab : mSlabs) {
+    bytes += slab.capacity * sizeof(QuadtreeNode);
+  }
+  return bytes;
+}
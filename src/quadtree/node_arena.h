@@ -0,0 +1,63 @@
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include "quadtreenode.h"
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Slab allocator for QuadtreeNode.
+// Nodes are carved out of large slabs and never freed one by one: the whole
+// tree is released at once by reset(), which keeps the slabs around so the
+// next build can reuse them without touching the heap.
+class NodeArena {
+public:
+  static constexpr size_t DEFAULT_SLAB_NODES = 1 << 14;
+
+  explicit NodeArena(size_t slabNodes = DEFAULT_SLAB_NODES);
+
+  NodeArena(const NodeArena &) = delete;
+  NodeArena &operator=(const NodeArena &) = delete;
+  NodeArena(NodeArena &&) = default;
+  NodeArena &operator=(NodeArena &&) = default;
+
+  inline QuadtreeNode *create(int x, int y, int width, int height) {
+    if (mCurrentSlab >= mSlabs.size() ||
+        mSlabs[mCurrentSlab].used == mSlabs[mCurrentSlab].capacity) {
+      nextSlab();
+    }
+    Slab &slab = mSlabs[mCurrentSlab];
+    void *address = &slab.storage[slab.used++];
+    return new (address) QuadtreeNode(x, y, width, height);
+  }
+
+  // drops every node in O(1), slabs are kept for reuse
+  void reset();
+  // drops every node and gives the slabs back to the system
+  void release();
+
+  size_t getSlabCount() const { return mSlabs.size(); }
+  size_t getNodeCount() const;
+  size_t getBytesReserved() const;
+  size_t getBytesUsed() const { return getNodeCount() * sizeof(QuadtreeNode); }
+
+private:
+  using NodeStorage =
+      std::aligned_storage_t<sizeof(QuadtreeNode), alignof(QuadtreeNode)>;
+
+  struct Slab {
+    std::unique_ptr<NodeStorage[]> storage;
+    size_t capacity;
+    size_t used;
+  };
+
+  void nextSlab();
+
+  size_t mSlabNodes;
+  std::vector<Slab> mSlabs;
+  size_t mCurrentSlab;
+};
+
+#endif
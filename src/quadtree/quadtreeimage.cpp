@@ -1,63 +1,526 @@
 #include "quadtreeimage.h"
+#include "error_measurement/error_method_factory.h"
+#include "image/color_palette.h"
 // #include "utils/debug.h"
+#include "utils/thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <functional>
 #include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+uint32_t packColor(const std::array<unsigned char, 3> &color) {
+  return color[0] | color[1] << 8 | color[2] << 16;
+}
+
+// the leaf colours, by the pixels they cover, as the palette of the image;
+// more than 256 of them are reduced to a median cut and the pixels painted
+// again with the entry of their colour, unless their alpha would still need
+// more than 256 entries, which no indexed PNG can hold
+void attachPalette(Image &image,
+                   const std::unordered_map<uint32_t, uint64_t> &leafColors) {
+  // sorted, so the palette doesn't depend on the order of the map
+  std::vector<std::pair<uint32_t, uint64_t>> sorted(leafColors.begin(),
+                                                    leafColors.end());
+  std::sort(sorted.begin(), sorted.end());
+  std::vector<ColorPalette::Color> colors;
+  std::vector<uint64_t> weights;
+  for (const auto &[key, weight] : sorted) {
+    colors.push_back({static_cast<unsigned char>(key),
+                      static_cast<unsigned char>(key >> 8),
+                      static_cast<unsigned char>(key >> 16)});
+    weights.push_back(weight);
+  }
+  if (colors.size() <= static_cast<size_t>(ColorPalette::kMaxColors)) {
+    image.setPalette(std::move(colors));
+    return;
+  }
+
+  std::vector<int> indices;
+  std::vector<ColorPalette::Color> palette = ColorPalette::medianCut(
+      colors, weights, ColorPalette::kMaxColors, indices);
+  std::unordered_map<uint32_t, int> entryOf;
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    entryOf.emplace(sorted[i].first, indices[i]);
+  }
+  // every pixel is a leaf colour and runs of one are the rule
+  const int channels = image.getChannels();
+  const size_t pixelCount =
+      static_cast<size_t>(image.getWidth()) * image.getHeight();
+  if (channels == 4) {
+    std::bitset<ColorPalette::kMaxColors * 256> isUsed;
+    size_t usedCount = 0;
+    const unsigned char *pixel = image.getImageData();
+    uint32_t lastKey = 0;
+    int index = -1;
+    for (size_t i = 0; i < pixelCount; ++i, pixel += channels) {
+      const uint32_t key = packColor({pixel[0], pixel[1], pixel[2]});
+      if (index < 0 || key != lastKey) {
+        lastKey = key;
+        index = entryOf.at(key);
+      }
+      const size_t pair = static_cast<size_t>(index) * 256 + pixel[3];
+      if (!isUsed[pair]) {
+        isUsed[pair] = true;
+        if (++usedCount > static_cast<size_t>(ColorPalette::kMaxColors)) {
+          return;
+        }
+      }
+    }
+  }
+  unsigned char *pixel = image.getImageData();
+  uint32_t lastKey = 0;
+  const ColorPalette::Color *entry = nullptr;
+  for (size_t i = 0; i < pixelCount; ++i, pixel += channels) {
+    const uint32_t key = packColor({pixel[0], pixel[1], pixel[2]});
+    if (!entry || key != lastKey) {
+      lastKey = key;
+      entry = &palette[entryOf.at(key)];
+    }
+    pixel[0] = (*entry)[0];
+    pixel[1] = (*entry)[1];
+    pixel[2] = (*entry)[2];
+  }
+  image.setPalette(std::move(palette));
+}
+} // namespace
 
 QuadtreeImage::QuadtreeImage(const Image &image, float threshold,
                              int minBlockSize, ErrorMethod *errorMethod)
     : mImage(image), mThreshold(threshold), mMinBlockSize(minBlockSize),
-      mErrorMethod(errorMethod), mDepth(0), mNodeCount(0), mRoot(nullptr) {}
+      mErrorMethod(errorMethod), mDepth(0), mNodeCount(0), mThreadCount(1),
+      mRepresentation(Representation::Pointer),
+      mPaletteMode(PaletteMode::Exact), mErrorTree(nullptr), mRoot(nullptr) {}
 
 QuadtreeImage::~QuadtreeImage() { clear(); }
 
 bool QuadtreeImage::build() {
   // DEBUG_TIMER("Building tree");
-  mRoot = new QuadtreeNode(0, 0, mImage.getWidth(), mImage.getHeight());
-  std::queue<QuadtreeNode *> nodeQueue;
-  nodeQueue.push(mRoot);
+  clear();
+  mCounters = EvaluationCounters();
+  if (mErrorTree &&
+      mErrorTree->matches(mImage, mMinBlockSize, mErrorMethod)) {
+    buildFromErrorTree();
+    return mRoot != nullptr || mLinearTree.getLeafCount() > 0;
+  }
+
+  // the only runtime dispatch on the method, everything below is
+  // instantiated for its concrete type
+  EMM::dispatch(*mErrorMethod,
+                [this](const auto &method) { buildWith(method); });
+  if (mRepresentation == Representation::Linear) {
+    return mLinearTree.getLeafCount() > 0;
+  }
+  return mRoot != nullptr;
+}
+
+template <typename Method>
+void QuadtreeImage::buildWith(const Method &method) {
+  if (mRepresentation == Representation::Linear) {
+    const long long scannedBefore = ErrorMethod::scannedPixelCounter();
+    buildLinear(method);
+    mCounters.scannedPixels +=
+        ErrorMethod::scannedPixelCounter() - scannedBefore;
+    return;
+  }
+
+  mRoot = mArena.create(0, 0, mImage.getWidth(), mImage.getHeight());
+
+  if (mThreadCount > 1) {
+    buildParallel(method);
+  } else {
+    const long long scannedBefore = ErrorMethod::scannedPixelCounter();
+    int createdNodes = 0;
+    mDepth = buildSubtree(method, mRoot, mArena, createdNodes, mCounters);
+    mNodeCount = 1 + createdNodes;
+    mCounters.scannedPixels +=
+        ErrorMethod::scannedPixelCounter() - scannedBefore;
+  }
+}
+
+bool QuadtreeImage::isDivisible(int width, int height) const {
+  return isDivisible(width, height, mMinBlockSize);
+}
+
+std::array<unsigned char, 3>
+QuadtreeImage::getBlockColor(const QuadRect &rect) const {
+  const long long area = static_cast<long long>(rect.width) * rect.height;
+  // splitting a block one pixel wide or high leaves children without
+  // pixels, there is nothing to paint
+  if (area == 0) {
+    return {0, 0, 0};
+  }
+  const BlockStats stats =
+      mImage.getBlockStats(rect.x, rect.y, rect.width, rect.height);
+  return {static_cast<unsigned char>(stats.sum[0] / area),
+          static_cast<unsigned char>(stats.sum[1] / area),
+          static_cast<unsigned char>(stats.sum[2] / area)};
+}
+
+template <typename Method>
+bool QuadtreeImage::shouldDivide(const Method &method, int x, int y,
+                                 int width, int height,
+                                 EvaluationCounters &counters) const {
+  // a block too small to split is a leaf whatever its error
+  if (!isDivisible(width, height)) {
+    return false;
+  }
+  ++counters.errorEvaluations;
+  return !method.isBlockAcceptable(mImage, x, y, width, height, mThreshold);
+}
+
+template <typename Method>
+void QuadtreeImage::evaluateBatch(const Method &method,
+                                  const std::vector<QuadRect> &rects,
+                                  std::vector<unsigned char> &accepted,
+                                  EvaluationCounters &counters) const {
+  accepted.resize(rects.size());
+  counters.errorEvaluations += rects.size();
+  method.calculateErrors(mImage, rects.data(), rects.size(), mThreshold,
+                         nullptr, accepted.data());
+}
+
+template <typename Method>
+int QuadtreeImage::buildSubtree(const Method &method, QuadtreeNode *root,
+                                NodeArena &arena, int &nodeCount,
+                                EvaluationCounters &counters) const {
+  // breadth first, the divisible blocks of a level are one batch
+  std::vector<QuadtreeNode *> level = {root};
+  std::vector<QuadtreeNode *> nextLevel;
+  std::vector<QuadtreeNode *> candidates;
+  std::vector<QuadRect> rects;
+  std::vector<unsigned char> accepted;
+
+  int levels = 0;
+  while (!level.empty()) {
+    candidates.clear();
+    rects.clear();
+    for (QuadtreeNode *node : level) {
+      if (isDivisible(node->mWidth, node->mHeight)) {
+        candidates.push_back(node);
+        rects.push_back(
+            {node->mPosX, node->mPosY, node->mWidth, node->mHeight});
+      }
+    }
+    evaluateBatch(method, rects, accepted, counters);
+
+    nextLevel.clear();
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      if (accepted[i]) {
+        continue;
+      }
+      QuadtreeNode *currentNode = candidates[i];
+      if (!currentNode->mIsDivided) {
+        currentNode->divide(arena, mImage.getSplitAlignment());
+      }
+
+      for (const auto &child : currentNode->mChildren) {
+        if (child) {
+          ++nodeCount;
+          nextLevel.push_back(child);
+        }
+      }
+    }
+
+    level.swap(nextLevel);
+    levels++;
+  }
+
+  return levels;
+}
+
+template <typename Method>
+void QuadtreeImage::buildParallel(const Method &method) {
+  // the split decision of a node only depends on its own block, so disjoint
+  // subtrees are independent and can be built in any order. large nodes are
+  // evaluated as individual tasks that fork their children, small ones build
+  // their whole subtree serially to keep the task overhead low.
+  std::atomic<int> nodeCount(1);
+  std::atomic<int> maxLevel(0);
+  std::atomic<long long> errorEvaluations(0);
+  std::atomic<long long> scannedPixels(0);
+
+  auto updateMaxLevel = [&maxLevel](int level) {
+    int current = maxLevel.load();
+    while (level > current && !maxLevel.compare_exchange_weak(current, level)) {
+    }
+  };
+
+  ThreadPool pool(mThreadCount);
+  if (mWorkerArenas.size() < static_cast<size_t>(mThreadCount)) {
+    mWorkerArenas.resize(mThreadCount);
+  }
+  std::function<void(QuadtreeNode *, int)> buildTask =
+      [&](QuadtreeNode *node, int level) {
+        NodeArena &arena = mWorkerArenas[ThreadPool::getWorkerIndex()];
+        const long long scannedBefore = ErrorMethod::scannedPixelCounter();
+        EvaluationCounters counters;
+        auto flushCounters = [&]() {
+          errorEvaluations += counters.errorEvaluations;
+          scannedPixels += ErrorMethod::scannedPixelCounter() - scannedBefore;
+        };
+
+        if (node->mWidth * node->mHeight < PARALLEL_GRAIN_AREA) {
+          int createdNodes = 0;
+          const int levels =
+              buildSubtree(method, node, arena, createdNodes, counters);
+          nodeCount += createdNodes;
+          updateMaxLevel(level + levels - 1);
+          flushCounters();
+          return;
+        }
+
+        updateMaxLevel(level);
+        const bool divides =
+            shouldDivide(method, node->mPosX, node->mPosY, node->mWidth,
+                         node->mHeight, counters);
+        flushCounters();
+        if (!divides) {
+          return;
+        }
+        if (!node->mIsDivided) {
+          node->divide(arena, mImage.getSplitAlignment());
+        }
+        for (const auto &child : node->mChildren) {
+          if (child) {
+            ++nodeCount;
+            pool.submit([&buildTask, child, level]() {
+              buildTask(child, level + 1);
+            });
+          }
+        }
+      };
+
+  pool.submit([&buildTask, this]() { buildTask(mRoot, 0); });
+  pool.wait();
+
+  mNodeCount = nodeCount;
+  mDepth = maxLevel + 1;
+  mCounters.errorEvaluations = errorEvaluations;
+  mCounters.scannedPixels = scannedPixels;
+}
+
+template <typename Method>
+void QuadtreeImage::buildLinear(const Method &method) {
+  mLinearTree.reset(mImage.getWidth(), mImage.getHeight(),
+                    mImage.getSplitAlignment());
+
+  // breadth first with one batch per level. every level is kept in Z-order
+  // and splits[depth][i] records whether its i-th block splits, which is
+  // all the depth-first walk below needs to emit the leaves in Z-order
+  std::vector<std::vector<unsigned char>> splits;
+  std::vector<QuadRect> level = {
+      {0, 0, mImage.getWidth(), mImage.getHeight()}};
+  std::vector<QuadRect> nextLevel;
+  std::vector<size_t> candidates;
+  std::vector<QuadRect> rects;
+  std::vector<unsigned char> accepted;
+
+  while (!level.empty()) {
+    const int depth = static_cast<int>(splits.size());
+    splits.emplace_back(level.size(), 0);
+    candidates.clear();
+    rects.clear();
+    if (depth < LinearQuadtree::MAX_DEPTH) {
+      for (size_t i = 0; i < level.size(); ++i) {
+        if (isDivisible(level[i].width, level[i].height)) {
+          candidates.push_back(i);
+          rects.push_back(level[i]);
+        }
+      }
+    }
+    evaluateBatch(method, rects, accepted, mCounters);
+
+    nextLevel.clear();
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      if (accepted[i]) {
+        continue;
+      }
+      splits[depth][candidates[i]] = 1;
+      for (int quadrant = 0; quadrant < 4; ++quadrant) {
+        nextLevel.push_back(LinearQuadtree::childRect(
+            rects[i], quadrant, mImage.getSplitAlignment()));
+      }
+    }
+    level.swap(nextLevel);
+  }
+
+  std::vector<size_t> cursors(splits.size(), 0);
+  addLinearLeaves(splits, cursors, LinearQuadtree::ROOT_CODE, 0);
+
+  // every split turns one leaf into four
+  const int splitCount =
+      static_cast<int>((mLinearTree.getLeafCount() - 1) / 3);
+  mNodeCount = 1 + 4 * splitCount;
+  mDepth = static_cast<int>(splits.size());
+}
+
+void QuadtreeImage::addLinearLeaves(
+    const std::vector<std::vector<unsigned char>> &splits,
+    std::vector<size_t> &cursors, uint64_t code, int depth) {
+  // the walk meets the blocks of each level in the order they were built
+  if (!splits[depth][cursors[depth]++]) {
+    mLinearTree.addLeaf(code);
+    return;
+  }
+  for (int quadrant = 0; quadrant < 4; ++quadrant) {
+    addLinearLeaves(splits, cursors,
+                    LinearQuadtree::childCode(code, quadrant), depth + 1);
+  }
+}
+
+bool QuadtreeImage::cutDivides(uint32_t node) const {
+  return mErrorTree->isSplit(node, mThreshold);
+}
+
+void QuadtreeImage::buildFromErrorTree() {
+  // DEBUG_TIMER("Cutting error tree");
+  if (mRepresentation == Representation::Linear) {
+    mLinearTree.reset(mImage.getWidth(), mImage.getHeight(),
+                      mImage.getSplitAlignment());
+    int maxDepth = 0;
+    cutLinearSubtree({0, 0, mImage.getWidth(), mImage.getHeight()},
+                     LinearQuadtree::ROOT_CODE, 0, 0, maxDepth);
+
+    const int splitCount =
+        static_cast<int>((mLinearTree.getLeafCount() - 1) / 3);
+    mNodeCount = 1 + 4 * splitCount;
+    mDepth = maxDepth + 1;
+    return;
+  }
+
+  // the error tree keeps children in Z-order, QuadtreeNode::divide() starts
+  // with the top-right one
+  static constexpr int kChildQuadrant[4] = {1, 0, 2, 3};
+
+  mRoot = mArena.create(0, 0, mImage.getWidth(), mImage.getHeight());
+  std::queue<std::pair<QuadtreeNode *, uint32_t>> nodeQueue;
+  nodeQueue.push({mRoot, 0});
 
   mNodeCount = 1;
   mDepth = 0;
-
   while (!nodeQueue.empty()) {
     const int nodesThisLevel = nodeQueue.size();
 
     for (int i = 0; i < nodesThisLevel; ++i) {
-      QuadtreeNode *currentNode = nodeQueue.front();
+      auto [currentNode, index] = nodeQueue.front();
       nodeQueue.pop();
 
-      const double nodeError = mErrorMethod->calculateError(
-          mImage, currentNode->mPosX, currentNode->mPosY, currentNode->mWidth,
-          currentNode->mHeight);
+      if (cutDivides(index)) {
+        currentNode->divide(mArena, mImage.getSplitAlignment());
+        const uint32_t firstChild = mErrorTree->getFirstChild(index);
+        for (int c = 0; c < 4; ++c) {
+          ++mNodeCount;
+          nodeQueue.push(
+              {currentNode->mChildren[c], firstChild + kChildQuadrant[c]});
+        }
+      }
+    }
 
-      const bool isQualityAcceptable =
-          mErrorMethod->isQualityAcceptable(nodeError, mThreshold);
+    mDepth++;
+  }
+}
 
-      const bool hasMinimumSizeForDivision =
-          (currentNode->mWidth * currentNode->mHeight) / 4 >= mMinBlockSize;
+void QuadtreeImage::cutLinearSubtree(const QuadRect &rect, uint64_t code,
+                                     uint32_t node, int depth, int &maxDepth) {
+  maxDepth = (std::max)(maxDepth, depth);
+  if (depth >= LinearQuadtree::MAX_DEPTH || !cutDivides(node)) {
+    mLinearTree.addLeaf(code);
+    return;
+  }
 
-      if (!isQualityAcceptable && hasMinimumSizeForDivision) {
-        if (!currentNode->mIsDivided) {
-          currentNode->divide();
-        }
+  const uint32_t firstChild = mErrorTree->getFirstChild(node);
+  for (int quadrant = 0; quadrant < 4; ++quadrant) {
+    cutLinearSubtree(LinearQuadtree::childRect(rect, quadrant,
+                                               mImage.getSplitAlignment()),
+                     LinearQuadtree::childCode(code, quadrant),
+                     firstChild + quadrant, depth + 1, maxDepth);
+  }
+}
 
-        for (const auto &child : currentNode->mChildren) {
-          if (child) {
-            ++mNodeCount;
-            nodeQueue.push(child);
-          }
+std::vector<int> QuadtreeImage::computeNodesPerLevel() const {
+  std::vector<int> nodesPerLevel;
+
+  if (mRepresentation == Representation::Linear || !mRoot) {
+    // the level n nodes are the distinct level n ancestors of the leaves,
+    // which are contiguous in Z-order
+    std::vector<uint64_t> lastAncestor;
+    for (uint64_t code : mLinearTree.getLeaves()) {
+      const int depth = LinearQuadtree::codeDepth(code);
+      if (static_cast<int>(nodesPerLevel.size()) <= depth) {
+        nodesPerLevel.resize(depth + 1, 0);
+        lastAncestor.resize(depth + 1, 0);
+      }
+      for (int level = 0; level <= depth; ++level) {
+        const uint64_t ancestor = LinearQuadtree::ancestorCode(code, level);
+        if (ancestor != lastAncestor[level]) {
+          lastAncestor[level] = ancestor;
+          ++nodesPerLevel[level];
         }
       }
     }
+    return nodesPerLevel;
+  }
 
-    mDepth++;
+  std::queue<QuadtreeNode *> nodeQueue;
+  nodeQueue.push(mRoot);
+  while (!nodeQueue.empty()) {
+    const int nodesThisLevel = nodeQueue.size();
+    nodesPerLevel.push_back(nodesThisLevel);
+
+    for (int i = 0; i < nodesThisLevel; ++i) {
+      QuadtreeNode *current = nodeQueue.front();
+      nodeQueue.pop();
+      for (auto &child : current->mChildren) {
+        if (child != nullptr) {
+          nodeQueue.push(child);
+        }
+      }
+    }
   }
+  return nodesPerLevel;
+}
 
-  return mRoot != nullptr;
+template <int kChannels>
+std::array<unsigned char, 3> QuadtreeImage::paintBlock(Image &target, int x,
+                                                       int y, int w,
+                                                       int h) const {
+  const std::array<unsigned char, 3> color = getBlockColor({x, y, w, h});
+  const auto [avgR, avgG, avgB] = color;
+
+  if constexpr (kChannels == 0) {
+    target.setBlockColorAt(x, y, w, h, avgR, avgG, avgB);
+  } else {
+    // a fixed pixel size lets the fill unroll; the alpha of a 4 channel
+    // target is left as it is
+    const size_t rowStride =
+        static_cast<size_t>(target.getWidth()) * kChannels;
+    unsigned char *row = target.getImageData() + target.getIdxAt(x, y, 0);
+    for (int i = 0; i < h; ++i, row += rowStride) {
+      unsigned char *pixel = row;
+      for (int j = 0; j < w; ++j, pixel += kChannels) {
+        pixel[0] = avgR;
+        pixel[1] = avgG;
+        pixel[2] = avgB;
+      }
+    }
+  }
+  return color;
 }
 
-Image QuadtreeImage::apply() {
-  // DEBUG_TIMER("Applying tree to image");
-  Image resultImage(mImage);
+template <int kChannels, typename OnLeaf>
+void QuadtreeImage::paintLeaves(Image &target, OnLeaf &&onLeaf) const {
+  if (mRepresentation == Representation::Linear) {
+    mLinearTree.forEachLeaf([&](const QuadRect &leaf) {
+      onLeaf(paintBlock<kChannels>(target, leaf.x, leaf.y, leaf.width,
+                                   leaf.height),
+             leaf.width * leaf.height);
+    });
+    return;
+  }
 
   std::queue<QuadtreeNode *> nodeQueue;
   nodeQueue.push(mRoot);
@@ -67,21 +530,9 @@ Image QuadtreeImage::apply() {
     nodeQueue.pop();
 
     if (!current->mIsDivided) {
-      const int area = current->mWidth * current->mHeight;
-      const int x = current->mPosX;
-      const int y = current->mPosY;
-      const int w = current->mWidth;
-      const int h = current->mHeight;
-
-      unsigned char avgR = static_cast<unsigned char>(
-          mImage.getChannelBlockSum(x, y, w, h, 0) / area);
-      unsigned char avgG = static_cast<unsigned char>(
-          mImage.getChannelBlockSum(x, y, w, h, 1) / area);
-      unsigned char avgB = static_cast<unsigned char>(
-          mImage.getChannelBlockSum(x, y, w, h, 2) / area);
-
-      resultImage.setBlockColorAt(x, y, w, h, avgR, avgG, avgB);
-
+      onLeaf(paintBlock<kChannels>(target, current->mPosX, current->mPosY,
+                                   current->mWidth, current->mHeight),
+             current->mWidth * current->mHeight);
     } else {
       for (auto &child : current->mChildren) {
         if (child != nullptr) {
@@ -90,18 +541,45 @@ Image QuadtreeImage::apply() {
       }
     }
   }
+}
 
-  // preserve the alpha channel for png
-  // (setBlockColorAt use some optimization to apply color faster but not
-  // maintaining the alpha channel)
-  if (resultImage.getChannels() == 4) {
-    for (int y = 0; y < resultImage.getHeight(); y++) {
-      for (int x = 0; x < resultImage.getWidth(); x++) {
-        resultImage.setAlphaAt(x, y, mImage.getAlphaAt(x, y));
-      }
+Image QuadtreeImage::apply() {
+  // DEBUG_TIMER("Applying tree to image");
+  Image resultImage(mImage);
+
+  // leaf colours by the pixels they cover, kept while they can still make
+  // a palette
+  std::unordered_map<uint32_t, uint64_t> leafColors;
+  bool hasPalette =
+      mPaletteMode != PaletteMode::Off && resultImage.getChannels() >= 3;
+  auto onLeaf = [&](const std::array<unsigned char, 3> &color, int area) {
+    if (!hasPalette || area == 0) {
+      return;
+    }
+    leafColors[packColor(color)] += area;
+    if (mPaletteMode == PaletteMode::Exact &&
+        leafColors.size() > static_cast<size_t>(ColorPalette::kMaxColors)) {
+      hasPalette = false;
     }
+  };
+
+  // the copy already holds the source alpha, which the specialized fills
+  // keep, so a png keeps its transparency
+  switch (resultImage.getChannels()) {
+  case 3:
+    paintLeaves<3>(resultImage, onLeaf);
+    break;
+  case 4:
+    paintLeaves<4>(resultImage, onLeaf);
+    break;
+  default:
+    paintLeaves<0>(resultImage, onLeaf);
+    break;
   }
 
+  if (hasPalette) {
+    attachPalette(resultImage, leafColors);
+  }
   return resultImage;
 }
 
@@ -110,6 +588,31 @@ ImageSequence QuadtreeImage::applyAnimation() {
   ImageSequence resultSequence;
   Image tempImage(mImage);
 
+  if (mRepresentation == Representation::Linear) {
+    // frame n paints every node of level n, which are the level n ancestors
+    // of the leaves at depth >= n. in Z-order the leaves sharing an ancestor
+    // are contiguous, so each ancestor is painted once.
+    const std::vector<uint64_t> &leaves = mLinearTree.getLeaves();
+    for (int level = 0; level < mDepth; ++level) {
+      uint64_t lastAncestor = 0;
+      for (uint64_t code : leaves) {
+        if (LinearQuadtree::codeDepth(code) < level) {
+          continue;
+        }
+        const uint64_t ancestor = LinearQuadtree::ancestorCode(code, level);
+        if (ancestor == lastAncestor) {
+          continue;
+        }
+        lastAncestor = ancestor;
+
+        const QuadRect rect = mLinearTree.decode(ancestor);
+        paintBlock<0>(tempImage, rect.x, rect.y, rect.width, rect.height);
+      }
+      resultSequence.addImage(tempImage, DEFAULT_SEQUENCE_DELAY);
+    }
+    return resultSequence;
+  }
+
   std::queue<QuadtreeNode *> nodeQueue;
   nodeQueue.push(mRoot);
 
@@ -120,20 +623,8 @@ ImageSequence QuadtreeImage::applyAnimation() {
       QuadtreeNode *current = nodeQueue.front();
       nodeQueue.pop();
 
-      const int area = current->mWidth * current->mHeight;
-      const int x = current->mPosX;
-      const int y = current->mPosY;
-      const int w = current->mWidth;
-      const int h = current->mHeight;
-
-      unsigned char avgR = static_cast<unsigned char>(
-          mImage.getChannelBlockSum(x, y, w, h, 0) / area);
-      unsigned char avgG = static_cast<unsigned char>(
-          mImage.getChannelBlockSum(x, y, w, h, 1) / area);
-      unsigned char avgB = static_cast<unsigned char>(
-          mImage.getChannelBlockSum(x, y, w, h, 2) / area);
-
-      tempImage.setBlockColorAt(x, y, w, h, avgR, avgG, avgB);
+      paintBlock<0>(tempImage, current->mPosX, current->mPosY,
+                    current->mWidth, current->mHeight);
 
       for (auto &child : current->mChildren) {
         if (child != nullptr) {
@@ -148,8 +639,37 @@ ImageSequence QuadtreeImage::applyAnimation() {
 }
 
 void QuadtreeImage::clear() {
-  if (mRoot) {
-    delete mRoot;
-    mRoot = nullptr;
+  // the nodes live in the arenas, so the whole tree is dropped at once. The
+  // next build may spread its nodes over the workers differently, slabs
+  // kept per worker would pile up, so theirs are given back
+  mArena.reset();
+  for (NodeArena &arena : mWorkerArenas) {
+    arena.release();
+  }
+  mRoot = nullptr;
+  mLinearTree.reset(0, 0, 1);
+}
+
+size_t QuadtreeImage::getArenaSlabCount() const {
+  size_t count = mArena.getSlabCount();
+  for (const NodeArena &arena : mWorkerArenas) {
+    count += arena.getSlabCount();
+  }
+  return count;
+}
+
+size_t QuadtreeImage::getArenaBytesReserved() const {
+  size_t bytes = mArena.getBytesReserved();
+  for (const NodeArena &arena : mWorkerArenas) {
+    bytes += arena.getBytesReserved();
+  }
+  return bytes;
+}
+
+size_t QuadtreeImage::getArenaBytesUsed() const {
+  size_t bytes = mArena.getBytesUsed();
+  for (const NodeArena &arena : mWorkerArenas) {
+    bytes += arena.getBytesUsed();
   }
+  return bytes;
 }
@@ -2,11 +2,30 @@
 #define QUADTREEIMAGE_H
 
 #include "error_measurement/error_method.h"
+#include "error_tree.h"
 #include "image/image.h"
 #include "image/image_sequence.h"
+#include "linear_quadtree.h"
+#include "node_arena.h"
 #include "quadtreenode.h"
+#include <array>
+#include <vector>
+
+class ThreadPool;
 
 class QuadtreeImage {
+public:
+  // Pointer: QuadtreeNode tree, needed by getRoot()
+  // Linear: leaves only, as Z-ordered locational codes (see LinearQuadtree)
+  enum class Representation { Pointer, Linear };
+  // what apply() tells the output image about its colours, one per leaf:
+  // Off nothing, Exact the leaf colours when there are at most 256 of them,
+  // Quantize the same, and otherwise repaints the leaves with a median cut
+  // of their colours down to 256 (lossy); the PNG is saved indexed only if
+  // its (colour, alpha) pairs fit in 256 entries, so varying alpha can keep
+  // it truecolour, and then quantizing leaves the leaves as they are
+  enum class PaletteMode { Off, Exact, Quantize };
+
 private:
   const Image &mImage;
   float mThreshold;
@@ -15,10 +34,57 @@ private:
 
   int mDepth;
   int mNodeCount;
+  int mThreadCount;
+  Representation mRepresentation;
+  PaletteMode mPaletteMode;
+  const ErrorTree *mErrorTree;
 
   QuadtreeNode *mRoot;
+  NodeArena mArena;
+  // one per build thread so allocation needs no locking, they hold the
+  // nodes of a parallel build until clear()
+  std::vector<NodeArena> mWorkerArenas;
+  LinearQuadtree mLinearTree;
+  EvaluationCounters mCounters;
 
   static constexpr int DEFAULT_SEQUENCE_DELAY = 70;
+  // subtrees with a smaller area are built serially by a single task
+  static constexpr int PARALLEL_GRAIN_AREA = 64 * 64;
+
+  // whether the block is large enough to be split
+  bool isDivisible(int width, int height) const;
+  // the build loops are instantiated per concrete error method (see
+  // EMM::dispatch), so the per node calls are resolved at compile time
+  template <typename Method>
+  bool shouldDivide(const Method &method, int x, int y, int width,
+                    int height, EvaluationCounters &counters) const;
+  // accepted[i] is whether rects[i] meets the threshold, the whole span is
+  // handed to ErrorMethod::calculateErrors at once
+  template <typename Method>
+  void evaluateBatch(const Method &method, const std::vector<QuadRect> &rects,
+                     std::vector<unsigned char> &accepted,
+                     EvaluationCounters &counters) const;
+  template <typename Method>
+  int buildSubtree(const Method &method, QuadtreeNode *root, NodeArena &arena,
+                   int &nodeCount, EvaluationCounters &counters) const;
+  template <typename Method> void buildParallel(const Method &method);
+  template <typename Method> void buildLinear(const Method &method);
+  void addLinearLeaves(const std::vector<std::vector<unsigned char>> &splits,
+                       std::vector<size_t> &cursors, uint64_t code,
+                       int depth);
+  template <typename Method> void buildWith(const Method &method);
+  bool cutDivides(uint32_t node) const;
+  void buildFromErrorTree();
+  void cutLinearSubtree(const QuadRect &rect, uint64_t code, uint32_t node,
+                        int depth, int &maxDepth);
+  // kChannels is the pixel size of the target, 0 when only known at
+  // runtime; returns the colour painted
+  template <int kChannels>
+  std::array<unsigned char, 3> paintBlock(Image &target, int x, int y,
+                                          int width, int height) const;
+  // onLeaf(colour, area) is called for every leaf painted
+  template <int kChannels, typename OnLeaf>
+  void paintLeaves(Image &target, OnLeaf &&onLeaf) const;
 
 public:
   QuadtreeImage(const Image &image, float threshold, int minBlockSize,
@@ -32,9 +98,46 @@ public:
 
   void clear();
 
+  // number of worker threads used by build(), 1 means serial build
+  void setThreadCount(int threadCount) {
+    mThreadCount = threadCount < 1 ? 1 : threadCount;
+  }
+
+  void setRepresentation(Representation representation) {
+    mRepresentation = representation;
+  }
+
+  void setPaletteMode(PaletteMode paletteMode) { mPaletteMode = paletteMode; }
+
+  // use the cached errors of a maximal tree instead of evaluating blocks.
+  // ignored unless it was built for the same image size, split alignment,
+  // minimum block size and error method
+  void setErrorTree(const ErrorTree *errorTree) { mErrorTree = errorTree; }
+
+  // whether a block is large enough to be split, the rule every build and
+  // the .qtc codec follow
+  static bool isDivisible(int width, int height, int minBlockSize) {
+    return (width * height) / 4 >= minBlockSize;
+  }
+  // the colour apply() paints a leaf with, the block average
+  std::array<unsigned char, 3> getBlockColor(const QuadRect &rect) const;
+
+  const Image &getImage() const { return mImage; }
+  int getMinBlockSize() const { return mMinBlockSize; }
   int getDepth() const { return mDepth; }
   int getNodeCount() const { return mNodeCount; }
+  int getThreadCount() const { return mThreadCount; }
+  Representation getRepresentation() const { return mRepresentation; }
+  PaletteMode getPaletteMode() const { return mPaletteMode; }
   QuadtreeNode *getRoot() const { return mRoot; }
+  // over the arena of the build thread and those of the workers
+  size_t getArenaSlabCount() const;
+  size_t getArenaBytesReserved() const;
+  size_t getArenaBytesUsed() const;
+  const LinearQuadtree &getLinearTree() const { return mLinearTree; }
+  // calculateError calls and pixels scanned by the last build()
+  const EvaluationCounters &getCounters() const { return mCounters; }
+  std::vector<int> computeNodesPerLevel() const;
 };
 
 #endif
@@ -1,4 +1,6 @@
 #include "quadtreenode.h"
+#include "image/quad_rect.h"
+#include "node_arena.h"
 
 QuadtreeNode::QuadtreeNode(int x, int y, int width, int height)
     : mPosX(x), mPosY(y), mWidth(width), mHeight(height), mIsDivided(false) {
@@ -6,9 +8,23 @@ QuadtreeNode::QuadtreeNode(int x, int y, int width, int height)
     child = nullptr;
 }
 
-QuadtreeNode::~QuadtreeNode() {
-  for (auto child : mChildren) {
-    if (child != nullptr)
-      delete child;
+void QuadtreeNode::divide(NodeArena &arena, int splitAlignment) {
+  if (mIsDivided) {
+    return;
   }
+
+  int halfWidth = splitOffset(mWidth, splitAlignment);
+  int halfHeight = splitOffset(mHeight, splitAlignment);
+  // first quadrant
+  mChildren[0] =
+      arena.create(mPosX + halfWidth, mPosY, mWidth - halfWidth, halfHeight);
+  // second quadrant
+  mChildren[1] = arena.create(mPosX, mPosY, halfWidth, halfHeight);
+  // third quadran
+  mChildren[2] =
+      arena.create(mPosX, mPosY + halfHeight, halfWidth, mHeight - halfHeight);
+  // fourth quadran
+  mChildren[3] = arena.create(mPosX + halfWidth, mPosY + halfHeight,
+                              mWidth - halfWidth, mHeight - halfHeight);
+  mIsDivided = true;
 }
@@ -3,6 +3,8 @@
 
 #include <cassert>
 
+class NodeArena;
+
 class QuadtreeNode {
 public:
   int mPosX;
@@ -15,32 +17,14 @@ public:
 
   QuadtreeNode *mChildren[4];
 
+  // nodes are owned by a NodeArena, which frees the whole tree at once
   QuadtreeNode(int x, int y, int width, int height);
-  ~QuadtreeNode();
 
   QuadtreeNode(const QuadtreeNode &) = delete;
   QuadtreeNode &operator=(const QuadtreeNode &) = delete;
 
-  inline void divide() {
-    if (mIsDivided) {
-      return;
-    }
-
-    int halfWidth = mWidth / 2;
-    int halfHeight = mHeight / 2;
-    // first quadrant
-    mChildren[0] = new QuadtreeNode(mPosX + halfWidth, mPosY,
-                                    mWidth - halfWidth, halfHeight);
-    // second quadrant
-    mChildren[1] = new QuadtreeNode(mPosX, mPosY, halfWidth, halfHeight);
-    // third quadran
-    mChildren[2] = new QuadtreeNode(mPosX, mPosY + halfHeight, halfWidth,
-                                    mHeight - halfHeight);
-    // fourth quadran
-    mChildren[3] = new QuadtreeNode(mPosX + halfWidth, mPosY + halfHeight,
-                                    mWidth - halfWidth, mHeight - halfHeight);
-    mIsDivided = true;
-  }
+  // split on the given alignment, see splitOffset
+  void divide(NodeArena &arena, int splitAlignment);
 };
 
 #endif
@@ -0,0 +1,192 @@
+#include "size_predictor.h"
+#include "linear_quadtree.h"
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+namespace {
+
+// shorter images are encoded whole, a band would be most of them
+constexpr int kMinSampledHeight = 4 * SizePredictor::kBandHeight;
+
+// raw prediction errors measured against the encoders on photographs and
+// screenshots, before any calibration; BMP rows encode to a fixed size
+SizePredictor::ErrorBounds getFormatBounds(const std::string &fileExt) {
+  if (fileExt == ".png" || fileExt == ".jpg" || fileExt == ".jpeg") {
+    return {-0.15, 0.15};
+  }
+  if (fileExt == ".bmp") {
+    return {-0.01, 0.01};
+  }
+  return {-0.25, 0.25};
+}
+
+} // namespace
+
+SizePredictor::SizePredictor(const Image &image, const ErrorTree &errorTree)
+    : mImage(image), mErrorTree(errorTree), mIsSampled(false),
+      mHeaderSize(0), mEncodeCount(0), mBytesEncoded(0) {
+  const int width = image.getWidth();
+  const int height = image.getHeight();
+  if (height < kMinSampledHeight) {
+    mBands.push_back({0, 0, width, height});
+    return;
+  }
+
+  mIsSampled = true;
+  const int bandCount = (std::min)(
+      kBandCount, (std::max)(1, height / (kSampleShare * kBandHeight)));
+  for (int band = 0; band < bandCount; ++band) {
+    const int center = static_cast<int>((2LL * band + 1) * height /
+                                        (2 * bandCount));
+    int top = center - kBandHeight / 2;
+    top -= top % Image::kJpegMcuSize;
+    mBands.push_back({0, top, width, kBandHeight});
+  }
+  // a single pixel is all header
+  mHeaderSize =
+      Image(1, 1, image.getChannels(), image.getFileExt()).estimateFileSize();
+}
+
+int SizePredictor::getSampledRows() const {
+  int rows = 0;
+  for (const QuadRect &band : mBands) {
+    rows += band.height;
+  }
+  return rows;
+}
+
+long long SizePredictor::predictRaw(double threshold) {
+  // QuadtreeImage keeps its threshold as a float
+  const float buildThreshold = static_cast<float>(threshold);
+  const auto cached = mRawSizes.find(buildThreshold);
+  if (cached != mRawSizes.end()) {
+    return cached->second;
+  }
+  const QuadRect root = {0, 0, mImage.getWidth(), mImage.getHeight()};
+
+  long long payload = 0;
+  for (const QuadRect &bandRect : mBands) {
+    Image band =
+        mImage.crop(bandRect.x, bandRect.y, bandRect.width, bandRect.height);
+    paintBand(band, bandRect, 0, root, buildThreshold);
+    payload += band.estimateFileSize() - mHeaderSize;
+  }
+  long long rawSize = payload;
+  if (mIsSampled) {
+    rawSize = mHeaderSize + std::llround(static_cast<double>(payload) *
+                                         mImage.getHeight() / getSampledRows());
+  } else {
+    ++mEncodeCount;
+    mBytesEncoded += static_cast<size_t>(payload);
+  }
+  mRawSizes.emplace(buildThreshold, rawSize);
+  return rawSize;
+}
+
+void SizePredictor::paintBand(Image &band, const QuadRect &bandRect,
+                              uint32_t node, const QuadRect &rect,
+                              float threshold) const {
+  const int top = (std::max)(rect.y, bandRect.y);
+  const int bottom =
+      (std::min)(rect.y + rect.height, bandRect.y + bandRect.height);
+  if (top >= bottom || rect.width <= 0) {
+    return;
+  }
+
+  if (mErrorTree.isSplit(node, threshold)) {
+    const uint32_t firstChild = mErrorTree.getFirstChild(node);
+    for (int quadrant = 0; quadrant < 4; ++quadrant) {
+      paintBand(band, bandRect, firstChild + quadrant,
+                LinearQuadtree::childRect(rect, quadrant,
+                                          mErrorTree.getSplitAlignment()),
+                threshold);
+    }
+    return;
+  }
+
+  // the leaf colour QuadtreeImage paints, over the rows inside the band;
+  // like QuadtreeImage::paintBlock it leaves the alpha of the source
+  const int area = rect.width * rect.height;
+  const BlockStats stats =
+      mImage.getBlockStats(rect.x, rect.y, rect.width, rect.height);
+  const unsigned char color[3] = {
+      static_cast<unsigned char>(stats.sum[0] / area),
+      static_cast<unsigned char>(stats.sum[1] / area),
+      static_cast<unsigned char>(stats.sum[2] / area)};
+  const int channels = band.getChannels();
+  const size_t rowStride = static_cast<size_t>(band.getWidth()) * channels;
+  unsigned char *row =
+      band.getImageData() + band.getIdxAt(rect.x, top - bandRect.y, 0);
+  for (int y = top; y < bottom; ++y, row += rowStride) {
+    unsigned char *pixel = row;
+    for (int x = 0; x < rect.width; ++x, pixel += channels) {
+      pixel[0] = color[0];
+      pixel[1] = color[1];
+      pixel[2] = color[2];
+    }
+  }
+}
+
+double SizePredictor::getRatio(long long rawSize) const {
+  if (mCalibrations.empty()) {
+    return 1.0;
+  }
+  if (rawSize <= mCalibrations.front().rawSize) {
+    return mCalibrations.front().ratio;
+  }
+  if (rawSize >= mCalibrations.back().rawSize) {
+    return mCalibrations.back().ratio;
+  }
+  const auto upper = std::upper_bound(
+      mCalibrations.begin(), mCalibrations.end(), rawSize,
+      [](long long size, const Calibration &calibration) {
+        return size < calibration.rawSize;
+      });
+  const Calibration &lower = *(upper - 1);
+  const double t = static_cast<double>(rawSize - lower.rawSize) /
+                   (upper->rawSize - lower.rawSize);
+  return lower.ratio + t * (upper->ratio - lower.ratio);
+}
+
+long long SizePredictor::predict(double threshold) {
+  const long long rawSize = predictRaw(threshold);
+  return std::llround(rawSize * getRatio(rawSize));
+}
+
+void SizePredictor::calibrate(double threshold, long long encodedSize) {
+  const long long rawSize = predictRaw(threshold);
+  if (rawSize <= 0) {
+    return;
+  }
+  const Calibration calibration = {
+      rawSize, static_cast<double>(encodedSize) / rawSize};
+  auto position = std::lower_bound(
+      mCalibrations.begin(), mCalibrations.end(), rawSize,
+      [](const Calibration &existing, long long size) {
+        return existing.rawSize < size;
+      });
+  if (position != mCalibrations.end() && position->rawSize == rawSize) {
+    *position = calibration;
+  } else {
+    mCalibrations.insert(position, calibration);
+  }
+}
+
+SizePredictor::ErrorBounds SizePredictor::getErrorBounds() const {
+  if (!mIsSampled) {
+    return {0.0, 0.0};
+  }
+  if (mCalibrations.size() < 2) {
+    return getFormatBounds(mImage.getFileExt());
+  }
+  // how far apart the calibrated corrections are is how far off a
+  // correction interpolated between them can be
+  double minRatio = mCalibrations.front().ratio;
+  double maxRatio = minRatio;
+  for (const Calibration &calibration : mCalibrations) {
+    minRatio = (std::min)(minRatio, calibration.ratio);
+    maxRatio = (std::max)(maxRatio, calibration.ratio);
+  }
+  return {minRatio / maxRatio - 1.0, maxRatio / minRatio - 1.0};
+}
@@ -0,0 +1,81 @@
+#ifndef SIZE_PREDICTOR_H
+#define SIZE_PREDICTOR_H
+
+#include "error_tree.h"
+#include "image/image.h"
+#include "image/quad_rect.h"
+#include <unordered_map>
+#include <vector>
+
+// Predicts the encoded size of the image QuadtreeImage would produce for a
+// threshold, from the cut of an ErrorTree, without painting or encoding the
+// whole image.
+//
+// Only evenly spaced bands of kBandHeight rows are painted and encoded, each
+// as an image of its own, and their payload (the encoded size past the fixed
+// header of the format) is scaled to the image height. There is a band per
+// kSampleShare bands of the image, at least one and at most kBandCount, so a
+// prediction costs a small share of an encode whatever the image size. Bands
+// start on a multiple of 16 rows so the JPEG MCUs line up with the full
+// encode. Images too short for a band are encoded whole, those encodes are
+// counted by getEncodeCount(). Raw predictions are cached per threshold.
+//
+// Sampling misses the rows between bands and each band restarts the
+// encoder state, so the raw prediction carries a bias of its own per image
+// and format. Every real encode fed to calibrate() records the ratio of the
+// real size to the raw prediction; predictions are scaled by that ratio,
+// interpolated between the calibrated sizes.
+class SizePredictor {
+public:
+  static constexpr int kBandCount = 8;
+  static constexpr int kBandHeight = 16;
+  static constexpr int kSampleShare = 16;
+
+  // relative error of a prediction: the real size is expected between
+  // predicted * (1 + lower) and predicted * (1 + upper)
+  struct ErrorBounds {
+    double lower;
+    double upper;
+  };
+
+  SizePredictor(const Image &image, const ErrorTree &errorTree);
+
+  long long predict(double threshold);
+  // the real encoded size of the cut at `threshold`
+  void calibrate(double threshold, long long encodedSize);
+
+  // measured on the calibrated cuts once there are two of them, before that
+  // the bounds of the format measured against the encoders on photographs
+  ErrorBounds getErrorBounds() const;
+  bool isSampled() const { return mIsSampled; }
+  int getSampledRows() const;
+  // whole images encoded by predictions of an image too short to sample,
+  // and the bytes they came to
+  int getEncodeCount() const { return mEncodeCount; }
+  size_t getBytesEncoded() const { return mBytesEncoded; }
+
+private:
+  struct Calibration {
+    long long rawSize;
+    double ratio;
+  };
+
+  const Image &mImage;
+  const ErrorTree &mErrorTree;
+  std::vector<QuadRect> mBands;
+  bool mIsSampled;
+  long long mHeaderSize;
+  // sorted by raw size
+  std::vector<Calibration> mCalibrations;
+  // by the float threshold the cut is taken at
+  std::unordered_map<float, long long> mRawSizes;
+  int mEncodeCount;
+  size_t mBytesEncoded;
+
+  long long predictRaw(double threshold);
+  double getRatio(long long rawSize) const;
+  void paintBand(Image &band, const QuadRect &bandRect, uint32_t node,
+                 const QuadRect &rect, float threshold) const;
+};
+
+#endif
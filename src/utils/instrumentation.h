@@ -0,0 +1,137 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+
+#ifdef _WIN32
+// ThreadPool brings this header into most of the sources, keep windows.h
+// from defining min and max
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// CPU time consumed by the calling thread so far, in milliseconds
+inline double threadCpuTimeMs() {
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel,
+                      &user)) {
+    return 0.0;
+  }
+  auto toMs = [](const FILETIME &time) {
+    ULARGE_INTEGER value;
+    value.LowPart = time.dwLowDateTime;
+    value.HighPart = time.dwHighDateTime;
+    return static_cast<double>(value.QuadPart) / 10000.0; // 100 ns ticks
+  };
+  return toMs(kernel) + toMs(user);
+#else
+  timespec time;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0) {
+    return 0.0;
+  }
+  return 1000.0 * time.tv_sec + time.tv_nsec / 1e6;
+#endif
+}
+
+// CPU time of one job, such as an image of a batch, apart from the jobs
+// running alongside it. The thread that entered the account reads its own
+// clock, the workers of every ThreadPool created under the account, from
+// that thread or from inside their tasks, add the time of each task.
+class CpuAccount {
+public:
+  CpuAccount() : mPooledUs(0) {}
+
+  CpuAccount(const CpuAccount &) = delete;
+  CpuAccount &operator=(const CpuAccount &) = delete;
+
+  // the account the calling thread works for, null outside of any
+  static CpuAccount *current() { return tCurrent; }
+
+  // makes an account the current one of the calling thread while it lives
+  class Scope {
+  public:
+    explicit Scope(CpuAccount *account) : mPrevious(tCurrent) {
+      tCurrent = account;
+    }
+    ~Scope() { tCurrent = mPrevious; }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    CpuAccount *mPrevious;
+  };
+
+  void addPooledMs(double ms) {
+    mPooledUs += static_cast<long long>(ms * 1000.0);
+  }
+  // the time of the calling thread and of every pool worker so far
+  double getCpuMs() const { return threadCpuTimeMs() + mPooledUs / 1000.0; }
+
+private:
+  std::atomic<long long> mPooledUs;
+
+  static inline thread_local CpuAccount *tCurrent = nullptr;
+};
+
+// peak resident memory of the whole process so far, in bytes; every job
+// of a batch shares it
+inline size_t peakResidentBytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                            sizeof(counters))) {
+    return 0;
+  }
+  return counters.PeakWorkingSetSize;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return static_cast<size_t>(usage.ru_maxrss); // bytes on macOS
+#else
+  return static_cast<size_t>(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+#endif
+}
+
+// wall time and CPU time of the current CpuAccount, or of the calling
+// thread alone outside of any, since construction or the last restart()
+class StageStopwatch {
+public:
+  StageStopwatch() { restart(); }
+
+  void restart() {
+    mWallStart = std::chrono::steady_clock::now();
+    mCpuStart = cpuTimeMs();
+  }
+
+  double wallMs() const {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - mWallStart)
+        .count();
+  }
+  double cpuMs() const { return cpuTimeMs() - mCpuStart; }
+
+private:
+  static double cpuTimeMs() {
+    const CpuAccount *account = CpuAccount::current();
+    return account ? account->getCpuMs() : threadCpuTimeMs();
+  }
+
+  std::chrono::steady_clock::time_point mWallStart;
+  double mCpuStart;
+};
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "instrumentation.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool.
+// Every worker owns a deque: tasks submitted from inside a worker go to the
+// back of its own deque and are popped LIFO (good locality for recursive
+// work), idle workers steal FIFO from the front of the other deques so the
+// oldest (usually biggest) pieces of work migrate first.
+class ThreadPool {
+public:
+  using Task = std::function<void()>;
+
+  // the workers charge their tasks to the CpuAccount of the creating thread
+  explicit ThreadPool(int threadCount)
+      : mPending(0), mQueued(0), mStopping(false), mNextQueue(0),
+        mCpuAccount(CpuAccount::current()) {
+    threadCount = (std::max)(1, threadCount);
+    for (int i = 0; i < threadCount; ++i) {
+      mQueues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (int i = 0; i < threadCount; ++i) {
+      mWorkers.emplace_back([this, i]() { workerLoop(i); });
+    }
+  }
+
+  ~ThreadPool() {
+    wait();
+    {
+      std::lock_guard<std::mutex> lock(mSleepMutex);
+      mStopping = true;
+    }
+    mWakeCv.notify_all();
+    for (auto &worker : mWorkers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(Task task) {
+    ++mPending;
+    int index;
+    if (tCurrentPool == this) {
+      index = tWorkerIndex;
+    } else {
+      index = mNextQueue.fetch_add(1) % static_cast<int>(mQueues.size());
+    }
+    {
+      std::lock_guard<std::mutex> lock(mQueues[index]->mutex);
+      mQueues[index]->tasks.push_back(std::move(task));
+    }
+    ++mQueued;
+    {
+      std::lock_guard<std::mutex> lock(mSleepMutex);
+    }
+    mWakeCv.notify_one();
+  }
+
+  // blocks until every submitted task (including tasks spawned by tasks) is
+  // finished
+  void wait() {
+    std::unique_lock<std::mutex> lock(mSleepMutex);
+    mDoneCv.wait(lock, [this]() { return mPending == 0; });
+  }
+
+  int getThreadCount() const { return static_cast<int>(mWorkers.size()); }
+
+  // index of the calling worker thread in its pool, -1 outside of a pool
+  static int getWorkerIndex() { return tWorkerIndex; }
+
+  static int defaultThreadCount() {
+    unsigned int count = std::thread::hardware_concurrency();
+    return count == 0 ? 1 : static_cast<int>(count);
+  }
+
+private:
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<WorkQueue>> mQueues;
+  std::vector<std::thread> mWorkers;
+
+  std::atomic<int> mPending;
+  std::atomic<int> mQueued;
+  bool mStopping;
+  std::atomic<int> mNextQueue;
+
+  CpuAccount *mCpuAccount;
+
+  std::mutex mSleepMutex;
+  std::condition_variable mWakeCv;
+  std::condition_variable mDoneCv;
+
+  static inline thread_local ThreadPool *tCurrentPool = nullptr;
+  static inline thread_local int tWorkerIndex = -1;
+
+  bool tryPop(int index, Task &task) {
+    WorkQueue &queue = *mQueues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      return false;
+    }
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+  }
+
+  bool trySteal(int thief, Task &task) {
+    const int queueCount = static_cast<int>(mQueues.size());
+    for (int offset = 1; offset < queueCount; ++offset) {
+      WorkQueue &queue = *mQueues[(thief + offset) % queueCount];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void workerLoop(int index) {
+    tCurrentPool = this;
+    tWorkerIndex = index;
+    // pools created by the tasks charge the same account
+    const CpuAccount::Scope cpuScope(mCpuAccount);
+
+    while (true) {
+      Task task;
+      if (tryPop(index, task) || trySteal(index, task)) {
+        --mQueued;
+        if (mCpuAccount) {
+          const double cpuStart = threadCpuTimeMs();
+          task();
+          mCpuAccount->addPooledMs(threadCpuTimeMs() - cpuStart);
+        } else {
+          task();
+        }
+        if (--mPending == 0) {
+          std::lock_guard<std::mutex> lock(mSleepMutex);
+          mDoneCv.notify_all();
+        }
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(mSleepMutex);
+      mWakeCv.wait(lock, [this]() { return mStopping || mQueued > 0; });
+      if (mStopping && mQueued == 0) {
+        return;
+      }
+    }
+  }
+};
+
+#endif